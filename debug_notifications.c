@@ -20,7 +20,7 @@ int main() {
     int count;
     
     printf("1. All items in database:\n");
-    if (db_get_items(VIEW_MONTH, &items, &count) == 0) {
+    if (db_get_items(NULL, VIEW_MONTH, &items, &count) == 0) {
         for (int i = 0; i < count; i++) {
             printf("   ID: %d, Date: %s, Time: %s, Description: %s\n", 
                    items[i].id, items[i].date, items[i].time, items[i].description);
@@ -37,28 +37,21 @@ int main() {
     print_timestamp(now);
     printf(")\n\n");
     
-    // Check notification window (using the correct logic from database.c)
-    time_t target_time = now + (NOTIFICATION_ADVANCE_MINUTES * 60);
-    time_t notification_start = target_time - 30; // 30 seconds before the 15-minute mark
-    time_t notification_end = target_time + 30;   // 30 seconds after the 15-minute mark
-    
-    printf("3. Notification window:\n");
-    printf("   Start: %ld (", notification_start);
-    print_timestamp(notification_start);
-    printf(")\n   End:   %ld (", notification_end);
-    print_timestamp(notification_end);
-    printf(")\n\n");
-    
-    // Check for pending notifications
-    printf("4. Pending notifications:\n");
-    if (db_get_pending_notifications(&items, &count) == 0) {
-        printf("   Found %d pending notifications\n", count);
+    // Check reminders that are due now
+    reminder_t* reminders;
+    printf("3. Due reminders:\n");
+    if (db_get_due_reminders(NULL, now, &reminders, &count) == 0) {
+        printf("   Found %d due reminders\n", count);
         for (int i = 0; i < count; i++) {
-            printf("   - %s at %s: %s\n", items[i].date, items[i].time, items[i].description);
+            printf("   - %s at %s: %s (%d minutes before, fire at ",
+                   reminders[i].item.date, reminders[i].item.time,
+                   reminders[i].item.description, reminders[i].offset_minutes);
+            print_timestamp(reminders[i].fire_at);
+            printf(")\n");
         }
-        if (items) free(items);
+        if (reminders) free(reminders);
     } else {
-        printf("   Error getting pending notifications\n");
+        printf("   Error getting due reminders\n");
     }
     
     db_close();
@@ -4,21 +4,68 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sqlite3.h>
 #include <pthread.h>
 #include <microhttpd.h>
-#include <raylib.h>
 
 // Configuration
 #define SERVER_PORT 8080
 #define DB_PATH "agenda.db"
+#define SERVER_PID_PATH "algen-server.pid"   // Locked while a server runs in this directory
+#define SERVER_SOCKET_PATH "algen-server.sock" // Clients hand the server their writes here
+#define SERVER_LOG_PATH "algen-server.log"   // Output of a server started with --daemon
+#define SERVER_CONFIG_PATH "algen.conf"      // Read at start and on SIGHUP
+#define SERVER_START_TIMEOUT_SECONDS 10
+#define ARCHIVE_DB_PATH "agenda_archive.db"  // Attached as "archive"
+#define CALENDAR_DIR "calendars"           // Named calendars: <dir>/<name>.db
+#define CALENDAR_NAME_LEN 64
+#define CALENDAR_CACHE_SIZE 64             // Open named calendars kept around
+#define CALENDAR_IDLE_SECONDS 600          // Idle calendars closed by maintenance
+#define ARCHIVE_RETENTION_DAYS 90          // Items older than this move to the archive
+#define ARCHIVE_BATCH_SIZE 500             // Items moved per transaction
+#define VACUUM_SLICE_PAGES 128             // Pages freed per incremental_vacuum step
+#define MAINTENANCE_INTERVAL_SECONDS 3600
+#define BACKUP_STEP_PAGES 256               // Pages copied per sqlite3_backup_step
+#define BACKUP_YIELD_MS 2                   // Pause between steps so writers get in
+#define BACKUP_INTERVAL_SECONDS (24 * 3600) // Scheduled backups (--backup=<path>)
 #define MAX_DESCRIPTION_LEN 256
 #define MAX_DATE_LEN 32
 #define MAX_TIME_LEN 16
-#define NOTIFICATION_ADVANCE_MINUTES 15
+#define NOTIFICATION_ADVANCE_MINUTES 15 // Default reminder offset
+#define REMINDER_RETRY_SECONDS 30       // After a failed reminder check
+#define MAX_REMINDERS 8                 // Offsets per item
+#define MAX_REMINDER_OFFSET_MINUTES (366 * 24 * 60) // Earliest reminder before its item
+#define MAX_TAGS 8                      // Tags per item
+#define MAX_TAG_LEN 32                  // Including the NUL
+#define SEARCH_RESULT_LIMIT 50
+#define TAG_LOOKUP_MAX_ITEMS 1024         // Smaller tag filters read their items by id
+#define FREEBUSY_DEFAULT_DAYS 30           // Range of /freebusy without a 'to' date
+#define MAX_DURATION_MINUTES (7 * 24 * 60) // Longest item --for/--until accept
+#define SEARCH_MATCH_START '\x02'         // Brackets matched terms in snippets
+#define SEARCH_MATCH_END '\x03'
+#define WRITE_GROUP_MAX 256                // Writes sharing one commit
+#define WRITE_GROUP_WINDOW_US 500          // How long a group waits for company
+#define WRITE_CHANNEL_MAX_CLIENTS 64       // Client writes handled at once; more wait their turn
+#define WRITE_CHANNEL_TIMEOUT_SECONDS 5    // A client that sends nothing for this long is dropped
+#define REPLICATION_POLL_MS 200            // How often a primary checks for new changes
+#define REPLICATION_BATCH_SIZE 500         // Changes per replica transaction
+#define REPLICATION_HEARTBEAT_SECONDS 5
+#define REPLICATION_LOG_RETAIN 100000      // Change log rows kept for lagging replicas
+#define WEB_WORKER_THREADS 4               // Threads rendering pages off the event loop
+#define WEB_QUEUE_DEPTH 64                 // Renders waiting beyond this get a 503
+#define ICS_EXPORT_CHUNK_ITEMS 5000        // Larger exports render in chunks of about this many items
+#define ICS_EXPORT_MAX_THREADS 16          // Export pool: one thread per core up to this
+#define ARENA_BLOCK_SIZE (64 * 1024)       // First block of a page's arena; larger pages chain more
+#define ICS_LINE_OCTETS 75                 // RFC 5545 folds longer content lines
+#define NOTIFY_DEFAULT_BACKENDS "popup,desktop"
+#define NOTIFY_RUNTIME_DIR_FMT "/tmp/algen-%u"   // Private 0700 directory when $XDG_RUNTIME_DIR is unset
+#define NOTIFY_SOCKET_NAME "algen-stack.sock"
+#define NOTIFY_LOCK_NAME "algen-stack.lock"
+#define NOTIFICATION_QUEUE_CAPACITY 256   // Power of two; notifications waiting for algen-stack to draw
 
 // Structures
 typedef struct {
@@ -28,17 +75,150 @@ typedef struct {
     char description[MAX_DESCRIPTION_LEN];
     time_t datetime;             // Unix timestamp for easy comparison
     int notified;                // 0 = not notified, 1 = notified
+    time_t end_datetime;         // 0 = no end; the item takes no time
 } agenda_item_t;
 
-typedef struct notification_window {
+// One reminder of an item, fired offset_minutes before it
+typedef struct {
+    int id;
+    int offset_minutes;
+    time_t fire_at;              // Precomputed item datetime - offset
+    agenda_item_t item;
+} reminder_t;
+
+// One full-text search hit, best first
+typedef struct {
+    agenda_item_t item;
+    char snippet[MAX_DESCRIPTION_LEN + 64];
+    double rank;                 // bm25, lower is better
+} search_result_t;
+
+// A tag and how many items carry it
+typedef struct {
+    char tag[MAX_TAG_LEN];
+    int item_count;
+} tag_count_t;
+
+// Compressed set of item ids (src/bitmap.c)
+typedef struct bitmap bitmap_t;
+
+// A named calendar: its own database and archive files, opened on first
+// use and cached. NULL stands for the default calendar (DB_PATH).
+typedef struct calendar {
+    char name[CALENDAR_NAME_LEN];
+    char path[CALENDAR_NAME_LEN + 32];
+    char archive_path[CALENDAR_NAME_LEN + 32];
+    sqlite3* conn;
+    int refcount;                // Users holding it; only idle ones are evicted
+    int opening;                 // Set while one thread opens the database
+    time_t last_used;
+    struct calendar* lru_prev;   // Most recently used first
+    struct calendar* lru_next;
+    struct calendar* hash_next;
+} calendar_t;
+
+// Aggregates of one day, maintained by triggers
+typedef struct {
+    char date[MAX_DATE_LEN];     // YYYY-MM-DD format
+    int item_count;
+    int notified_count;
+    char first_time[MAX_TIME_LEN];
+    char last_time[MAX_TIME_LEN];
+} day_stats_t;
+
+// Outcome of one verified online backup
+typedef struct {
+    int pages;                   // Pages copied, both files
+    int rows;                    // Items in the copy, both files
+    double seconds;
+} backup_stats_t;
+
+// Settings for the server's maintenance thread
+typedef struct {
+    int retention_days;          // 0 keeps everything in the hot table
+    char backup_path[256];       // Empty disables scheduled backups
+} maintenance_config_t;
+
+// Wire format of a notification sent to the algen-stack instance
+typedef struct {
     char title[64];
     char message[512];
     char time_str[32];
-    float slideOffset;
-    float autoCloseTimer;
-    int position_index;
-    struct notification_window* next;
-} notification_window_t;
+} notification_msg_t;
+
+// A notification delivery backend, selected at runtime by name
+typedef struct {
+    const char* name;
+    int (*init)(const char* arg);   // arg is the text after "name:", or NULL
+    int (*deliver)(const char* title, const char* message, const char* time_str);
+    void (*shutdown)(void);
+} notification_backend_t;
+
+// What woke the server's event loop
+typedef enum {
+    EVENT_SHUTDOWN,              // SIGINT or SIGTERM
+    EVENT_RELOAD,                // SIGHUP
+    EVENT_DEADLINE,              // The time set with event_loop_set_deadline passed
+    EVENT_WAKE                   // event_loop_wake, or SIGUSR1 from a client
+} event_t;
+
+// Handles one event on the loop thread; nonzero stops the loop
+typedef int (*event_handler_t)(event_t event);
+
+// A bounded pool of threads; jobs are opaque pointers handed to one
+// function, along with the index of the thread running it
+typedef struct worker_pool worker_pool_t;
+typedef void (*worker_job_fn)(void* job, int worker);
+
+// Page templates, compiled from templates/*.tmpl into tables of static
+// fragments and typed slots (build/templates.h)
+typedef enum {
+    SLOT_NONE,                   // A static fragment
+    SLOT_TEXT,                   // String, HTML-escaped
+    SLOT_RAW,                    // String inserted as is
+    SLOT_INT
+} template_slot_type_t;
+
+typedef struct {
+    const char* fragment;        // NULL for a slot
+    size_t length;
+    template_slot_type_t type;
+    int slot;                    // Index into the values given to template_emit
+} template_part_t;
+
+typedef struct {
+    const char* name;
+    const template_part_t* parts;
+    int part_count;
+    int slot_count;
+} template_t;
+
+// The value of one slot: text for TEXT and RAW slots, number for INT slots
+typedef struct {
+    const char* text;
+    long number;
+} template_value_t;
+
+// One piece of rendered output, laid out like struct iovec
+typedef struct {
+    const void* iov_base;
+    size_t iov_len;
+} template_iovec_t;
+
+// Bump allocator holding everything one page render allocates
+typedef struct arena arena_t;
+
+// Rendered output: a list of pieces pointing at template fragments, at the
+// caller's values and at arena memory for escaped and formatted values.
+// Values must stay valid until the output is joined.
+typedef struct {
+    template_iovec_t* pieces;
+    int piece_count;
+    int piece_capacity;
+    size_t length;               // Bytes over all pieces
+    arena_t* arena;              // Pieces, values and the joined page
+    int failed;                  // Ran out of memory; joining returns NULL
+} template_output_t;
 
 typedef enum {
     VIEW_TODAY,
@@ -48,47 +228,206 @@ typedef enum {
 
 // Function prototypes
 
-// Database functions
+// Database functions. Each takes the calendar to work on; NULL is the
+// default calendar. Functions taking an arena return their rows in it, or
+// in memory for the caller to free when the arena is NULL.
 int db_init(void);
-int db_add_item(const char* date, const char* time, const char* description);
-int db_get_items(view_type_t view, agenda_item_t** items, int* count);
-int db_get_pending_notifications(agenda_item_t** items, int* count);
-int db_mark_notified(int id);
-int db_remove_item(int id);
+int db_open_calendar(const char* path, const char* archive_path, int create, sqlite3** conn);
+int db_open_reader(const char* path, const char* archive_path, sqlite3** conn);
+int db_add_item(calendar_t* cal, const char* date, const char* time, const char* description);
+int db_add_item_with_reminders(calendar_t* cal, const char* date, const char* time, int duration_minutes,
+                               const char* description, const int* offsets, int offset_count,
+                               char (*tags)[MAX_TAG_LEN], int tag_count);
+int db_get_items(calendar_t* cal, arena_t* arena, view_type_t view, agenda_item_t** items, int* count);
+int db_get_items_between(calendar_t* cal, arena_t* arena, time_t start, time_t end, const bitmap_t* filter,
+                         agenda_item_t** items, int* count);
+int db_get_item_bounds(calendar_t* cal, time_t start, time_t end, int* count, time_t* first, time_t* last);
+int db_get_overlapping_items(calendar_t* cal, arena_t* arena, time_t start, time_t end,
+                             agenda_item_t** items, int* count);
+int db_get_due_reminders(calendar_t* cal, time_t now, reminder_t** reminders, int* count);
+int db_claim_due_reminders(calendar_t* cal, time_t now, reminder_t** reminders, int* count);
+int db_search_items(calendar_t* cal, arena_t* arena, const char* terms, time_t from, time_t to, int limit,
+                    search_result_t** results, int* count);
+int db_get_day_stats(calendar_t* cal, arena_t* arena, const char* from_date, const char* to_date,
+                     day_stats_t** stats, int* count);
+int db_mark_notified(calendar_t* cal, int id);
+int db_remove_item(calendar_t* cal, int id);
+int db_archive_items(calendar_t* cal, time_t cutoff, int* archived);
+int db_run_maintenance(calendar_t* cal, int retention_days);
+int db_backup(calendar_t* cal, const char* path, backup_stats_t* stats);
+int db_next_reminder_time(calendar_t* cal, time_t* fire_at);
+int db_get_tags_version(calendar_t* cal, long long* version);
+int db_each_item_tag(calendar_t* cal, int (*visit)(const char* tag, int item_id, void* context), void* context);
+int db_writer_start(void);
+void db_set_commit_hook(void (*hook)(void));
+void db_writer_stop(void);
 void db_close(void);
+void db_count_statements(int enabled);
+unsigned long db_statement_count(void);
+
+// Calendar cache functions (named calendars)
+int calendar_name_is_valid(const char* name);
+int calendar_exists(const char* name);
+calendar_t* calendar_acquire(const char* name, int create);
+void calendar_release(calendar_t* cal);
+int calendar_cache_trim(int idle_seconds);
+void calendar_cache_close_all(void);
+
+// Tag functions (per-calendar bitmap indexes over item_tags)
+int tag_filter(calendar_t* cal, const char* expression, bitmap_t** items);
+int tag_counts(calendar_t* cal, tag_count_t** counts, int* count);
+void tag_index_drop(const char* path);
+void tag_index_close_all(void);
+
+// Bitmap functions
+bitmap_t* bitmap_create(void);
+void bitmap_free(bitmap_t* bitmap);
+int bitmap_add(bitmap_t* bitmap, uint32_t value);
+int bitmap_contains(const bitmap_t* bitmap, uint32_t value);
+uint32_t bitmap_cardinality(const bitmap_t* bitmap);
+uint32_t bitmap_values(const bitmap_t* bitmap, uint32_t* values, uint32_t max);
+bitmap_t* bitmap_copy(const bitmap_t* bitmap);
+bitmap_t* bitmap_and(const bitmap_t* a, const bitmap_t* b);
+bitmap_t* bitmap_or(const bitmap_t* a, const bitmap_t* b);
 
 // Server functions
 int server_start(void);
 void server_stop(void);
 int server_is_running(void);
+pid_t server_running_pid(void);
+int server_acquire_lock(void);
+void server_notify_changed(void);
+
+// Event loop functions (the server's main thread)
+int event_loop_init(void);
+unsigned int event_loop_web_flags(void);
+int event_loop_run(struct MHD_Daemon* web, event_handler_t handler);
+void event_loop_wake(void);
+void event_loop_set_deadline(time_t at);
+void event_loop_close(void);
+
+// Replication functions (change log shipping over a Unix socket)
+int replication_primary_start(const char* socket_path);
+int replication_replica_start(const char* socket_path);
+void replication_stop(void);
 
 // Client functions
 int parse_date_input(const char* input, char* output_date);
 int parse_time_input(const char* input, char* output_time);
 time_t combine_datetime(const char* date, const char* time);
+int parse_reminder_offsets(const char* input, int* offsets, int max_offsets);
+int parse_duration(const char* input);
+int parse_tag(const char* input, size_t length, char* output);
+int parse_tags(const char* input, char (*tags)[MAX_TAG_LEN], int max_tags);
 
 // Notification functions
 int send_notification(const char* title, const char* message);
-int show_visual_notification(const char* title, const char* message, const char* time_str);
-int show_stacked_notifications(void);
-void add_notification_to_stack(const char* title, const char* message, const char* time_str);
+int notifications_configure(const char* spec);
+int deliver_notification(const char* title, const char* message, const char* time_str);
+void notifications_shutdown(void);
+int notifications_dispatch(time_t now, time_t* next_fire_at);
 void* notification_thread(void* arg);
 
+// Maintenance functions (archive moves and incremental vacuum)
+void* maintenance_thread(void* arg);
+void maintenance_configure(const maintenance_config_t* config);
+void stop_maintenance_thread(void);
+
+// Notification IPC functions (algen-stack single instance)
+int notification_ipc_send(const char* title, const char* message, const char* time_str);
+int notification_ipc_deliver(const char* title, const char* message, const char* time_str);
+int notification_ipc_listen(void);
+int notification_ipc_receive(int fd, notification_msg_t* msg);
+int notification_ipc_spawn_stack(void);
+void notification_ipc_close(int fd);
+
+// Write channel functions (clients writing through the server's writer)
+int write_channel_start(int read_only);
+void write_channel_stop(void);
+int write_channel_add(const char* date, const char* time, int duration_minutes, const char* description,
+                      const int* offsets, int offset_count, char (*tags)[MAX_TAG_LEN], int tag_count,
+                      int* result);
+int write_channel_remove(int id, int* result);
+
+// Notification queue functions (any thread to the algen-stack render thread)
+void notification_queue_push(const char* title, const char* message, const char* time_str);
+int notification_queue_pop(notification_msg_t* msg);
+void notification_queue_wait(void);
+
+// Clock functions (calendar time; virtual in simulations)
+time_t clock_now(void);
+void clock_use_virtual(time_t start);
+void clock_advance_to(time_t when);
+int clock_is_virtual(void);
+
+// Arena functions
+arena_t* arena_create(void);
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_grow(arena_t* arena, void* memory, size_t old_size, size_t new_size);
+void arena_shrink(arena_t* arena, void* memory, size_t size);
+void arena_destroy(arena_t* arena);
+
+// Worker pool functions
+worker_pool_t* worker_pool_create(int thread_count, int max_queued, worker_job_fn run);
+int worker_pool_submit(worker_pool_t* pool, void* job);
+void worker_pool_destroy(worker_pool_t* pool);
+
+// Template functions
+void template_output_init(template_output_t* out, arena_t* arena);
+void template_emit(template_output_t* out, const template_t* tmpl, const template_value_t* values);
+char* template_output_alloc(template_output_t* out, size_t size);
+char* template_output_join(template_output_t* out, size_t* length);
+
+// ICS export functions (large ranges rendered in parallel)
+int ics_export_start(void);
+void ics_export_stop(void);
+char* ics_export_chunks(calendar_t* cal, arena_t* arena, time_t start, time_t end, const bitmap_t* filter,
+                        int chunk_count, const char* before, const char* after, size_t* length);
+
 // Web interface functions
+int web_workers_start(void);
+void web_workers_stop(void);
 enum MHD_Result handle_web_request(void* cls, struct MHD_Connection* connection,
                       const char* url, const char* method,
                       const char* version, const char* upload_data,
                       size_t* upload_data_size, void** con_cls);
+void web_request_completed(void* cls, struct MHD_Connection* connection,
+                           void** con_cls, enum MHD_RequestTerminationCode toe);
 
-// Calendar functions
-char* generate_ics_calendar(void);
-char* generate_html_calendar(void);
+// Calendar functions. Pages are built in the arena; length is set to
+// their size.
+char* generate_ics_calendar(calendar_t* cal, arena_t* arena, time_t start, time_t end, const bitmap_t* filter,
+                            size_t* length);
+char* ics_render_events(calendar_t* cal, arena_t* scratch, arena_t* out, time_t start, time_t end,
+                        const bitmap_t* filter, const char* before, const char* after, size_t* length);
+char* generate_html_calendar(calendar_t* cal, arena_t* arena, size_t* length);
+char* generate_html_search(calendar_t* cal, arena_t* arena, const char* terms, const char* from,
+                           const char* to, size_t* length);
+char* generate_html_year(calendar_t* cal, arena_t* arena, int year, size_t* length);
+char* generate_html_week(calendar_t* cal, arena_t* arena, size_t* length);
+char* generate_ics_freebusy(calendar_t* cal, arena_t* arena, time_t start, time_t end, size_t* length);
 
 // Utility functions
 void format_date_for_display(const char* date, char* output);
 void format_time_for_display(const char* time, char* output);
+void format_time_range_for_display(const agenda_item_t* item, char* output, size_t output_size);
+void format_reminder_offset(int offset_minutes, char* output, size_t output_size);
+int parse_search_range(const char* from, const char* to, time_t* start, time_t* end);
+int view_time_range(view_type_t view, time_t now, time_t* start, time_t* end);
 int is_same_day(time_t t1, time_t t2);
 int is_same_week(time_t t1, time_t t2);
 int is_same_month(time_t t1, time_t t2);
 
+// Escaping functions (SIMD scans where the CPU has them)
+// Worst case of ics_append_text: every byte escaped, a fold at least every
+// 71 octets (folds never split an escape or a UTF-8 sequence), CRLF, NUL
+#define ICS_CONTENT_SIZE(name_length, value_length) ((name_length) + 1 + 2 * (value_length))
+#define ICS_TEXT_SIZE(name_length, value_length) \
+    (ICS_CONTENT_SIZE(name_length, value_length) + 3 * (ICS_CONTENT_SIZE(name_length, value_length) / 71 + 1) + 3)
+size_t html_escape(const char* input, char* output, size_t output_size);
+size_t html_escape_find(const char* s, size_t length);
+size_t ics_append_text(char* output, size_t output_size, const char* name, const char* value);
+const char* escape_kernel_name(void);
+int escape_use_kernel(const char* name);
+
 #endif // AGENDA_H
@@ -0,0 +1,32 @@
+#ifndef NOTIFICATION_UI_H
+#define NOTIFICATION_UI_H
+
+#include "agenda.h"
+#include <raylib.h>
+
+// raylib popups, linked only into algen-notify and algen-stack
+
+#define NOTIFICATION_STACK_CAPACITY 8  // Oldest card is dropped when full
+#define NOTIFICATION_ACTIVE_FPS 60     // While sliding or under the pointer
+#define NOTIFICATION_IDLE_FPS 4        // Timer bar updates only
+
+typedef struct notification_window {
+    char title[64];
+    char message[512];
+    char time_str[32];
+    float slideOffset;
+    float autoCloseTimer;
+    RenderTexture2D card;        // Cached static part of the card
+    bool card_loaded;            // card texture allocated for this slot
+    bool card_ready;             // card texture holds this notification
+    int prev;                    // Slot index of the newer neighbour, -1 at the head
+    int next;                    // Slot index of the older neighbour, -1 at the tail
+} notification_window_t;
+
+// Popup functions
+int show_visual_notification(const char* title, const char* message, const char* time_str);
+int show_stacked_notifications(void);
+int serve_stacked_notifications(int ipc_fd);
+void add_notification_to_stack(const char* title, const char* message, const char* time_str);
+
+#endif // NOTIFICATION_UI_H
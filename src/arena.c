@@ -0,0 +1,126 @@
+#include "agenda.h"
+#include <stdint.h>
+
+// Memory for one rendered page: blocks that are only bumped forward and
+// freed all at once. The arena lives at the start of its first block, so a
+// page that fits in ARENA_BLOCK_SIZE costs a single malloc. Larger pages
+// chain blocks of twice the size. The finished page stays in the arena,
+// which is freed once libmicrohttpd has sent it.
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block arena_block_t;
+
+struct arena_block {
+    arena_block_t* next;         // The block filled before this one
+    size_t used;
+    size_t capacity;
+    unsigned char data[];
+};
+
+struct arena {
+    arena_block_t* current;
+    void* last;                  // Latest allocation; may grow or shrink in place
+};
+
+static arena_block_t* new_block(size_t capacity) {
+    arena_block_t* block = malloc(sizeof(arena_block_t) + capacity);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->used = 0;
+    block->capacity = capacity;
+    return block;
+}
+
+// Offset of the next aligned byte in block
+static size_t aligned_used(const arena_block_t* block) {
+    uintptr_t next = (uintptr_t)(block->data + block->used);
+    uintptr_t aligned = (next + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1);
+    return block->used + (aligned - next);
+}
+
+static void* bump(arena_block_t* block, size_t size) {
+    size_t offset = aligned_used(block);
+    if (offset > block->capacity || block->capacity - offset < size) {
+        return NULL;
+    }
+    block->used = offset + size;
+    return block->data + offset;
+}
+
+arena_t* arena_create(void) {
+    arena_block_t* block = new_block(ARENA_BLOCK_SIZE);
+    if (!block) {
+        return NULL;
+    }
+    arena_t* arena = bump(block, sizeof(arena_t));
+    arena->current = block;
+    arena->last = NULL;
+    return arena;
+}
+
+// Returns size bytes, aligned for any type and valid until the arena is
+// destroyed. NULL when out of memory.
+void* arena_alloc(arena_t* arena, size_t size) {
+    void* memory = bump(arena->current, size);
+    if (!memory) {
+        size_t capacity = arena->current->capacity * 2;
+        if (capacity < size + ARENA_ALIGNMENT) {
+            capacity = size + ARENA_ALIGNMENT;
+        }
+        arena_block_t* block = new_block(capacity);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->current;
+        arena->current = block;
+        memory = bump(block, size);
+    }
+    arena->last = memory;
+    return memory;
+}
+
+// Resizes an allocation of old_size bytes. The latest allocation grows in
+// place while its block has room; anything else is copied to new memory.
+void* arena_grow(arena_t* arena, void* memory, size_t old_size, size_t new_size) {
+    if (!memory) {
+        return arena_alloc(arena, new_size);
+    }
+
+    arena_block_t* block = arena->current;
+    if (memory == arena->last) {
+        size_t offset = (unsigned char*)memory - block->data;
+        if (block->capacity - offset >= new_size) {
+            block->used = offset + new_size;
+            return memory;
+        }
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+    if (grown) {
+        memcpy(grown, memory, old_size < new_size ? old_size : new_size);
+    }
+    return grown;
+}
+
+// Gives back the tail past size bytes if memory is the latest allocation
+void arena_shrink(arena_t* arena, void* memory, size_t size) {
+    if (memory && memory == arena->last) {
+        arena->current->used = ((unsigned char*)memory - arena->current->data) + size;
+    }
+}
+
+void arena_destroy(arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+    // The arena itself is in the first block, freed last
+    arena_block_t* block = arena->current;
+    while (block) {
+        arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+}
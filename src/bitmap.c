@@ -0,0 +1,455 @@
+#include "agenda.h"
+
+// Compressed sets of item ids in the style of roaring bitmaps. Ids are
+// split on their high 16 bits into containers kept in key order. A
+// container holding at most BITMAP_ARRAY_MAX values is a sorted array of
+// their low 16 bits; a fuller one is a 65,536-bit bitmap. Sparse tags
+// cost two bytes an item, dense ones one bit, and AND and OR work a
+// container at a time: merging arrays, probing or masking bitmaps. Run
+// containers are left out; item ids are handed out in order and rarely
+// form long runs within one tag.
+
+#define BITMAP_ARRAY_MAX 4096             // Above this a bitmap is smaller
+#define BITMAP_WORDS (65536 / 64)
+
+typedef struct {
+    uint16_t key;                // High 16 bits of every value in it
+    uint16_t is_bitmap;
+    uint32_t cardinality;
+    uint32_t capacity;           // Array slots allocated
+    union {
+        uint16_t* values;        // Sorted, when an array
+        uint64_t* words;         // When a bitmap
+    } data;
+} container_t;
+
+struct bitmap {
+    container_t* containers;     // In key order
+    int count;
+    int capacity;
+};
+
+static void container_free(container_t* container) {
+    if (container->is_bitmap) {
+        free(container->data.words);
+    } else {
+        free(container->data.values);
+    }
+}
+
+static int array_find(const uint16_t* values, uint32_t count, uint16_t low) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (values[mid] < low) lo = mid + 1;
+        else hi = mid;
+    }
+    return (int)lo;
+}
+
+static int bitmap_test(const uint64_t* words, uint16_t low) {
+    return (words[low >> 6] >> (low & 63)) & 1;
+}
+
+// Turns a full array container into a bitmap
+static int container_to_bitmap(container_t* container) {
+    uint64_t* words = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    if (!words) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < container->cardinality; i++) {
+        uint16_t low = container->data.values[i];
+        words[low >> 6] |= (uint64_t)1 << (low & 63);
+    }
+    free(container->data.values);
+    container->data.words = words;
+    container->is_bitmap = 1;
+    container->capacity = 0;
+    return 0;
+}
+
+// Gives a bitmap container of at most BITMAP_ARRAY_MAX values back its
+// array form
+static int container_shrink(container_t* container) {
+    if (!container->is_bitmap || container->cardinality > BITMAP_ARRAY_MAX) {
+        return 0;
+    }
+    uint16_t* values = malloc((container->cardinality ? container->cardinality : 1) * sizeof(uint16_t));
+    if (!values) {
+        return -1;
+    }
+    uint32_t n = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++) {
+        for (uint64_t word = container->data.words[w]; word; word &= word - 1) {
+            values[n++] = (uint16_t)(w * 64 + __builtin_ctzll(word));
+        }
+    }
+    free(container->data.words);
+    container->data.values = values;
+    container->is_bitmap = 0;
+    container->capacity = container->cardinality;
+    return 0;
+}
+
+static container_t* append_container(bitmap_t* bitmap, uint16_t key) {
+    if (bitmap->count == bitmap->capacity) {
+        int capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+        container_t* grown = realloc(bitmap->containers, capacity * sizeof(container_t));
+        if (!grown) {
+            return NULL;
+        }
+        bitmap->containers = grown;
+        bitmap->capacity = capacity;
+    }
+    container_t* container = &bitmap->containers[bitmap->count++];
+    memset(container, 0, sizeof(container_t));
+    container->key = key;
+    return container;
+}
+
+static int find_container(const bitmap_t* bitmap, uint16_t key) {
+    int lo = 0, hi = bitmap->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (bitmap->containers[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bitmap_t* bitmap_create(void) {
+    return calloc(1, sizeof(bitmap_t));
+}
+
+void bitmap_free(bitmap_t* bitmap) {
+    if (!bitmap) {
+        return;
+    }
+    for (int i = 0; i < bitmap->count; i++) {
+        container_free(&bitmap->containers[i]);
+    }
+    free(bitmap->containers);
+    free(bitmap);
+}
+
+// Adds value. Adding in increasing order, as the index build does, only
+// ever appends. Returns -1 when out of memory.
+int bitmap_add(bitmap_t* bitmap, uint32_t value) {
+    uint16_t key = value >> 16;
+    uint16_t low = value & 0xFFFF;
+
+    int index = find_container(bitmap, key);
+    container_t* container;
+    if (index < bitmap->count && bitmap->containers[index].key == key) {
+        container = &bitmap->containers[index];
+    } else {
+        if (!append_container(bitmap, key)) {
+            return -1;
+        }
+        // Keep key order when the new container isn't the last
+        container_t added = bitmap->containers[bitmap->count - 1];
+        memmove(&bitmap->containers[index + 1], &bitmap->containers[index],
+                (bitmap->count - 1 - index) * sizeof(container_t));
+        bitmap->containers[index] = added;
+        container = &bitmap->containers[index];
+    }
+
+    if (container->is_bitmap) {
+        if (!bitmap_test(container->data.words, low)) {
+            container->data.words[low >> 6] |= (uint64_t)1 << (low & 63);
+            container->cardinality++;
+        }
+        return 0;
+    }
+
+    uint32_t position = (container->cardinality && container->data.values[container->cardinality - 1] < low)
+        ? container->cardinality
+        : (uint32_t)array_find(container->data.values, container->cardinality, low);
+    if (position < container->cardinality && container->data.values[position] == low) {
+        return 0;
+    }
+
+    if (container->cardinality == BITMAP_ARRAY_MAX) {
+        if (container_to_bitmap(container) != 0) {
+            return -1;
+        }
+        container->data.words[low >> 6] |= (uint64_t)1 << (low & 63);
+        container->cardinality++;
+        return 0;
+    }
+
+    if (container->cardinality == container->capacity) {
+        uint32_t capacity = container->capacity ? container->capacity * 2 : 4;
+        if (capacity > BITMAP_ARRAY_MAX) capacity = BITMAP_ARRAY_MAX;
+        uint16_t* grown = realloc(container->data.values, capacity * sizeof(uint16_t));
+        if (!grown) {
+            return -1;
+        }
+        container->data.values = grown;
+        container->capacity = capacity;
+    }
+    memmove(&container->data.values[position + 1], &container->data.values[position],
+            (container->cardinality - position) * sizeof(uint16_t));
+    container->data.values[position] = low;
+    container->cardinality++;
+    return 0;
+}
+
+int bitmap_contains(const bitmap_t* bitmap, uint32_t value) {
+    uint16_t key = value >> 16;
+    uint16_t low = value & 0xFFFF;
+
+    int index = find_container(bitmap, key);
+    if (index >= bitmap->count || bitmap->containers[index].key != key) {
+        return 0;
+    }
+    const container_t* container = &bitmap->containers[index];
+    if (container->is_bitmap) {
+        return bitmap_test(container->data.words, low);
+    }
+    uint32_t position = array_find(container->data.values, container->cardinality, low);
+    return position < container->cardinality && container->data.values[position] == low;
+}
+
+uint32_t bitmap_cardinality(const bitmap_t* bitmap) {
+    uint32_t total = 0;
+    for (int i = 0; i < bitmap->count; i++) {
+        total += bitmap->containers[i].cardinality;
+    }
+    return total;
+}
+
+// Writes up to max values to values in increasing order; returns how many
+uint32_t bitmap_values(const bitmap_t* bitmap, uint32_t* values, uint32_t max) {
+    uint32_t n = 0;
+    for (int i = 0; i < bitmap->count && n < max; i++) {
+        const container_t* container = &bitmap->containers[i];
+        uint32_t high = (uint32_t)container->key << 16;
+        if (container->is_bitmap) {
+            for (int w = 0; w < BITMAP_WORDS && n < max; w++) {
+                for (uint64_t word = container->data.words[w]; word && n < max; word &= word - 1) {
+                    values[n++] = high | (uint32_t)(w * 64 + __builtin_ctzll(word));
+                }
+            }
+        } else {
+            for (uint32_t j = 0; j < container->cardinality && n < max; j++) {
+                values[n++] = high | container->data.values[j];
+            }
+        }
+    }
+    return n;
+}
+
+static int copy_container(bitmap_t* out, const container_t* container) {
+    container_t* copy = append_container(out, container->key);
+    if (!copy) {
+        return -1;
+    }
+    copy->is_bitmap = container->is_bitmap;
+    copy->cardinality = container->cardinality;
+    if (container->is_bitmap) {
+        copy->data.words = malloc(BITMAP_WORDS * sizeof(uint64_t));
+        if (!copy->data.words) {
+            return -1;
+        }
+        memcpy(copy->data.words, container->data.words, BITMAP_WORDS * sizeof(uint64_t));
+    } else {
+        copy->capacity = container->cardinality ? container->cardinality : 1;
+        copy->data.values = malloc(copy->capacity * sizeof(uint16_t));
+        if (!copy->data.values) {
+            return -1;
+        }
+        memcpy(copy->data.values, container->data.values, container->cardinality * sizeof(uint16_t));
+    }
+    return 0;
+}
+
+// An array container for the result, with room for capacity values
+static container_t* new_array(bitmap_t* out, uint16_t key, uint32_t capacity) {
+    container_t* container = append_container(out, key);
+    if (!container) {
+        return NULL;
+    }
+    container->capacity = capacity ? capacity : 1;
+    container->data.values = malloc(container->capacity * sizeof(uint16_t));
+    return container->data.values ? container : NULL;
+}
+
+static container_t* new_bitmap(bitmap_t* out, uint16_t key) {
+    container_t* container = append_container(out, key);
+    if (!container) {
+        return NULL;
+    }
+    container->is_bitmap = 1;
+    container->data.words = malloc(BITMAP_WORDS * sizeof(uint64_t));
+    return container->data.words ? container : NULL;
+}
+
+static int and_containers(bitmap_t* out, const container_t* a, const container_t* b) {
+    // Probe the smaller side when only one is an array
+    if (a->is_bitmap && !b->is_bitmap) {
+        const container_t* swap = a;
+        a = b;
+        b = swap;
+    }
+
+    if (!a->is_bitmap) {
+        container_t* result = new_array(out, a->key, a->cardinality < b->cardinality ? a->cardinality : b->cardinality);
+        if (!result) {
+            return -1;
+        }
+        uint32_t n = 0;
+        if (b->is_bitmap) {
+            for (uint32_t i = 0; i < a->cardinality; i++) {
+                if (bitmap_test(b->data.words, a->data.values[i])) {
+                    result->data.values[n++] = a->data.values[i];
+                }
+            }
+        } else {
+            uint32_t i = 0, j = 0;
+            while (i < a->cardinality && j < b->cardinality) {
+                if (a->data.values[i] < b->data.values[j]) i++;
+                else if (a->data.values[i] > b->data.values[j]) j++;
+                else {
+                    result->data.values[n++] = a->data.values[i];
+                    i++;
+                    j++;
+                }
+            }
+        }
+        result->cardinality = n;
+    } else {
+        container_t* result = new_bitmap(out, a->key);
+        if (!result) {
+            return -1;
+        }
+        uint32_t cardinality = 0;
+        for (int w = 0; w < BITMAP_WORDS; w++) {
+            result->data.words[w] = a->data.words[w] & b->data.words[w];
+            cardinality += __builtin_popcountll(result->data.words[w]);
+        }
+        result->cardinality = cardinality;
+        if (container_shrink(result) != 0) {
+            return -1;
+        }
+    }
+
+    // Empty intersections leave no container behind
+    if (out->containers[out->count - 1].cardinality == 0) {
+        container_free(&out->containers[--out->count]);
+    }
+    return 0;
+}
+
+static int or_containers(bitmap_t* out, const container_t* a, const container_t* b) {
+    if (!a->is_bitmap && !b->is_bitmap && a->cardinality + b->cardinality <= BITMAP_ARRAY_MAX) {
+        container_t* result = new_array(out, a->key, a->cardinality + b->cardinality);
+        if (!result) {
+            return -1;
+        }
+        uint32_t i = 0, j = 0, n = 0;
+        while (i < a->cardinality || j < b->cardinality) {
+            if (j == b->cardinality || (i < a->cardinality && a->data.values[i] < b->data.values[j])) {
+                result->data.values[n++] = a->data.values[i++];
+            } else if (i == a->cardinality || b->data.values[j] < a->data.values[i]) {
+                result->data.values[n++] = b->data.values[j++];
+            } else {
+                result->data.values[n++] = a->data.values[i++];
+                j++;
+            }
+        }
+        result->cardinality = n;
+        return 0;
+    }
+
+    container_t* result = new_bitmap(out, a->key);
+    if (!result) {
+        return -1;
+    }
+    memset(result->data.words, 0, BITMAP_WORDS * sizeof(uint64_t));
+    const container_t* sides[2] = { a, b };
+    for (int s = 0; s < 2; s++) {
+        const container_t* side = sides[s];
+        if (side->is_bitmap) {
+            for (int w = 0; w < BITMAP_WORDS; w++) {
+                result->data.words[w] |= side->data.words[w];
+            }
+        } else {
+            for (uint32_t i = 0; i < side->cardinality; i++) {
+                uint16_t low = side->data.values[i];
+                result->data.words[low >> 6] |= (uint64_t)1 << (low & 63);
+            }
+        }
+    }
+    uint32_t cardinality = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++) {
+        cardinality += __builtin_popcountll(result->data.words[w]);
+    }
+    result->cardinality = cardinality;
+    return container_shrink(result);
+}
+
+// A copy the caller owns; NULL when out of memory
+bitmap_t* bitmap_copy(const bitmap_t* bitmap) {
+    bitmap_t* out = bitmap_create();
+    if (!out) {
+        return NULL;
+    }
+    for (int i = 0; i < bitmap->count; i++) {
+        if (copy_container(out, &bitmap->containers[i]) != 0) {
+            bitmap_free(out);
+            return NULL;
+        }
+    }
+    return out;
+}
+
+// Values in both a and b, as a new bitmap; NULL when out of memory
+bitmap_t* bitmap_and(const bitmap_t* a, const bitmap_t* b) {
+    bitmap_t* out = bitmap_create();
+    if (!out) {
+        return NULL;
+    }
+    int i = 0, j = 0;
+    while (i < a->count && j < b->count) {
+        uint16_t key_a = a->containers[i].key;
+        uint16_t key_b = b->containers[j].key;
+        if (key_a < key_b) {
+            i++;
+        } else if (key_a > key_b) {
+            j++;
+        } else {
+            if (and_containers(out, &a->containers[i], &b->containers[j]) != 0) {
+                bitmap_free(out);
+                return NULL;
+            }
+            i++;
+            j++;
+        }
+    }
+    return out;
+}
+
+// Values in a or b, as a new bitmap; NULL when out of memory
+bitmap_t* bitmap_or(const bitmap_t* a, const bitmap_t* b) {
+    bitmap_t* out = bitmap_create();
+    if (!out) {
+        return NULL;
+    }
+    int i = 0, j = 0;
+    while (i < a->count || j < b->count) {
+        int rc;
+        if (j == b->count || (i < a->count && a->containers[i].key < b->containers[j].key)) {
+            rc = copy_container(out, &a->containers[i++]);
+        } else if (i == a->count || b->containers[j].key < a->containers[i].key) {
+            rc = copy_container(out, &b->containers[j++]);
+        } else {
+            rc = or_containers(out, &a->containers[i++], &b->containers[j++]);
+        }
+        if (rc != 0) {
+            bitmap_free(out);
+            return NULL;
+        }
+    }
+    return out;
+}
@@ -1,33 +1,42 @@
+#define _DEFAULT_SOURCE
 #include "agenda.h"
+#include "templates.h"
 
-char* generate_ics_calendar(void) {
+static const char ics_calendar_begin[] =
+    "BEGIN:VCALENDAR\r\n"
+    "VERSION:2.0\r\n"
+    "PRODID:-//Algendado//Personal Agenda//EN\r\n"
+    "CALSCALE:GREGORIAN\r\n";
+static const char ics_calendar_end[] = "END:VCALENDAR\r\n";
+
+// The VEVENTs of the items starting in [start, end), only those in filter
+// unless it is NULL, between before and after. Rows are read into scratch
+// and the text is written to out; they may be the same arena. Also
+// renders one chunk of a parallel export.
+char* ics_render_events(calendar_t* cal, arena_t* scratch, arena_t* out, time_t start, time_t end,
+                        const bitmap_t* filter, const char* before, const char* after, size_t* length) {
     agenda_item_t* items;
     int count;
     
-    // Get all items for the month
-    if (db_get_items(VIEW_MONTH, &items, &count) != 0) {
+    if (db_get_items_between(cal, scratch, start, end, filter, &items, &count) != 0) {
         return NULL;
     }
     
-    // Calculate required buffer size
-    size_t buffer_size = 1024 + (count * 512); // Base size + estimated per item
-    char* ics_content = malloc(buffer_size);
+    // Calculate required buffer size: the fixed lines of an event, then
+    // SUMMARY and DESCRIPTION at their escaped and folded worst case. The
+    // unused tail goes back to the arena at the end.
+    size_t buffer_size = strlen(before) + strlen(after) + 1 +
+                         count * (256 + 2 * ICS_TEXT_SIZE(sizeof("DESCRIPTION"), MAX_DESCRIPTION_LEN));
+    char* ics_content = arena_alloc(out, buffer_size);
     if (!ics_content) {
-        if (items) free(items);
         return NULL;
     }
     
-    // ICS header
-    strcpy(ics_content, "BEGIN:VCALENDAR\r\n");
-    strcat(ics_content, "VERSION:2.0\r\n");
-    strcat(ics_content, "PRODID:-//Algendado//Personal Agenda//EN\r\n");
-    strcat(ics_content, "CALSCALE:GREGORIAN\r\n");
+    size_t used = snprintf(ics_content, buffer_size, "%s", before);
     
     // Add events
     for (int i = 0; i < count; i++) {
-        char event_block[512];
         char start_datetime[32];
-        char uid[64];
         
         // Convert date and time to ICS format (YYYYMMDDTHHMMSS)
         struct tm tm_event = {0};
@@ -37,102 +46,483 @@ char* generate_ics_calendar(void) {
         tm_event.tm_mon -= 1;
         
         strftime(start_datetime, sizeof(start_datetime), "%Y%m%dT%H%M%S", &tm_event);
-        snprintf(uid, sizeof(uid), "agenda-item-%d@algendado", items[i].id);
         
-        snprintf(event_block, sizeof(event_block),
+        used += snprintf(ics_content + used, buffer_size - used,
             "BEGIN:VEVENT\r\n"
-            "UID:%s\r\n"
+            "UID:agenda-item-%d@algendado\r\n"
             "DTSTAMP:%s\r\n"
-            "DTSTART:%s\r\n"
-            "SUMMARY:%s\r\n"
-            "DESCRIPTION:%s\r\n"
-            "END:VEVENT\r\n",
-            uid, start_datetime, start_datetime, 
-            items[i].description, items[i].description);
+            "DTSTART:%s\r\n",
+            items[i].id, start_datetime, start_datetime);
+        
+        // Local time like DTSTART; items without an end have no DTEND
+        if (items[i].end_datetime > 0) {
+            char end_datetime[32];
+            struct tm tm_end;
+            localtime_r(&items[i].end_datetime, &tm_end);
+            strftime(end_datetime, sizeof(end_datetime), "%Y%m%dT%H%M%S", &tm_end);
+            used += snprintf(ics_content + used, buffer_size - used, "DTEND:%s\r\n", end_datetime);
+        }
         
-        strcat(ics_content, event_block);
+        // Descriptions are TEXT values: escaped and folded
+        used += ics_append_text(ics_content + used, buffer_size - used, "SUMMARY", items[i].description);
+        used += ics_append_text(ics_content + used, buffer_size - used, "DESCRIPTION", items[i].description);
+        used += snprintf(ics_content + used, buffer_size - used, "END:VEVENT\r\n");
     }
     
-    // ICS footer
-    strcat(ics_content, "END:VCALENDAR\r\n");
+    used += snprintf(ics_content + used, buffer_size - used, "%s", after);
     
-    if (items) free(items);
+    arena_shrink(out, ics_content, used + 1);
+    *length = used;
     return ics_content;
 }
 
-char* generate_html_calendar(void) {
+// The items starting in [start, end) as a calendar, only those in filter
+// unless it is NULL. More than ICS_EXPORT_CHUNK_ITEMS of them are rendered
+// in chunks on the export pool; the bounds query that decides this reads
+// only the indexes. A filter can't match more items than it holds, so a
+// small one skips the query.
+char* generate_ics_calendar(calendar_t* cal, arena_t* arena, time_t start, time_t end, const bitmap_t* filter,
+                            size_t* length) {
+    int count = 0;
+    time_t first, last;
+    if (!filter || bitmap_cardinality(filter) > ICS_EXPORT_CHUNK_ITEMS) {
+        if (db_get_item_bounds(cal, start, end, &count, &first, &last) != 0) {
+            return NULL;
+        }
+        if (filter && bitmap_cardinality(filter) < (uint32_t)count) {
+            count = (int)bitmap_cardinality(filter);
+        }
+    }
+    
+    if (count > ICS_EXPORT_CHUNK_ITEMS) {
+        int chunk_count = (count + ICS_EXPORT_CHUNK_ITEMS - 1) / ICS_EXPORT_CHUNK_ITEMS;
+        return ics_export_chunks(cal, arena, first, last + 1, filter, chunk_count,
+                                 ics_calendar_begin, ics_calendar_end, length);
+    }
+    return ics_render_events(cal, arena, arena, start, end, filter, ics_calendar_begin, ics_calendar_end, length);
+}
+
+static void format_utc(time_t t, char* output, size_t output_size) {
+    struct tm tm_utc;
+    gmtime_r(&t, &tm_utc);
+    strftime(output, output_size, "%Y%m%dT%H%M%SZ", &tm_utc);
+}
+
+// Busy time in [start, end) as a VFREEBUSY. Overlapping and touching
+// items merge into one period, clipped to the range; items without an end
+// take no time and don't show. Times are UTC as RFC 5545 requires here.
+char* generate_ics_freebusy(calendar_t* cal, arena_t* arena, time_t start, time_t end, size_t* length) {
     agenda_item_t* items;
     int count;
     
-    // Get all items for the month
-    if (db_get_items(VIEW_MONTH, &items, &count) != 0) {
+    if (db_get_overlapping_items(cal, arena, start, end, &items, &count) != 0) {
+        return NULL;
+    }
+    
+    // One FREEBUSY line per period, at most one per item
+    size_t buffer_size = 512 + count * 64;
+    char* ics_content = arena_alloc(arena, buffer_size);
+    if (!ics_content) {
         return NULL;
     }
     
-    // Calculate required buffer size
-    size_t buffer_size = 4096 + (count * 256);
-    char* html_content = malloc(buffer_size);
-    if (!html_content) {
-        if (items) free(items);
+    char stamp[32], range_start[32], range_end[32];
+    format_utc(clock_now(), stamp, sizeof(stamp));
+    format_utc(start, range_start, sizeof(range_start));
+    format_utc(end, range_end, sizeof(range_end));
+    
+    size_t used = snprintf(ics_content, buffer_size,
+        "BEGIN:VCALENDAR\r\n"
+        "VERSION:2.0\r\n"
+        "PRODID:-//Algendado//Personal Agenda//EN\r\n"
+        "METHOD:PUBLISH\r\n"
+        "BEGIN:VFREEBUSY\r\n"
+        "UID:freebusy-%s-%s@algendado\r\n"
+        "DTSTAMP:%s\r\n"
+        "DTSTART:%s\r\n"
+        "DTEND:%s\r\n",
+        range_start, range_end, stamp, range_start, range_end);
+    
+    // Items come in start order, so a period grows until the next item
+    // starts after it ends
+    time_t busy_start = 0, busy_end = 0;
+    for (int i = 0; i <= count; i++) {
+        int has_span = (i < count && items[i].end_datetime > items[i].datetime);
+        if (i < count && !has_span) {
+            continue;
+        }
+        
+        if (i < count && busy_end > 0 && items[i].datetime <= busy_end) {
+            if (items[i].end_datetime > busy_end) busy_end = items[i].end_datetime;
+            continue;
+        }
+        
+        if (busy_end > 0) {
+            char period_start[32], period_end[32];
+            format_utc(busy_start > start ? busy_start : start, period_start, sizeof(period_start));
+            format_utc(busy_end < end ? busy_end : end, period_end, sizeof(period_end));
+            used += snprintf(ics_content + used, buffer_size - used,
+                               "FREEBUSY:%s/%s\r\n", period_start, period_end);
+        }
+        if (i < count) {
+            busy_start = items[i].datetime;
+            busy_end = items[i].end_datetime;
+        }
+    }
+    
+    used += snprintf(ics_content + used, buffer_size - used, "END:VFREEBUSY\r\nEND:VCALENDAR\r\n");
+    
+    arena_shrink(arena, ics_content, used + 1);
+    *length = used;
+    return ics_content;
+}
+
+// HTML pages are rendered from the compiled templates in templates/*.tmpl.
+// Rows point at the items' own strings; both are in the page's arena.
+
+static void emit_page_header(template_output_t* out, const char* terms, const char* from, const char* to) {
+    template_emit(out, &tmpl_page_header, (template_value_t[]) {
+        [TMPL_PAGE_HEADER_Q] = { .text = terms },
+        [TMPL_PAGE_HEADER_FROM] = { .text = from },
+        [TMPL_PAGE_HEADER_TO] = { .text = to },
+    });
+}
+
+static void emit_no_items(template_output_t* out, const char* message) {
+    template_emit(out, &tmpl_no_items, (template_value_t[]) {
+        [TMPL_NO_ITEMS_MESSAGE] = { .text = message },
+    });
+}
+
+// Adds the footer and gathers the page into one buffer
+static char* finish_page(template_output_t* out, size_t* length) {
+    template_emit(out, &tmpl_page_footer, NULL);
+    return template_output_join(out, length);
+}
+
+// Display forms of dates and times live in the output's arena
+static const char* format_date(template_output_t* out, const char* date) {
+    char* formatted = template_output_alloc(out, MAX_DATE_LEN);
+    if (formatted) {
+        format_date_for_display(date, formatted);
+    }
+    return formatted;
+}
+
+static const char* format_time(template_output_t* out, const agenda_item_t* item) {
+    char* formatted = template_output_alloc(out, 2 * MAX_TIME_LEN + 4);
+    if (formatted) {
+        format_time_range_for_display(item, formatted, 2 * MAX_TIME_LEN + 4);
+    }
+    return formatted;
+}
+
+// Renders the current month as a grid with one item-count badge per busy
+// day. Reads at most 31 day_stats rows, not the items themselves.
+static void emit_month_grid(calendar_t* cal, template_output_t* out) {
+    time_t now = clock_now();
+    struct tm first;
+    localtime_r(&now, &first);
+    int today = first.tm_mday;
+    first.tm_mday = 1;
+    first.tm_hour = 12;
+    mktime(&first);
+    
+    struct tm last = first;
+    last.tm_mon++;
+    last.tm_mday = 0;
+    mktime(&last);
+    int days = last.tm_mday;
+    
+    char from_date[MAX_DATE_LEN];
+    char to_date[MAX_DATE_LEN];
+    strftime(from_date, sizeof(from_date), "%Y-%m-01", &first);
+    // Every day of the month sorts below "YYYY-MM-32"
+    snprintf(to_date, sizeof(to_date), "%.8s32", from_date);
+    
+    day_stats_t* stats = NULL;
+    int count = 0;
+    if (db_get_day_stats(cal, out->arena, from_date, to_date, &stats, &count) != 0) {
+        return;
+    }
+    
+    int item_counts[32] = {0};
+    for (int i = 0; i < count; i++) {
+        int mday = atoi(stats[i].date + 8);
+        if (mday >= 1 && mday <= 31) {
+            item_counts[mday] = stats[i].item_count;
+        }
+    }
+    
+    template_emit(out, &tmpl_month_grid_start, NULL);
+    for (int i = 0; i < first.tm_wday; i++) {
+        template_emit(out, &tmpl_month_pad, NULL);
+    }
+    for (int day = 1; day <= days; day++) {
+        int column = (first.tm_wday + day - 1) % 7;
+        if (column == 0 && day > 1) {
+            template_emit(out, &tmpl_month_row_break, NULL);
+        }
+        
+        const char* today_class = day == today ? " class=\"today\"" : "";
+        if (item_counts[day] > 0) {
+            template_emit(out, &tmpl_month_busy_day, (template_value_t[]) {
+                [TMPL_MONTH_BUSY_DAY_TODAY] = { .text = today_class },
+                [TMPL_MONTH_BUSY_DAY_DAY] = { .number = day },
+                [TMPL_MONTH_BUSY_DAY_COUNT] = { .number = item_counts[day] },
+            });
+        } else {
+            template_emit(out, &tmpl_month_day, (template_value_t[]) {
+                [TMPL_MONTH_DAY_TODAY] = { .text = today_class },
+                [TMPL_MONTH_DAY_DAY] = { .number = day },
+            });
+        }
+    }
+    template_emit(out, &tmpl_month_grid_end, NULL);
+}
+
+char* generate_html_calendar(calendar_t* cal, arena_t* arena, size_t* length) {
+    agenda_item_t* items;
+    int count;
+    
+    // Get all items for the month
+    if (db_get_items(cal, arena, VIEW_MONTH, &items, &count) != 0) {
         return NULL;
     }
     
-    // HTML header
-    strcpy(html_content, 
-        "<!DOCTYPE html>\n"
-        "<html lang=\"en\">\n"
-        "<head>\n"
-        "    <meta charset=\"UTF-8\">\n"
-        "    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
-        "    <title>Personal Agenda</title>\n"
-        "    <style>\n"
-        "        body { font-family: Arial, sans-serif; margin: 20px; background-color: #f5f5f5; }\n"
-        "        .container { max-width: 800px; margin: 0 auto; background-color: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }\n"
-        "        h1 { color: #333; text-align: center; margin-bottom: 30px; }\n"
-        "        .agenda-item { background-color: #f9f9f9; border-left: 4px solid #4CAF50; margin: 10px 0; padding: 15px; border-radius: 5px; }\n"
-        "        .date-time { font-weight: bold; color: #2196F3; margin-bottom: 5px; }\n"
-        "        .description { color: #666; }\n"
-        "        .no-items { text-align: center; color: #999; font-style: italic; padding: 40px; }\n"
-        "        .header-actions { text-align: center; margin-bottom: 20px; }\n"
-        "        .ics-link { display: inline-block; background-color: #4CAF50; color: white; padding: 10px 20px; text-decoration: none; border-radius: 5px; margin: 5px; }\n"
-        "        .ics-link:hover { background-color: #45a049; }\n"
-        "    </style>\n"
-        "</head>\n"
-        "<body>\n"
-        "    <div class=\"container\">\n"
-        "        <h1>📅 Personal Agenda</h1>\n"
-        "        <div class=\"header-actions\">\n"
-        "            <a href=\"/calendar.ics\" class=\"ics-link\">📱 Download ICS Calendar</a>\n"
-        "        </div>\n");
+    template_output_t out;
+    template_output_init(&out, arena);
+    emit_page_header(&out, NULL, NULL, NULL);
+    emit_month_grid(cal, &out);
     
     if (count == 0) {
-        strcat(html_content, "        <div class=\"no-items\">No agenda items found for this month.</div>\n");
+        emit_no_items(&out, "No agenda items found for this month.");
     } else {
+        const char* date = NULL;
         for (int i = 0; i < count; i++) {
-            char item_html[512];
-            char formatted_date[64];
-            char formatted_time[32];
+            // Items come in date order; rows of one day share its date
+            if (i == 0 || strcmp(items[i].date, items[i - 1].date) != 0) {
+                date = format_date(&out, items[i].date);
+            }
             
-            format_date_for_display(items[i].date, formatted_date);
-            format_time_for_display(items[i].time, formatted_time);
-            
-            snprintf(item_html, sizeof(item_html),
-                "        <div class=\"agenda-item\">\n"
-                "            <div class=\"date-time\">%s at %s</div>\n"
-                "            <div class=\"description\">%s</div>\n"
-                "        </div>\n",
-                formatted_date, formatted_time, items[i].description);
+            template_emit(&out, &tmpl_agenda_item, (template_value_t[]) {
+                [TMPL_AGENDA_ITEM_DATE] = { .text = date },
+                [TMPL_AGENDA_ITEM_TIME] = { .text = format_time(&out, &items[i]) },
+                [TMPL_AGENDA_ITEM_DESCRIPTION] = { .text = items[i].description },
+            });
+        }
+    }
+    
+    return finish_page(&out, length);
+}
+
+char* generate_html_week(calendar_t* cal, arena_t* arena, size_t* length) {
+    static const char* const weekdays[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    agenda_item_t* items;
+    int count;
+    
+    if (db_get_items(cal, arena, VIEW_WEEK, &items, &count) != 0) {
+        return NULL;
+    }
+    
+    // Columns run from the Sunday starting the week
+    time_t now = clock_now();
+    struct tm day;
+    localtime_r(&now, &day);
+    int today = day.tm_wday;
+    day.tm_mday -= day.tm_wday;
+    day.tm_hour = 12;
+    day.tm_isdst = -1;
+    mktime(&day);
+    
+    template_output_t out;
+    template_output_init(&out, arena);
+    emit_page_header(&out, NULL, NULL, NULL);
+    template_emit(&out, &tmpl_week_start, NULL);
+    
+    int next_item = 0;
+    for (int column = 0; column < 7; column++) {
+        char date[MAX_DATE_LEN];
+        strftime(date, sizeof(date), "%Y-%m-%d", &day);
+        
+        template_emit(&out, &tmpl_week_column_start, (template_value_t[]) {
+            [TMPL_WEEK_COLUMN_START_TODAY] = { .text = column == today ? " today" : "" },
+            [TMPL_WEEK_COLUMN_START_WEEKDAY] = { .text = weekdays[column] },
+            [TMPL_WEEK_COLUMN_START_DAY] = { .number = day.tm_mday },
+        });
+        
+        // Items are in datetime order, so each column takes the next run
+        while (next_item < count && strcmp(items[next_item].date, date) <= 0) {
+            template_emit(&out, &tmpl_week_item, (template_value_t[]) {
+                [TMPL_WEEK_ITEM_TIME] = { .text = format_time(&out, &items[next_item]) },
+                [TMPL_WEEK_ITEM_DESCRIPTION] = { .text = items[next_item].description },
+            });
+            next_item++;
+        }
+        
+        template_emit(&out, &tmpl_week_column_end, NULL);
+        day.tm_mday++;
+        mktime(&day);
+    }
+    template_emit(&out, &tmpl_week_end, NULL);
+    
+    if (count == 0) {
+        emit_no_items(&out, "No agenda items found for this week.");
+    }
+    
+    return finish_page(&out, length);
+}
+
+// Escapes a search snippet and turns its match markers into <mark> tags
+static void render_snippet_html(const char* snippet, char* output, size_t output_size) {
+    char escaped[(MAX_DESCRIPTION_LEN + 64) * 6];
+    html_escape(snippet, escaped, sizeof(escaped));
+    
+    size_t length = 0;
+    for (const char* p = escaped; *p && length + 8 < output_size; p++) {
+        if (*p == SEARCH_MATCH_START) {
+            memcpy(output + length, "<mark>", 6);
+            length += 6;
+        } else if (*p == SEARCH_MATCH_END) {
+            memcpy(output + length, "</mark>", 7);
+            length += 7;
+        } else {
+            output[length++] = *p;
+        }
+    }
+    output[length] = '\0';
+}
+
+char* generate_html_search(calendar_t* cal, arena_t* arena, const char* terms, const char* from,
+                           const char* to, size_t* length) {
+    search_result_t* results = NULL;
+    int count = 0;
+    time_t start, end;
+    int valid = (terms && *terms && parse_search_range(from, to, &start, &end) == 0);
+    
+    if (valid && db_search_items(cal, arena, terms, start, end, SEARCH_RESULT_LIMIT, &results, &count) != 0) {
+        valid = 0;
+    }
+    
+    // Header with the form refilled from the query
+    template_output_t out;
+    template_output_init(&out, arena);
+    emit_page_header(&out, terms, from, to);
+    
+    if (!valid) {
+        emit_no_items(&out, "Enter search terms and optional dates.");
+    } else if (count == 0) {
+        template_emit(&out, &tmpl_search_no_match, (template_value_t[]) {
+            [TMPL_SEARCH_NO_MATCH_TERMS] = { .text = terms },
+        });
+    } else {
+        for (int i = 0; i < count; i++) {
+            size_t snippet_size = (MAX_DESCRIPTION_LEN + 64) * 7;
+            char* snippet_html = template_output_alloc(&out, snippet_size);
+            if (snippet_html) {
+                render_snippet_html(results[i].snippet, snippet_html, snippet_size);
+                arena_shrink(arena, snippet_html, strlen(snippet_html) + 1);
+            }
             
-            strcat(html_content, item_html);
+            template_emit(&out, &tmpl_search_hit, (template_value_t[]) {
+                [TMPL_SEARCH_HIT_DATE] = { .text = format_date(&out, results[i].item.date) },
+                [TMPL_SEARCH_HIT_TIME] = { .text = format_time(&out, &results[i].item) },
+                [TMPL_SEARCH_HIT_SNIPPET] = { .text = snippet_html },
+            });
         }
     }
     
-    // HTML footer
-    strcat(html_content, 
-        "    </div>\n"
-        "</body>\n"
-        "</html>\n");
+    return finish_page(&out, length);
+}
+
+// Heatmap level of a day, GitHub style
+static int heatmap_level(int item_count) {
+    if (item_count == 0) return 0;
+    if (item_count == 1) return 1;
+    if (item_count == 2) return 2;
+    if (item_count <= 4) return 3;
+    return 4;
+}
+
+char* generate_html_year(calendar_t* cal, arena_t* arena, int year, size_t* length) {
+    char from_date[MAX_DATE_LEN];
+    char to_date[MAX_DATE_LEN];
+    snprintf(from_date, sizeof(from_date), "%04d-01-01", year);
+    snprintf(to_date, sizeof(to_date), "%04d-01-01", year + 1);
+    
+    // One aggregate row per busy day instead of every item of the year
+    day_stats_t* stats = NULL;
+    int count = 0;
+    if (db_get_day_stats(cal, arena, from_date, to_date, &stats, &count) != 0) {
+        return NULL;
+    }
+    
+    template_output_t out;
+    template_output_init(&out, arena);
+    emit_page_header(&out, NULL, NULL, NULL);
+    
+    int total_items = 0;
+    int busiest = -1;
+    for (int i = 0; i < count; i++) {
+        total_items += stats[i].item_count;
+        if (busiest < 0 || stats[i].item_count > stats[busiest].item_count) {
+            busiest = i;
+        }
+    }
+    
+    template_emit(&out, &tmpl_year_nav, (template_value_t[]) {
+        [TMPL_YEAR_NAV_PREVIOUS] = { .number = year - 1 },
+        [TMPL_YEAR_NAV_YEAR] = { .number = year },
+        [TMPL_YEAR_NAV_NEXT] = { .number = year + 1 },
+    });
+    
+    // Columns are weeks, rows are weekdays; pad up to January 1st
+    struct tm day = {0};
+    day.tm_year = year - 1900;
+    day.tm_mday = 1;
+    day.tm_hour = 12;
+    day.tm_isdst = -1;
+    mktime(&day);
+    for (int i = 0; i < day.tm_wday; i++) {
+        template_emit(&out, &tmpl_heatmap_pad, NULL);
+    }
+    
+    int next_stat = 0;
+    while (day.tm_year == year - 1900) {
+        char* date = template_output_alloc(&out, MAX_DATE_LEN);
+        if (!date) {
+            break;
+        }
+        strftime(date, MAX_DATE_LEN, "%Y-%m-%d", &day);
+        
+        int item_count = 0;
+        if (next_stat < count && strcmp(stats[next_stat].date, date) == 0) {
+            item_count = stats[next_stat++].item_count;
+        }
+        
+        template_emit(&out, &tmpl_heatmap_day, (template_value_t[]) {
+            [TMPL_HEATMAP_DAY_LEVEL] = { .number = heatmap_level(item_count) },
+            [TMPL_HEATMAP_DAY_DATE] = { .text = date },
+            [TMPL_HEATMAP_DAY_COUNT] = { .number = item_count },
+            [TMPL_HEATMAP_DAY_PLURAL] = { .text = item_count == 1 ? "" : "s" },
+        });
+        
+        day.tm_mday++;
+        mktime(&day);
+    }
+    
+    if (busiest >= 0) {
+        template_emit(&out, &tmpl_year_summary, (template_value_t[]) {
+            [TMPL_YEAR_SUMMARY_ITEMS] = { .number = total_items },
+            [TMPL_YEAR_SUMMARY_DAYS] = { .number = count },
+            [TMPL_YEAR_SUMMARY_BUSIEST] = { .text = format_date(&out, stats[busiest].date) },
+            [TMPL_YEAR_SUMMARY_BUSIEST_ITEMS] = { .number = stats[busiest].item_count },
+        });
+    } else {
+        template_emit(&out, &tmpl_year_empty, (template_value_t[]) {
+            [TMPL_YEAR_EMPTY_YEAR] = { .number = year },
+        });
+    }
     
-    if (items) free(items);
-    return html_content;
+    return finish_page(&out, length);
 }
@@ -0,0 +1,237 @@
+#include "agenda.h"
+#include <ctype.h>
+#include <errno.h>
+
+// Named calendars each live in their own database file under CALENDAR_DIR.
+// At most CALENDAR_CACHE_SIZE of them stay open; the least recently used
+// idle one is closed to make room, and maintenance closes the ones nobody
+// asked for in CALENDAR_IDLE_SECONDS. An idle calendar costs nothing but
+// its files on disk.
+
+#define CALENDAR_HASH_BUCKETS 128
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t calendar_opened = PTHREAD_COND_INITIALIZER;   // An opening finished
+static calendar_t* hash_buckets[CALENDAR_HASH_BUCKETS];
+static calendar_t* lru_head = NULL;
+static calendar_t* lru_tail = NULL;
+static int cached_count = 0;
+
+// Names become file names, so only a safe alphabet is allowed
+int calendar_name_is_valid(const char* name) {
+    size_t length = strlen(name);
+    if (length == 0 || length >= CALENDAR_NAME_LEN) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (!islower(c) && !isdigit(c) && c != '-' && c != '_') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Whether a named calendar has a database file, without opening it
+int calendar_exists(const char* name) {
+    char path[CALENDAR_NAME_LEN + 32];
+    struct stat info;
+
+    if (!calendar_name_is_valid(name)) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s.db", CALENDAR_DIR, name);
+    return stat(path, &info) == 0;
+}
+
+static unsigned int calendar_hash(const char* name) {
+    unsigned int hash = 5381;
+    for (const char* p = name; *p; p++) {
+        hash = hash * 33 + (unsigned char)*p;
+    }
+    return hash % CALENDAR_HASH_BUCKETS;
+}
+
+static void lru_unlink(calendar_t* cal) {
+    if (cal->lru_prev) cal->lru_prev->lru_next = cal->lru_next;
+    else lru_head = cal->lru_next;
+    if (cal->lru_next) cal->lru_next->lru_prev = cal->lru_prev;
+    else lru_tail = cal->lru_prev;
+    cal->lru_prev = cal->lru_next = NULL;
+}
+
+static void lru_push_front(calendar_t* cal) {
+    cal->lru_prev = NULL;
+    cal->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = cal;
+    lru_head = cal;
+    if (!lru_tail) lru_tail = cal;
+}
+
+static calendar_t* hash_find(const char* name) {
+    calendar_t* cal = hash_buckets[calendar_hash(name)];
+    while (cal && strcmp(cal->name, name) != 0) {
+        cal = cal->hash_next;
+    }
+    return cal;
+}
+
+static void hash_unlink(calendar_t* cal) {
+    calendar_t** link = &hash_buckets[calendar_hash(cal->name)];
+    while (*link && *link != cal) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) *link = cal->hash_next;
+}
+
+static void cache_remove(calendar_t* cal) {
+    hash_unlink(cal);
+    lru_unlink(cal);
+    cached_count--;
+
+    tag_index_drop(cal->path);
+    sqlite3_close(cal->conn);
+    free(cal);
+}
+
+// Closes least recently used calendars nobody holds until there is room
+static void cache_make_room(void) {
+    calendar_t* cal = lru_tail;
+    while (cal && cached_count >= CALENDAR_CACHE_SIZE) {
+        calendar_t* prev = cal->lru_prev;
+        if (cal->refcount == 0) {
+            cache_remove(cal);
+        }
+        cal = prev;
+    }
+}
+
+// Returns the named calendar, opening it if needed, and holds it until
+// calendar_release. Without create, a calendar with no file yet is NULL,
+// so requests for unknown names never create files. The database is
+// opened without cache_mutex held, so other calendars stay available
+// meanwhile; threads asking for the same one wait for the outcome.
+calendar_t* calendar_acquire(const char* name, int create) {
+    if (!calendar_name_is_valid(name)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+
+    calendar_t* cal;
+    while ((cal = hash_find(name)) != NULL) {
+        // Holding it keeps a failed entry alive until we have looked
+        cal->refcount++;
+        while (cal->opening) {
+            pthread_cond_wait(&calendar_opened, &cache_mutex);
+        }
+        if (cal->conn) {
+            lru_unlink(cal);
+            lru_push_front(cal);
+            cal->last_used = time(NULL);
+            pthread_mutex_unlock(&cache_mutex);
+            return cal;
+        }
+
+        // Its opener failed and unhashed it; the last one out frees it,
+        // and we try ourselves, perhaps with create
+        if (--cal->refcount == 0) {
+            free(cal);
+        }
+    }
+
+    // Hashed but kept off the LRU list until open, so nothing evicts it
+    cal = calloc(1, sizeof(calendar_t));
+    if (!cal) {
+        pthread_mutex_unlock(&cache_mutex);
+        return NULL;
+    }
+    snprintf(cal->name, sizeof(cal->name), "%s", name);
+    snprintf(cal->path, sizeof(cal->path), "%s/%s.db", CALENDAR_DIR, name);
+    snprintf(cal->archive_path, sizeof(cal->archive_path), "%s/%s_archive.db", CALENDAR_DIR, name);
+    cal->opening = 1;
+    cal->refcount = 1;
+    unsigned int bucket = calendar_hash(name);
+    cal->hash_next = hash_buckets[bucket];
+    hash_buckets[bucket] = cal;
+
+    pthread_mutex_unlock(&cache_mutex);
+
+    int rc = 0;
+    if (create && mkdir(CALENDAR_DIR, 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", CALENDAR_DIR, strerror(errno));
+        rc = -1;
+    }
+    if (rc == 0) {
+        rc = db_open_calendar(cal->path, cal->archive_path, create, &cal->conn);
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    cal->opening = 0;
+    pthread_cond_broadcast(&calendar_opened);
+
+    if (rc != 0) {
+        hash_unlink(cal);
+        if (--cal->refcount == 0) {
+            free(cal);
+        }
+        pthread_mutex_unlock(&cache_mutex);
+        return NULL;
+    }
+
+    // When every cached calendar is in use the cache grows past its
+    // size for a moment; the next acquire trims it back
+    cache_make_room();
+    lru_push_front(cal);
+    cached_count++;
+    cal->last_used = time(NULL);
+
+    pthread_mutex_unlock(&cache_mutex);
+    return cal;
+}
+
+// Moves cal to the front as well, so the LRU list stays ordered by
+// last_used for calendar_cache_trim
+void calendar_release(calendar_t* cal) {
+    if (!cal) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    cal->refcount--;
+    cal->last_used = time(NULL);
+    lru_unlink(cal);
+    lru_push_front(cal);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// Closes calendars idle for longer than idle_seconds; returns how many
+int calendar_cache_trim(int idle_seconds) {
+    time_t cutoff = time(NULL) - idle_seconds;
+    int closed = 0;
+
+    pthread_mutex_lock(&cache_mutex);
+
+    // The LRU tail is the longest idle; stop at the first recent one
+    calendar_t* cal = lru_tail;
+    while (cal && cal->last_used < cutoff) {
+        calendar_t* prev = cal->lru_prev;
+        if (cal->refcount == 0) {
+            cache_remove(cal);
+            closed++;
+        }
+        cal = prev;
+    }
+
+    pthread_mutex_unlock(&cache_mutex);
+    return closed;
+}
+
+void calendar_cache_close_all(void) {
+    pthread_mutex_lock(&cache_mutex);
+    while (lru_head) {
+        cache_remove(lru_head);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
@@ -1,41 +1,107 @@
 #include "agenda.h"
+#include <sys/wait.h>
+
+// Calendar chosen with --calendar or $ALGEN_CALENDAR; NULL is the default
+static calendar_t* selected_calendar = NULL;
 
 static void print_usage(void) {
     printf("Usage:\n");
-    printf("  algen add <date> <time> \"<description>\"\n");
-    printf("  algen get <period>\n");
-    printf("  algen remove <id>\n\n");
+    printf("  algen [--calendar <name>] <command> ...\n\n");
+    printf("Commands:\n");
+    printf("  algen add <date> <time> \"<description>\" [--for <duration> | --until <time>] [--remind <offsets>]\n");
+    printf("            [--tag <tags>]\n");
+    printf("  algen get <period> [--tag <filter>]\n");
+    printf("  algen tags\n");
+    printf("  algen remove <id>\n");
+    printf("  algen search <terms...> [--from <date>] [--to <date>]\n");
+    printf("  algen archive [days]\n");
+    printf("  algen backup <path>\n");
+    printf("  algen stats [year]\n\n");
     printf("Date formats:\n");
     printf("  today, tomorrow, or DD/MM/YYYY\n\n");
     printf("Time formats:\n");
     printf("  HH:MM or HH:MM:SS\n\n");
     printf("Period options:\n");
     printf("  today, week, month\n\n");
+    printf("Calendars:\n");
+    printf("  Default is %s; a named calendar lives in %s/<name>.db\n", DB_PATH, CALENDAR_DIR);
+    printf("  Names use a-z, 0-9, '-' and '_'; $ALGEN_CALENDAR sets the default\n\n");
+    printf("Durations:\n");
+    printf("  e.g. 45m, 2h or 1h30m; an item without one takes no time\n\n");
+    printf("Reminder offsets:\n");
+    printf("  Comma separated, e.g. 1d,1h,5m (default: %dm)\n\n", NOTIFICATION_ADVANCE_MINUTES);
+    printf("Tags:\n");
+    printf("  Comma separated, up to %d, using a-z, 0-9, '-' and '_', e.g. work,project-x\n", MAX_TAGS);
+    printf("  Filters: ',' matches any term, '+' joins tags that must all be present\n\n");
     printf("Examples:\n");
     printf("  algen add today 11:15:00 \"finish the project\"\n");
     printf("  algen add tomorrow 14:30 \"meeting with team\"\n");
     printf("  algen add 15/07/2025 09:00 \"doctor appointment\"\n");
+    printf("  algen add tomorrow 10:00 \"flight\" --remind 1d,1h,5m\n");
+    printf("  algen add tomorrow 14:00 \"workshop\" --for 1h30m\n");
+    printf("  algen add tomorrow 22:00 \"night shift\" --until 06:00\n");
+    printf("  algen add tomorrow 09:30 \"standup\" --tag work,team\n");
     printf("  algen get today\n");
     printf("  algen get week\n");
+    printf("  algen get week --tag work+urgent,home\n");
     printf("  algen remove 5\n");
+    printf("  algen search dentist --from today\n");
+    printf("  algen search \"team meet*\" --to 31/12/2025\n");
+    printf("  algen archive 30\n");
+    printf("  algen backup ~/agenda-backup.db\n");
+    printf("  algen stats 2025\n");
+    printf("  algen --calendar team add tomorrow 10:00 \"sprint review\"\n");
 }
 
 static int start_server_if_needed(void) {
-    if (!server_is_running()) {
-        printf("Starting agenda server...\n");
-        if (fork() == 0) {
-            // Child process - start server
-            execl("./algen-server", "algen-server", NULL);
-            // If execl fails, try from PATH
-            execlp("algen-server", "algen-server", NULL);
-            exit(1);
-        }
-        // Give server time to start
-        sleep(1);
+    if (server_is_running()) {
+        return 0;
+    }
+    
+    printf("Starting agenda server...\n");
+    fflush(stdout);
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        // The daemon's foreground process exits once the server is ready
+        execl("./algen-server", "algen-server", "--daemon", (char*)NULL);
+        // If execl fails, try from PATH
+        execlp("algen-server", "algen-server", "--daemon", (char*)NULL);
+        _exit(127);
+    }
+    
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Warning: agenda server did not start; reminders wait until it runs\n");
+        return -1;
     }
     return 0;
 }
 
+// Minutes from date/time to the end time, which may fall on the next day
+static int duration_until(const char* date, const char* time, const char* input) {
+    char end_time[MAX_TIME_LEN];
+    if (parse_time_input(input, end_time) != 0) {
+        return -1;
+    }
+
+    time_t start = combine_datetime(date, time);
+    time_t end = combine_datetime(date, end_time);
+    if (start == -1 || end == -1) {
+        return -1;
+    }
+    if (end <= start) {
+        struct tm tm_next = *localtime(&end);
+        tm_next.tm_mday++;
+        tm_next.tm_isdst = -1;
+        end = mktime(&tm_next);
+    }
+    return (int)((end - start) / 60);
+}
+
 static int handle_add_command(int argc, char* argv[]) {
     if (argc < 5) {
         fprintf(stderr, "Error: Insufficient arguments for add command\n");
@@ -56,11 +122,71 @@ static int handle_add_command(int argc, char* argv[]) {
         return 1;
     }
 
+    int offsets[MAX_REMINDERS] = { NOTIFICATION_ADVANCE_MINUTES };
+    int offset_count = 1;
+    int duration_minutes = 0;
+    char tags[MAX_TAGS][MAX_TAG_LEN];
+    int tag_count = 0;
+
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "--for") == 0 && i + 1 < argc) {
+            duration_minutes = parse_duration(argv[++i]);
+            if (duration_minutes < 0) {
+                fprintf(stderr, "Error: Invalid duration '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+            duration_minutes = duration_until(date, time, argv[++i]);
+            if (duration_minutes < 0) {
+                fprintf(stderr, "Error: Invalid end time '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--remind") == 0 && i + 1 < argc) {
+            offset_count = parse_reminder_offsets(argv[++i], offsets, MAX_REMINDERS);
+            if (offset_count < 0) {
+                fprintf(stderr, "Error: Invalid reminder offsets '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tag") == 0 && i + 1 < argc) {
+            tag_count = parse_tags(argv[++i], tags, MAX_TAGS);
+            if (tag_count < 0) {
+                fprintf(stderr, "Error: Invalid tags '%s'\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+
     // Start server if needed
     start_server_if_needed();
 
-    if (db_add_item(date, time, argv[4]) != 0) {
+    // Overlaps are worth a warning, not a refusal
+    agenda_item_t* conflicts = NULL;
+    int conflict_count = 0;
+    time_t start = combine_datetime(date, time);
+    if (start != -1) {
+        db_get_overlapping_items(selected_calendar, NULL, start, start + (time_t)duration_minutes * 60,
+                                 &conflicts, &conflict_count);
+    }
+
+    // The server commits writes to the default calendar together with
+    // everyone else's and reschedules itself; without one, write directly
+    int result;
+    if (selected_calendar || write_channel_add(date, time, duration_minutes, argv[4], offsets, offset_count,
+                                               tags, tag_count, &result) != 0) {
+        result = db_add_item_with_reminders(selected_calendar, date, time, duration_minutes, argv[4],
+                                            offsets, offset_count, tags, tag_count);
+        // The server schedules reminders of the default calendar only
+        if (result == 0 && !selected_calendar) {
+            server_notify_changed();
+        }
+    }
+    if (result != 0) {
         fprintf(stderr, "Error: Failed to add item to database\n");
+        free(conflicts);
         return 1;
     }
 
@@ -70,6 +196,18 @@ static int handle_add_command(int argc, char* argv[]) {
     format_time_for_display(time, formatted_time);
 
     printf("Added: %s at %s - %s\n", formatted_date, formatted_time, argv[4]);
+
+    if (conflict_count > 0) {
+        printf("Warning: overlaps %d item%s:\n", conflict_count, conflict_count == 1 ? "" : "s");
+        for (int i = 0; i < conflict_count; i++) {
+            char formatted_range[48];
+            format_date_for_display(conflicts[i].date, formatted_date);
+            format_time_range_for_display(&conflicts[i], formatted_range, sizeof(formatted_range));
+            printf("  [ID: %d] %s at %s - %s\n", conflicts[i].id, formatted_date, formatted_range,
+                   conflicts[i].description);
+        }
+    }
+    free(conflicts);
     return 0;
 }
 
@@ -93,27 +231,58 @@ static int handle_get_command(int argc, char* argv[]) {
         return 1;
     }
 
+    const char* tag_expression = NULL;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--tag") == 0 && i + 1 < argc) {
+            tag_expression = argv[++i];
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+
+    bitmap_t* filter = NULL;
+    if (tag_expression && tag_filter(selected_calendar, tag_expression, &filter) != 0) {
+        fprintf(stderr, "Error: Invalid tag filter '%s'\n", tag_expression);
+        return 1;
+    }
+
+    time_t start, end;
     agenda_item_t* items;
     int count;
 
-    if (db_get_items(view, &items, &count) != 0) {
+    int rc = view_time_range(view, clock_now(), &start, &end);
+    if (rc == 0) {
+        rc = db_get_items_between(selected_calendar, NULL, start, end, filter, &items, &count);
+    }
+    bitmap_free(filter);
+    if (rc != 0) {
         fprintf(stderr, "Error: Failed to retrieve items from database\n");
         return 1;
     }
 
     if (count == 0) {
-        printf("No agenda items found for %s.\n", argv[2]);
+        if (tag_expression) {
+            printf("No agenda items tagged %s found for %s.\n", tag_expression, argv[2]);
+        } else {
+            printf("No agenda items found for %s.\n", argv[2]);
+        }
         return 0;
     }
 
-    printf("Agenda items for %s:\n\n", argv[2]);
+    if (tag_expression) {
+        printf("Agenda items tagged %s for %s:\n\n", tag_expression, argv[2]);
+    } else {
+        printf("Agenda items for %s:\n\n", argv[2]);
+    }
     for (int i = 0; i < count; i++) {
         char formatted_date[64];
-        char formatted_time[32];
+        char formatted_range[48];
         format_date_for_display(items[i].date, formatted_date);
-        format_time_for_display(items[i].time, formatted_time);
+        format_time_range_for_display(&items[i], formatted_range, sizeof(formatted_range));
         
-        printf("[ID: %d] %s at %s\n", items[i].id, formatted_date, formatted_time);
+        printf("[ID: %d] %s at %s\n", items[i].id, formatted_date, formatted_range);
         printf("        %s\n\n", items[i].description);
     }
 
@@ -140,7 +309,14 @@ static int handle_remove_command(int argc, char* argv[]) {
     // Start server if needed (for potential web interface sync)
     start_server_if_needed();
 
-    if (db_remove_item((int)id) == 0) {
+    int result;
+    if (selected_calendar || write_channel_remove((int)id, &result) != 0) {
+        result = db_remove_item(selected_calendar, (int)id);
+        if (result == 0 && !selected_calendar) {
+            server_notify_changed();
+        }
+    }
+    if (result == 0) {
         printf("Successfully removed agenda item with ID %ld\n", id);
         return 0;
     } else {
@@ -149,14 +325,238 @@ static int handle_remove_command(int argc, char* argv[]) {
     }
 }
 
+static int handle_search_command(int argc, char* argv[]) {
+    char terms[MAX_DESCRIPTION_LEN] = "";
+    const char* from = NULL;
+    const char* to = NULL;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            from = argv[++i];
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            to = argv[++i];
+        } else {
+            size_t length = strlen(terms);
+            snprintf(terms + length, sizeof(terms) - length, "%s%s", length ? " " : "", argv[i]);
+        }
+    }
+    
+    if (terms[0] == '\0') {
+        fprintf(stderr, "Error: Missing search terms\n");
+        print_usage();
+        return 1;
+    }
+    
+    time_t start, end;
+    if (parse_search_range(from, to, &start, &end) != 0) {
+        fprintf(stderr, "Error: Invalid date range\n");
+        return 1;
+    }
+    
+    search_result_t* results;
+    int count;
+    
+    if (db_search_items(selected_calendar, NULL, terms, start, end, SEARCH_RESULT_LIMIT, &results, &count) != 0) {
+        fprintf(stderr, "Error: Search failed\n");
+        return 1;
+    }
+    
+    if (count == 0) {
+        printf("No agenda items match '%s'.\n", terms);
+        free(results);
+        return 0;
+    }
+    
+    printf("%d match%s for '%s':\n\n", count, count == 1 ? "" : "es", terms);
+    for (int i = 0; i < count; i++) {
+        char formatted_date[64];
+        char formatted_time[32];
+        format_date_for_display(results[i].item.date, formatted_date);
+        format_time_for_display(results[i].item.time, formatted_time);
+        
+        // Show the highlighted terms in brackets on the terminal
+        for (char* p = results[i].snippet; *p; p++) {
+            if (*p == SEARCH_MATCH_START) *p = '[';
+            else if (*p == SEARCH_MATCH_END) *p = ']';
+        }
+        
+        printf("[ID: %d] %s at %s\n", results[i].item.id, formatted_date, formatted_time);
+        printf("        %s\n\n", results[i].snippet);
+    }
+    
+    free(results);
+    return 0;
+}
+
+static int handle_archive_command(int argc, char* argv[]) {
+    int days = ARCHIVE_RETENTION_DAYS;
+    
+    if (argc >= 3) {
+        char* endptr;
+        long value = strtol(argv[2], &endptr, 10);
+        if (*endptr != '\0' || value <= 0) {
+            fprintf(stderr, "Error: Invalid number of days '%s'\n", argv[2]);
+            return 1;
+        }
+        days = (int)value;
+    }
+    
+    printf("Archiving items older than %d days...\n", days);
+    if (db_run_maintenance(selected_calendar, days) != 0) {
+        fprintf(stderr, "Error: Archiving failed\n");
+        return 1;
+    }
+    
+    printf("Done\n");
+    return 0;
+}
+
+static int handle_backup_command(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Error: Missing path for backup command\n");
+        print_usage();
+        return 1;
+    }
+    
+    backup_stats_t stats;
+    if (db_backup(selected_calendar, argv[2], &stats) != 0) {
+        fprintf(stderr, "Error: Backup failed\n");
+        return 1;
+    }
+    
+    printf("Backed up %d pages to %s (archive: %s.archive) in %.2fs\n",
+           stats.pages, argv[2], argv[2], stats.seconds);
+    printf("Verified: quick_check ok, %d items\n", stats.rows);
+    return 0;
+}
+
+static int handle_tags_command(void) {
+    tag_count_t* counts;
+    int count;
+    if (tag_counts(selected_calendar, &counts, &count) != 0) {
+        fprintf(stderr, "Error: Failed to read tags\n");
+        return 1;
+    }
+
+    if (count == 0) {
+        printf("No tagged items.\n");
+    } else {
+        int width = 0;
+        for (int i = 0; i < count; i++) {
+            int length = (int)strlen(counts[i].tag);
+            if (length > width) width = length;
+        }
+        printf("Tags:\n\n");
+        for (int i = 0; i < count; i++) {
+            printf("  %-*s %6d item%s\n", width, counts[i].tag, counts[i].item_count,
+                   counts[i].item_count == 1 ? "" : "s");
+        }
+    }
+
+    free(counts);
+    return 0;
+}
+
+static int handle_stats_command(int argc, char* argv[]) {
+    time_t now = clock_now();
+    int year = localtime(&now)->tm_year + 1900;
+    
+    if (argc >= 3) {
+        char* endptr;
+        long value = strtol(argv[2], &endptr, 10);
+        if (*endptr != '\0' || value < 1970 || value > 9999) {
+            fprintf(stderr, "Error: Invalid year '%s'\n", argv[2]);
+            return 1;
+        }
+        year = (int)value;
+    }
+    
+    char from_date[MAX_DATE_LEN];
+    char to_date[MAX_DATE_LEN];
+    snprintf(from_date, sizeof(from_date), "%04d-01-01", year);
+    snprintf(to_date, sizeof(to_date), "%04d-01-01", year + 1);
+    
+    day_stats_t* stats;
+    int count;
+    if (db_get_day_stats(selected_calendar, NULL, from_date, to_date, &stats, &count) != 0) {
+        fprintf(stderr, "Error: Failed to read statistics\n");
+        return 1;
+    }
+    
+    if (count == 0) {
+        printf("No agenda items in %d.\n", year);
+        return 0;
+    }
+    
+    static const char* const month_names[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+    };
+    int month_items[12] = {0};
+    int total_items = 0;
+    int total_notified = 0;
+    int busiest = 0;
+    
+    for (int i = 0; i < count; i++) {
+        int month = atoi(stats[i].date + 5) - 1;
+        if (month >= 0 && month < 12) {
+            month_items[month] += stats[i].item_count;
+        }
+        total_items += stats[i].item_count;
+        total_notified += stats[i].notified_count;
+        if (stats[i].item_count > stats[busiest].item_count) {
+            busiest = i;
+        }
+    }
+    
+    int max_month = 1;
+    for (int month = 0; month < 12; month++) {
+        if (month_items[month] > max_month) max_month = month_items[month];
+    }
+    
+    printf("Agenda statistics for %d:\n\n", year);
+    for (int month = 0; month < 12; month++) {
+        char bar[41];
+        int width = month_items[month] * 40 / max_month;
+        memset(bar, '#', width);
+        bar[width] = '\0';
+        printf("  %s %5d %s\n", month_names[month], month_items[month], bar);
+    }
+    
+    char formatted_date[64];
+    format_date_for_display(stats[busiest].date, formatted_date);
+    printf("\n  %d items on %d days, %d reminded\n", total_items, count, total_notified);
+    printf("  Busiest day: %s (%d items, %.5s to %.5s)\n", formatted_date,
+           stats[busiest].item_count, stats[busiest].first_time, stats[busiest].last_time);
+    
+    free(stats);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
+    const char* calendar_name = getenv("ALGEN_CALENDAR");
+    if (argc >= 3 && (strcmp(argv[1], "--calendar") == 0 || strcmp(argv[1], "-c") == 0)) {
+        calendar_name = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
     if (argc < 2) {
         print_usage();
         return 1;
     }
 
     // Initialize database
-    if (db_init() != 0) {
+    if (calendar_name && *calendar_name) {
+        if (!calendar_name_is_valid(calendar_name)) {
+            fprintf(stderr, "Error: Invalid calendar name '%s'\n", calendar_name);
+            return 1;
+        }
+        selected_calendar = calendar_acquire(calendar_name, 1);
+        if (!selected_calendar) {
+            fprintf(stderr, "Error: Failed to open calendar '%s'\n", calendar_name);
+            return 1;
+        }
+    } else if (db_init() != 0) {
         fprintf(stderr, "Error: Failed to initialize database\n");
         return 1;
     }
@@ -168,12 +568,25 @@ int main(int argc, char* argv[]) {
         result = handle_get_command(argc, argv);
     } else if (strcmp(argv[1], "remove") == 0) {
         result = handle_remove_command(argc, argv);
+    } else if (strcmp(argv[1], "search") == 0) {
+        result = handle_search_command(argc, argv);
+    } else if (strcmp(argv[1], "archive") == 0) {
+        result = handle_archive_command(argc, argv);
+    } else if (strcmp(argv[1], "backup") == 0) {
+        result = handle_backup_command(argc, argv);
+    } else if (strcmp(argv[1], "stats") == 0) {
+        result = handle_stats_command(argc, argv);
+    } else if (strcmp(argv[1], "tags") == 0) {
+        result = handle_tags_command();
     } else {
         fprintf(stderr, "Error: Unknown command '%s'\n", argv[1]);
         print_usage();
         result = 1;
     }
 
+    calendar_release(selected_calendar);
+    calendar_cache_close_all();
+    tag_index_close_all();
     db_close();
     return result;
 }
@@ -0,0 +1,32 @@
+#include "agenda.h"
+
+// What time it is, for everything that works in calendar time: what is
+// due, what counts as today, what to archive. The server and client read
+// the system clock. A simulation switches to a virtual clock and moves it
+// forward itself, so a year of reminders replays in seconds.
+//
+// Waits paired with OS timers (the event loop's timerfd, replication
+// heartbeats, idle connections, backup intervals) stay on the system
+// clock; a simulation doesn't run them.
+
+static time_t virtual_now = 0;   // 0 while on the system clock
+
+time_t clock_now(void) {
+    time_t now = __atomic_load_n(&virtual_now, __ATOMIC_ACQUIRE);
+    return now ? now : time(NULL);
+}
+
+void clock_use_virtual(time_t start) {
+    __atomic_store_n(&virtual_now, start, __ATOMIC_RELEASE);
+}
+
+// The virtual clock never runs backwards
+void clock_advance_to(time_t when) {
+    if (when > __atomic_load_n(&virtual_now, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&virtual_now, when, __ATOMIC_RELEASE);
+    }
+}
+
+int clock_is_virtual(void) {
+    return __atomic_load_n(&virtual_now, __ATOMIC_ACQUIRE) != 0;
+}
@@ -1,54 +1,625 @@
+#define _DEFAULT_SOURCE
 #include "agenda.h"
 
+#ifdef ALGEN_WITH_ZLIB
+#include <zlib.h>
+#endif
+
 // Global database connection
 static sqlite3* db = NULL;
 
-int db_init(void) {
-    int rc = sqlite3_open(DB_PATH, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-        return -1;
+#define SQL_STRINGIFY(x) #x
+#define SQL_INT(x) SQL_STRINGIFY(x)
+
+// Schema migrations, applied in order on top of the base agenda_items table.
+// PRAGMA user_version records how many have run.
+static const char* const schema_migrations[] = {
+    // 1: reminders with precomputed fire times and per-reminder delivery state
+    "CREATE TABLE reminders ("
+    "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "item_id INTEGER NOT NULL,"
+    "offset_minutes INTEGER NOT NULL,"
+    "fire_at INTEGER NOT NULL,"
+    "delivered INTEGER NOT NULL DEFAULT 0"
+    ");"
+    "CREATE INDEX reminders_due ON reminders(fire_at) WHERE delivered = 0;"
+    "CREATE INDEX reminders_item ON reminders(item_id);"
+    "CREATE TRIGGER agenda_items_delete_reminders AFTER DELETE ON agenda_items BEGIN "
+    "DELETE FROM reminders WHERE item_id = OLD.id; "
+    "END;"
+    "INSERT INTO reminders (item_id, offset_minutes, fire_at, delivered) "
+    "SELECT id, " SQL_INT(NOTIFICATION_ADVANCE_MINUTES) ", "
+    "datetime - " SQL_INT(NOTIFICATION_ADVANCE_MINUTES) " * 60, "
+    "notified OR datetime - " SQL_INT(NOTIFICATION_ADVANCE_MINUTES) " * 60 <= CAST(strftime('%s', 'now') AS INTEGER) "
+    "FROM agenda_items;",
+
+    // 2: full-text index over descriptions, kept in sync by triggers
+    "CREATE VIRTUAL TABLE agenda_fts USING fts5("
+    "description, content='agenda_items', content_rowid='id', "
+    "tokenize='unicode61 remove_diacritics 2');"
+    "CREATE TRIGGER agenda_items_fts_insert AFTER INSERT ON agenda_items BEGIN "
+    "INSERT INTO agenda_fts(rowid, description) VALUES (NEW.id, NEW.description); "
+    "END;"
+    "CREATE TRIGGER agenda_items_fts_delete AFTER DELETE ON agenda_items BEGIN "
+    "INSERT INTO agenda_fts(agenda_fts, rowid, description) VALUES ('delete', OLD.id, OLD.description); "
+    "END;"
+    "CREATE TRIGGER agenda_items_fts_update AFTER UPDATE OF description ON agenda_items BEGIN "
+    "INSERT INTO agenda_fts(agenda_fts, rowid, description) VALUES ('delete', OLD.id, OLD.description); "
+    "INSERT INTO agenda_fts(rowid, description) VALUES (NEW.id, NEW.description); "
+    "END;"
+    "INSERT INTO agenda_fts(agenda_fts) VALUES ('rebuild');",
+
+    // 3: range scans by datetime for views and archive moves
+    "CREATE INDEX agenda_items_datetime ON agenda_items(datetime);",
+
+    // 4: per-day aggregates kept current by triggers, covering both tiers.
+    // Archive moves set suppress_stats so moving an item doesn't count as
+    // removing it.
+    "CREATE TABLE db_state (key TEXT PRIMARY KEY, value INTEGER NOT NULL) WITHOUT ROWID;"
+    "INSERT INTO db_state (key, value) VALUES ('suppress_stats', 0);"
+    "CREATE TABLE day_stats ("
+    "date TEXT PRIMARY KEY,"
+    "item_count INTEGER NOT NULL,"
+    "notified_count INTEGER NOT NULL,"
+    "first_time TEXT NOT NULL,"
+    "last_time TEXT NOT NULL"
+    ") WITHOUT ROWID;"
+    "CREATE INDEX agenda_items_date ON agenda_items(date, time);"
+    "CREATE TRIGGER agenda_items_stats_insert AFTER INSERT ON agenda_items "
+    "WHEN (SELECT value FROM db_state WHERE key = 'suppress_stats') = 0 BEGIN "
+    "INSERT INTO day_stats (date, item_count, notified_count, first_time, last_time) "
+    "VALUES (NEW.date, 1, COALESCE(NEW.notified, 0), NEW.time, NEW.time) "
+    "ON CONFLICT(date) DO UPDATE SET item_count = item_count + 1, "
+    "notified_count = notified_count + excluded.notified_count, "
+    "first_time = min(first_time, excluded.first_time), "
+    "last_time = max(last_time, excluded.last_time); "
+    "END;"
+    // Only a removed first or last item needs a lookup, one probe of
+    // agenda_items_date. Triggers can't see the archive, so on the one day
+    // straddling the archive cutoff a bound may stay a little stale.
+    "CREATE TRIGGER agenda_items_stats_delete AFTER DELETE ON agenda_items "
+    "WHEN (SELECT value FROM db_state WHERE key = 'suppress_stats') = 0 BEGIN "
+    "UPDATE day_stats SET item_count = item_count - 1, "
+    "notified_count = notified_count - COALESCE(OLD.notified, 0), "
+    "first_time = CASE WHEN OLD.time = first_time THEN "
+    "COALESCE((SELECT min(time) FROM agenda_items WHERE date = OLD.date), first_time) ELSE first_time END, "
+    "last_time = CASE WHEN OLD.time = last_time THEN "
+    "COALESCE((SELECT max(time) FROM agenda_items WHERE date = OLD.date), last_time) ELSE last_time END "
+    "WHERE date = OLD.date; "
+    "DELETE FROM day_stats WHERE date = OLD.date AND item_count <= 0; "
+    "END;"
+    "CREATE TRIGGER agenda_items_stats_notified AFTER UPDATE OF notified ON agenda_items "
+    "WHEN COALESCE(NEW.notified, 0) != COALESCE(OLD.notified, 0) BEGIN "
+    "UPDATE day_stats SET notified_count = notified_count + COALESCE(NEW.notified, 0) - COALESCE(OLD.notified, 0) "
+    "WHERE date = NEW.date; "
+    "END;"
+    "INSERT INTO day_stats (date, item_count, notified_count, first_time, last_time) "
+    "SELECT date, count(*), sum(COALESCE(notified, 0)), min(time), max(time) FROM ("
+    "SELECT date, time, notified FROM main.agenda_items UNION ALL "
+    "SELECT date, time, notified FROM archive.agenda_items a "
+    "WHERE NOT EXISTS (SELECT 1 FROM main.agenda_items m WHERE m.id = a.id)"
+    ") GROUP BY date;",
+
+    // 5: change log shipped to read replicas. Archive moves aren't changes
+    // (the item still exists), so they are skipped like in day_stats.
+    "CREATE TABLE changelog ("
+    "seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "op TEXT NOT NULL,"                     // I insert, D delete, U notified changed
+    "item_id INTEGER NOT NULL,"
+    "date TEXT, time TEXT, description TEXT, datetime INTEGER, notified INTEGER"
+    ");"
+    "CREATE TRIGGER agenda_items_log_insert AFTER INSERT ON agenda_items BEGIN "
+    "INSERT INTO changelog (op, item_id, date, time, description, datetime, notified) "
+    "VALUES ('I', NEW.id, NEW.date, NEW.time, NEW.description, NEW.datetime, COALESCE(NEW.notified, 0)); "
+    "END;"
+    "CREATE TRIGGER agenda_items_log_delete AFTER DELETE ON agenda_items "
+    "WHEN (SELECT value FROM db_state WHERE key = 'suppress_stats') = 0 BEGIN "
+    "INSERT INTO changelog (op, item_id) VALUES ('D', OLD.id); "
+    "END;"
+    "CREATE TRIGGER agenda_items_log_notified AFTER UPDATE OF notified ON agenda_items "
+    "WHEN COALESCE(NEW.notified, 0) != COALESCE(OLD.notified, 0) BEGIN "
+    "INSERT INTO changelog (op, item_id, notified) VALUES ('U', NEW.id, COALESCE(NEW.notified, 0)); "
+    "END;",
+
+    // 6: optional end times, and an R*-tree over every item's span in whole
+    // minutes (rtree_i32 holds 32-bit integers) for overlap queries. Like
+    // day_stats it covers both tiers, so archive moves leave it alone.
+    "ALTER TABLE agenda_items ADD COLUMN end_datetime INTEGER;"
+    "ALTER TABLE changelog ADD COLUMN end_datetime INTEGER;"
+    "CREATE VIRTUAL TABLE item_spans USING rtree_i32(id, start_minute, end_minute);"
+    "CREATE TRIGGER agenda_items_spans_insert AFTER INSERT ON agenda_items BEGIN "
+    "INSERT OR REPLACE INTO item_spans (id, start_minute, end_minute) "
+    "VALUES (NEW.id, NEW.datetime / 60, (COALESCE(NEW.end_datetime, NEW.datetime) + 59) / 60); "
+    "END;"
+    "CREATE TRIGGER agenda_items_spans_update AFTER UPDATE OF datetime, end_datetime ON agenda_items BEGIN "
+    "UPDATE item_spans SET start_minute = NEW.datetime / 60, "
+    "end_minute = (COALESCE(NEW.end_datetime, NEW.datetime) + 59) / 60 WHERE id = NEW.id; "
+    "END;"
+    "CREATE TRIGGER agenda_items_spans_delete AFTER DELETE ON agenda_items "
+    "WHEN (SELECT value FROM db_state WHERE key = 'suppress_stats') = 0 BEGIN "
+    "DELETE FROM item_spans WHERE id = OLD.id; "
+    "END;"
+    "DROP TRIGGER agenda_items_log_insert;"
+    "CREATE TRIGGER agenda_items_log_insert AFTER INSERT ON agenda_items BEGIN "
+    "INSERT INTO changelog (op, item_id, date, time, description, datetime, notified, end_datetime) "
+    "VALUES ('I', NEW.id, NEW.date, NEW.time, NEW.description, NEW.datetime, COALESCE(NEW.notified, 0), "
+    "NEW.end_datetime); "
+    "END;"
+    "INSERT INTO item_spans (id, start_minute, end_minute) "
+    "SELECT id, datetime / 60, (COALESCE(end_datetime, datetime) + 59) / 60 FROM main.agenda_items UNION ALL "
+    "SELECT id, datetime / 60, (COALESCE(end_datetime, datetime) + 59) / 60 FROM archive.agenda_items a "
+    "WHERE NOT EXISTS (SELECT 1 FROM main.agenda_items m WHERE m.id = a.id);",
+
+    // 7: tags, for filtered views. Like item_spans they cover both tiers;
+    // each tag added is logged for replicas ('T', the tag in description),
+    // and goes when its item does.
+    "CREATE TABLE item_tags ("
+    "tag TEXT NOT NULL,"
+    "item_id INTEGER NOT NULL,"
+    "PRIMARY KEY (tag, item_id)"
+    ") WITHOUT ROWID;"
+    "CREATE INDEX item_tags_item ON item_tags(item_id);"
+    "CREATE TRIGGER agenda_items_tags_delete AFTER DELETE ON agenda_items "
+    "WHEN (SELECT value FROM db_state WHERE key = 'suppress_stats') = 0 BEGIN "
+    "DELETE FROM item_tags WHERE item_id = OLD.id; "
+    "END;"
+    "CREATE TRIGGER item_tags_log_insert AFTER INSERT ON item_tags BEGIN "
+    "INSERT INTO changelog (op, item_id, description) VALUES ('T', NEW.item_id, NEW.tag); "
+    "END;",
+
+    // 8: a version counter for the tag indexes, so they are rebuilt only
+    // when item_tags changes rather than on every logged change. Removing
+    // an item removes its tags, which counts too.
+    "INSERT INTO db_state (key, value) VALUES ('tags_version', 0);"
+    "CREATE TRIGGER item_tags_version_insert AFTER INSERT ON item_tags BEGIN "
+    "UPDATE db_state SET value = value + 1 WHERE key = 'tags_version'; "
+    "END;"
+    "CREATE TRIGGER item_tags_version_delete AFTER DELETE ON item_tags BEGIN "
+    "UPDATE db_state SET value = value + 1 WHERE key = 'tags_version'; "
+    "END;",
+};
+
+// Archived items keep their ids. The description column has no type so
+// compressed descriptions stay BLOBs while short ones stay TEXT.
+static const char* const archive_schema_sql =
+    "PRAGMA archive.auto_vacuum = INCREMENTAL;"
+    "CREATE TABLE IF NOT EXISTS archive.agenda_items ("
+    "id INTEGER PRIMARY KEY,"
+    "date TEXT NOT NULL,"
+    "time TEXT NOT NULL,"
+    "description NOT NULL,"
+    "datetime INTEGER NOT NULL,"
+    "notified INTEGER DEFAULT 0,"
+    "end_datetime INTEGER"
+    ");"
+    "CREATE INDEX IF NOT EXISTS archive.agenda_items_datetime ON agenda_items(datetime);"
+    "CREATE INDEX IF NOT EXISTS archive.agenda_items_date ON agenda_items(date, time);";
+
+// Reads both tiers as one table, so range queries never care where an
+// item lives. An item caught between the two steps of an archive move is
+// read from the hot table only.
+static const char* const connection_temp_sql =
+    "CREATE TEMP VIEW IF NOT EXISTS all_items AS "
+    "SELECT id, date, time, description, datetime, notified, end_datetime FROM main.agenda_items "
+    "UNION ALL "
+    "SELECT id, date, time, "
+    "CASE WHEN typeof(description) = 'blob' THEN algen_inflate(description) ELSE description END, "
+    "datetime, notified, end_datetime FROM archive.agenda_items a "
+    "WHERE NOT EXISTS (SELECT 1 FROM main.agenda_items m WHERE m.id = a.id);"
+    // Only TEMP triggers may reach across databases; this one keeps
+    // day_stats, item_spans, item_tags and the change log right when
+    // 'algen remove' deletes an archived item
+    "CREATE TEMP TRIGGER IF NOT EXISTS archive_items_stats_delete AFTER DELETE ON archive.agenda_items BEGIN "
+    "UPDATE day_stats SET item_count = item_count - 1, "
+    "notified_count = notified_count - COALESCE(OLD.notified, 0), "
+    "first_time = CASE WHEN OLD.time = first_time THEN COALESCE((SELECT min(time) FROM ("
+    "SELECT time FROM main.agenda_items WHERE date = OLD.date UNION ALL "
+    "SELECT time FROM archive.agenda_items WHERE date = OLD.date)), first_time) ELSE first_time END, "
+    "last_time = CASE WHEN OLD.time = last_time THEN COALESCE((SELECT max(time) FROM ("
+    "SELECT time FROM main.agenda_items WHERE date = OLD.date UNION ALL "
+    "SELECT time FROM archive.agenda_items WHERE date = OLD.date)), last_time) ELSE last_time END "
+    "WHERE date = OLD.date; "
+    "DELETE FROM day_stats WHERE date = OLD.date AND item_count <= 0; "
+    "DELETE FROM item_spans WHERE id = OLD.id; "
+    "DELETE FROM item_tags WHERE item_id = OLD.id; "
+    "INSERT INTO changelog (op, item_id) VALUES ('D', OLD.id); "
+    "END;";
+
+// Items matching where from both tiers, like all_items, sorted by order.
+// Spelled out so SQLite can filter each half on its own indexes and merge
+// the results; reading the view copies every row through a co-routine,
+// three allocations per row. where may use numbered parameters only.
+#define BOTH_TIERS_SQL(where, order) \
+    "SELECT id, date, time, description, datetime, notified, end_datetime " \
+    "FROM main.agenda_items WHERE (" where ") " \
+    "UNION ALL " \
+    "SELECT id, date, time, " \
+    "CASE WHEN typeof(description) = 'blob' THEN algen_inflate(description) ELSE description END, " \
+    "datetime, notified, end_datetime FROM archive.agenda_items a WHERE (" where ") " \
+    "AND NOT EXISTS (SELECT 1 FROM main.agenda_items m WHERE m.id = a.id) " \
+    "ORDER BY " order ";"
+
+// For the scheduler simulation: connections opened while counting is on
+// count every statement they start. Statements run by triggers report
+// themselves as "-- TRIGGER ..." comments and aren't counted.
+static int count_statements = 0;
+static unsigned long statement_count = 0;
+
+static int trace_statement(unsigned type, void* context, void* statement, void* sql) {
+    (void)type;
+    (void)context;
+    (void)statement;
+    if (strncmp((const char*)sql, "--", 2) != 0) {
+        __atomic_add_fetch(&statement_count, 1, __ATOMIC_RELAXED);
     }
+    return 0;
+}
 
-    // Create table if it doesn't exist
-    const char* create_table_sql = 
-        "CREATE TABLE IF NOT EXISTS agenda_items ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "date TEXT NOT NULL,"
-        "time TEXT NOT NULL,"
-        "description TEXT NOT NULL,"
-        "datetime INTEGER NOT NULL,"
-        "notified INTEGER DEFAULT 0"
-        ");";
+void db_count_statements(int enabled) {
+    count_statements = enabled;
+}
+
+unsigned long db_statement_count(void) {
+    return __atomic_load_n(&statement_count, __ATOMIC_RELAXED);
+}
 
+static int db_exec_on(sqlite3* conn, const char* sql) {
     char* err_msg = NULL;
-    rc = sqlite3_exec(db, create_table_sql, NULL, NULL, &err_msg);
+    int rc = sqlite3_exec(conn, sql, NULL, NULL, &err_msg);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
         return -1;
     }
+    return 0;
+}
+
+// Archived descriptions are stored as a 4-byte big-endian length followed by
+// zlib data. Without zlib they are stored as plain text.
+static void sql_deflate(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    (void)argc;
+    const unsigned char* text = sqlite3_value_text(argv[0]);
+    int length = sqlite3_value_bytes(argv[0]);
+    
+#ifdef ALGEN_WITH_ZLIB
+    uLongf packed_length = compressBound(length);
+    unsigned char* packed = malloc(packed_length + 4);
+    if (packed && compress2(packed + 4, &packed_length, text, length, Z_BEST_COMPRESSION) == Z_OK
+            && packed_length + 4 < (uLongf)length) {
+        packed[0] = (unsigned char)(length >> 24);
+        packed[1] = (unsigned char)(length >> 16);
+        packed[2] = (unsigned char)(length >> 8);
+        packed[3] = (unsigned char)length;
+        sqlite3_result_blob(context, packed, (int)packed_length + 4, free);
+        return;
+    }
+    free(packed);
+#endif
+    
+    // Short descriptions don't shrink; keep them as text
+    sqlite3_result_text(context, (const char*)text, length, SQLITE_TRANSIENT);
+}
+
+static void sql_inflate(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    (void)argc;
+#ifdef ALGEN_WITH_ZLIB
+    const unsigned char* packed = sqlite3_value_blob(argv[0]);
+    int packed_length = sqlite3_value_bytes(argv[0]);
+    if (packed_length < 4) {
+        sqlite3_result_error(context, "corrupt archived description", -1);
+        return;
+    }
+    
+    uLongf length = ((uLongf)packed[0] << 24) | ((uLongf)packed[1] << 16) |
+                    ((uLongf)packed[2] << 8) | (uLongf)packed[3];
+    char* text = malloc(length + 1);
+    if (!text || uncompress((unsigned char*)text, &length, packed + 4, packed_length - 4) != Z_OK) {
+        free(text);
+        sqlite3_result_error(context, "corrupt archived description", -1);
+        return;
+    }
+    sqlite3_result_text(context, text, (int)length, free);
+#else
+    (void)argv;
+    sqlite3_result_error(context, "archived description is compressed; rebuild with ZLIB=1", -1);
+#endif
+}
+
+// algen_tagged(filter, id): whether the bitmap bound as filter holds id.
+// The bitmap is passed with sqlite3_bind_pointer; SQL can't forge one.
+static void sql_tagged(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    (void)argc;
+    const bitmap_t* filter = sqlite3_value_pointer(argv[0], "algen_bitmap");
+    sqlite3_result_int(context, filter && bitmap_contains(filter, (uint32_t)sqlite3_value_int(argv[1])));
+}
+
+static int query_int(sqlite3* conn, const char* sql);
+
+static const char* const create_table_sql = 
+    "CREATE TABLE IF NOT EXISTS agenda_items ("
+    "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "date TEXT NOT NULL,"
+    "time TEXT NOT NULL,"
+    "description TEXT NOT NULL,"
+    "datetime INTEGER NOT NULL,"
+    "notified INTEGER DEFAULT 0"
+    ");";
+
+static int db_migrate(sqlite3* conn) {
+    const int target = (int)(sizeof(schema_migrations) / sizeof(schema_migrations[0]));
+    
+    // Up to date is the common case; don't take the write lock for it
+    if (query_int(conn, "PRAGMA user_version;") == target) {
+        return 0;
+    }
+    
+    // Client and server may start together; the write lock serializes them
+    if (db_exec_on(conn, "BEGIN IMMEDIATE;") != 0) {
+        return -1;
+    }
+    
+    int version = query_int(conn, "PRAGMA user_version;");
+    
+    for (; version < target; version++) {
+        char pragma[64];
+        snprintf(pragma, sizeof(pragma), "PRAGMA user_version = %d;", version + 1);
+        if (db_exec_on(conn, schema_migrations[version]) != 0 || db_exec_on(conn, pragma) != 0) {
+            fprintf(stderr, "Schema migration %d failed\n", version + 1);
+            db_exec_on(conn, "ROLLBACK;");
+            return -1;
+        }
+    }
+    
+    return db_exec_on(conn, "COMMIT;");
+}
+
+// The archive has no user_version of its own, and one created before
+// migration 6 lacks end_datetime; its columns are checked directly
+static int db_upgrade_archive(sqlite3* conn) {
+    static const char* const check_sql =
+        "SELECT count(*) FROM pragma_table_info('agenda_items', 'archive') WHERE name = 'end_datetime';";
+    
+    int present = query_int(conn, check_sql);
+    if (present != 0) {
+        return (present > 0) ? 0 : -1;
+    }
+    
+    if (db_exec_on(conn, "BEGIN IMMEDIATE;") != 0) {
+        return -1;
+    }
+    if (query_int(conn, check_sql) == 0 &&
+        db_exec_on(conn, "ALTER TABLE archive.agenda_items ADD COLUMN end_datetime INTEGER;") != 0) {
+        db_exec_on(conn, "ROLLBACK;");
+        return -1;
+    }
+    return db_exec_on(conn, "COMMIT;");
+}
 
+// Opens path with the archive attached and the compression functions
+// registered, without touching the schema
+static int open_connection(const char* path, const char* archive_path, int flags, sqlite3** conn) {
+    if (sqlite3_open_v2(path, conn, flags, NULL) != SQLITE_OK) {
+        if (flags & SQLITE_OPEN_CREATE) {
+            fprintf(stderr, "Cannot open database %s: %s\n", path, sqlite3_errmsg(*conn));
+        }
+        sqlite3_close(*conn);
+        *conn = NULL;
+        return -1;
+    }
+    
+    // Wait for a concurrent writer instead of failing outright
+    sqlite3_busy_timeout(*conn, 5000);
+    if (count_statements) {
+        sqlite3_trace_v2(*conn, SQLITE_TRACE_STMT, trace_statement, NULL);
+    }
+    
+    sqlite3_create_function(*conn, "algen_deflate", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, sql_deflate, NULL, NULL);
+    sqlite3_create_function(*conn, "algen_inflate", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, sql_inflate, NULL, NULL);
+    sqlite3_create_function(*conn, "algen_tagged", 2, SQLITE_UTF8, NULL, sql_tagged, NULL, NULL);
+    
+    sqlite3_stmt* attach;
+    int rc = sqlite3_prepare_v2(*conn, "ATTACH DATABASE ? AS archive;", -1, &attach, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(attach, 1, archive_path, -1, SQLITE_STATIC);
+        rc = (sqlite3_step(attach) == SQLITE_DONE) ? SQLITE_OK : SQLITE_ERROR;
+        sqlite3_finalize(attach);
+    }
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Cannot attach archive %s: %s\n", archive_path, sqlite3_errmsg(*conn));
+        sqlite3_close(*conn);
+        *conn = NULL;
+        return -1;
+    }
+    
     return 0;
 }
 
-int db_add_item(const char* date, const char* time, const char* description) {
-    if (!db) {
-        if (db_init() != 0) return -1;
+// Opens a calendar's database with its archive attached and the schema
+// migrated. Each thread doing writes of its own (the maintenance thread)
+// gets a separate connection. Without create, a missing file is an error.
+int db_open_calendar(const char* path, const char* archive_path, int create, sqlite3** conn) {
+    int flags = SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+    if (open_connection(path, archive_path, flags, conn) != 0) {
+        return -1;
+    }
+    
+    // auto_vacuum only takes effect on a new database; existing ones switch
+    // on the next full VACUUM (see db_run_maintenance). WAL lets readers,
+    // including online backups, keep a snapshot without blocking writers.
+    if (db_exec_on(*conn, "PRAGMA main.auto_vacuum = INCREMENTAL;") != 0 ||
+        db_exec_on(*conn, archive_schema_sql) != 0 ||
+        db_exec_on(*conn, "PRAGMA main.journal_mode = WAL; PRAGMA archive.journal_mode = WAL;") != 0 ||
+        db_exec_on(*conn, create_table_sql) != 0 ||
+        db_upgrade_archive(*conn) != 0 ||
+        db_migrate(*conn) != 0 ||
+        db_exec_on(*conn, connection_temp_sql) != 0) {
+        fprintf(stderr, "Cannot set up database %s: %s\n", path, sqlite3_errmsg(*conn));
+        sqlite3_close(*conn);
+        *conn = NULL;
+        return -1;
+    }
+    
+    return 0;
+}
+
+// A connection for reading a calendar that another connection has
+// already set up. It runs no schema statements, so many threads can open
+// one at once without queueing for the write lock.
+int db_open_reader(const char* path, const char* archive_path, sqlite3** conn) {
+    return open_connection(path, archive_path, SQLITE_OPEN_READWRITE, conn);
+}
+
+// Separate connection to the same files as cal, for maintenance and backups
+static int db_open_separate(calendar_t* cal, sqlite3** conn) {
+    return cal ? db_open_calendar(cal->path, cal->archive_path, 0, conn)
+               : db_open_calendar(DB_PATH, ARCHIVE_DB_PATH, 1, conn);
+}
+
+int db_init(void) {
+    if (db) {
+        return 0;
+    }
+    return db_open_calendar(DB_PATH, ARCHIVE_DB_PATH, 1, &db);
+}
+
+// The connection of cal, or of the default calendar when cal is NULL
+static sqlite3* db_connection(calendar_t* cal) {
+    if (cal) {
+        return cal->conn;
+    }
+    if (!db && db_init() != 0) {
+        return NULL;
+    }
+    return db;
+}
+
+// A queued write. The caller blocks until done, so the strings it points
+// to stay valid while the writer uses them.
+typedef enum {
+    WRITE_ADD_ITEM,
+    WRITE_REMOVE_ITEM,
+    WRITE_MARK_NOTIFIED,
+    WRITE_CLAIM_REMINDERS
+} write_op_t;
+
+typedef struct write_request {
+    write_op_t op;
+    const char* date;
+    const char* time;
+    const char* description;
+    int duration_minutes;
+    const int* offsets;
+    int offset_count;
+    char (*tags)[MAX_TAG_LEN];
+    int tag_count;
+    int id;
+    time_t now;                  // Claims: what is due by then
+    reminder_t** reminders;      // Claims: filled in by the writer
+    int* reminder_count;
+    int result;
+    int done;
+    struct write_request* next;
+} write_request_t;
+
+static int write_submit(calendar_t* cal, write_request_t* request);
+
+// The writer's own connection reuses its statements; preparing one with
+// all the agenda_items triggers costs as much as running it
+#define WRITER_STATEMENT_CACHE 12
+
+static sqlite3* writer_conn = NULL;
+static struct {
+    const char* sql;
+    sqlite3_stmt* stmt;
+} writer_statements[WRITER_STATEMENT_CACHE];
+
+static int write_prepare(sqlite3* conn, const char* sql, sqlite3_stmt** stmt) {
+    if (conn == writer_conn) {
+        for (int i = 0; i < WRITER_STATEMENT_CACHE; i++) {
+            if (writer_statements[i].sql == sql) {
+                *stmt = writer_statements[i].stmt;
+                return SQLITE_OK;
+            }
+            if (!writer_statements[i].sql) {
+                int rc = sqlite3_prepare_v3(conn, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+                if (rc == SQLITE_OK) {
+                    writer_statements[i].sql = sql;
+                    writer_statements[i].stmt = *stmt;
+                }
+                return rc;
+            }
+        }
+    }
+    return sqlite3_prepare_v2(conn, sql, -1, stmt, NULL);
+}
+
+static void write_finalize(sqlite3* conn, sqlite3_stmt* stmt) {
+    if (conn == writer_conn) {
+        for (int i = 0; i < WRITER_STATEMENT_CACHE && writer_statements[i].sql; i++) {
+            if (writer_statements[i].stmt == stmt) {
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                return;
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+int db_add_item(calendar_t* cal, const char* date, const char* time, const char* description) {
+    const int default_offset = NOTIFICATION_ADVANCE_MINUTES;
+    return db_add_item_with_reminders(cal, date, time, 0, description, &default_offset, 1, NULL, 0);
+}
+
+// An item with duration_minutes 0 has no end. Tags come from parse_tags.
+int db_add_item_with_reminders(calendar_t* cal, const char* date, const char* time, int duration_minutes,
+                               const char* description, const int* offsets, int offset_count,
+                               char (*tags)[MAX_TAG_LEN], int tag_count) {
+    // Callers include clients on the write channel, so nothing is trusted
+    if (offset_count < 0 || offset_count > MAX_REMINDERS ||
+        duration_minutes < 0 || duration_minutes > MAX_DURATION_MINUTES) {
+        fprintf(stderr, "Invalid reminders or duration\n");
+        return -1;
+    }
+    for (int i = 0; i < offset_count; i++) {
+        if (offsets[i] < 0 || offsets[i] > MAX_REMINDER_OFFSET_MINUTES) {
+            fprintf(stderr, "Invalid reminder offset: %d minutes\n", offsets[i]);
+            return -1;
+        }
     }
 
+    write_request_t request = { .op = WRITE_ADD_ITEM, .date = date, .time = time,
+                                .description = description, .duration_minutes = duration_minutes,
+                                .offsets = offsets, .offset_count = offset_count,
+                                .tags = tags, .tag_count = tag_count };
+    return write_submit(cal, &request);
+}
+
+// Write operations run inside a transaction their caller opened
+static int add_item_on(sqlite3* conn, const char* date, const char* time, int duration_minutes,
+                       const char* description, const int* offsets, int offset_count,
+                       char (*tags)[MAX_TAG_LEN], int tag_count) {
     time_t datetime = combine_datetime(date, time);
     if (datetime == -1) {
         fprintf(stderr, "Invalid date/time format\n");
         return -1;
     }
 
-    const char* sql = "INSERT INTO agenda_items (date, time, description, datetime) VALUES (?, ?, ?, ?);";
+    const char* sql = "INSERT INTO agenda_items (date, time, description, datetime, end_datetime) "
+                      "VALUES (?, ?, ?, ?, ?);";
+    const char* reminder_sql = "INSERT INTO reminders (item_id, offset_minutes, fire_at, delivered) VALUES (?, ?, ?, ?);";
     sqlite3_stmt* stmt;
+    sqlite3_stmt* reminder_stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    int rc = write_prepare(conn, sql, &stmt);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+    rc = write_prepare(conn, reminder_sql, &reminder_stmt);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        write_finalize(conn, stmt);
         return -1;
     }
 
@@ -56,76 +627,279 @@ int db_add_item(const char* date, const char* time, const char* description) {
     sqlite3_bind_text(stmt, 2, time, -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 3, description, -1, SQLITE_STATIC);
     sqlite3_bind_int64(stmt, 4, datetime);
+    if (duration_minutes > 0) {
+        sqlite3_bind_int64(stmt, 5, datetime + (time_t)duration_minutes * 60);
+    } else {
+        sqlite3_bind_null(stmt, 5);
+    }
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_int64 item_id = sqlite3_last_insert_rowid(conn);
+    write_finalize(conn, stmt);
+
+    time_t now = clock_now();
+    for (int i = 0; i < offset_count && rc == SQLITE_DONE; i++) {
+        time_t fire_at = datetime - (time_t)offsets[i] * 60;
+        sqlite3_bind_int64(reminder_stmt, 1, item_id);
+        sqlite3_bind_int(reminder_stmt, 2, offsets[i]);
+        sqlite3_bind_int64(reminder_stmt, 3, fire_at);
+        // Reminders whose moment has already passed are never delivered
+        sqlite3_bind_int(reminder_stmt, 4, fire_at <= now);
+        rc = sqlite3_step(reminder_stmt);
+        sqlite3_reset(reminder_stmt);
+    }
+    write_finalize(conn, reminder_stmt);
+
+    if (rc == SQLITE_DONE && tag_count > 0) {
+        const char* tag_sql = "INSERT OR IGNORE INTO item_tags (tag, item_id) VALUES (?, ?);";
+        sqlite3_stmt* tag_stmt;
+        rc = write_prepare(conn, tag_sql, &tag_stmt);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+            return -1;
+        }
+        rc = SQLITE_DONE;
+        for (int i = 0; i < tag_count && rc == SQLITE_DONE; i++) {
+            sqlite3_bind_text(tag_stmt, 1, tags[i], -1, SQLITE_STATIC);
+            sqlite3_bind_int64(tag_stmt, 2, item_id);
+            rc = sqlite3_step(tag_stmt);
+            sqlite3_reset(tag_stmt);
+        }
+        write_finalize(conn, tag_stmt);
+    }
 
     if (rc != SQLITE_DONE) {
-        fprintf(stderr, "Failed to insert item: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to insert item: %s\n", sqlite3_errmsg(conn));
         return -1;
     }
 
     return 0;
 }
 
-int db_get_items(view_type_t view, agenda_item_t** items, int* count) {
-    if (!db) {
-        if (db_init() != 0) return -1;
+// Zeroed rows from the arena, or from calloc when there is none
+static void* alloc_rows(arena_t* arena, size_t count, size_t size) {
+    if (!arena) {
+        return calloc(count, size);
+    }
+    void* rows = arena_alloc(arena, count * size);
+    if (rows) {
+        memset(rows, 0, count * size);
     }
+    return rows;
+}
 
-    time_t now = time(NULL);
-    time_t start_time, end_time;
-    struct tm* tm_now = localtime(&now);
-
-    // Calculate time range based on view type
-    switch (view) {
-        case VIEW_TODAY:
-            tm_now->tm_hour = 0;
-            tm_now->tm_min = 0;
-            tm_now->tm_sec = 0;
-            start_time = mktime(tm_now);
-            end_time = start_time + 24 * 60 * 60;
-            break;
-        case VIEW_WEEK:
-            tm_now->tm_hour = 0;
-            tm_now->tm_min = 0;
-            tm_now->tm_sec = 0;
-            tm_now->tm_mday -= tm_now->tm_wday; // Start of week
-            start_time = mktime(tm_now);
-            end_time = start_time + 7 * 24 * 60 * 60;
-            break;
-        case VIEW_MONTH:
-            tm_now->tm_hour = 0;
-            tm_now->tm_min = 0;
-            tm_now->tm_sec = 0;
-            tm_now->tm_mday = 1; // First day of month
-            start_time = mktime(tm_now);
-            tm_now->tm_mon++;
-            if (tm_now->tm_mon > 11) {
-                tm_now->tm_mon = 0;
-                tm_now->tm_year++;
+// Steps an item query to the end in one pass, growing the array as rows
+// come, and finalizes it. The array grows in place while it is the
+// arena's latest allocation.
+static int fetch_items(sqlite3* conn, sqlite3_stmt* stmt, arena_t* arena, agenda_item_t** items, int* count) {
+    agenda_item_t* rows = NULL;
+    int capacity = 0;
+    int rc;
+
+    *count = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (*count == capacity) {
+            int grown_capacity = capacity ? capacity * 2 : 64;
+            agenda_item_t* grown = arena
+                ? arena_grow(arena, rows, capacity * sizeof(agenda_item_t), grown_capacity * sizeof(agenda_item_t))
+                : realloc(rows, grown_capacity * sizeof(agenda_item_t));
+            if (!grown) {
+                rc = SQLITE_NOMEM;
+                break;
             }
-            end_time = mktime(tm_now);
-            break;
-        default:
+            rows = grown;
+            capacity = grown_capacity;
+        }
+
+        agenda_item_t* item = &rows[(*count)++];
+        memset(item, 0, sizeof(agenda_item_t));
+        item->id = sqlite3_column_int(stmt, 0);
+        strncpy(item->date, (const char*)sqlite3_column_text(stmt, 1), MAX_DATE_LEN - 1);
+        strncpy(item->time, (const char*)sqlite3_column_text(stmt, 2), MAX_TIME_LEN - 1);
+        strncpy(item->description, (const char*)sqlite3_column_text(stmt, 3), MAX_DESCRIPTION_LEN - 1);
+        item->datetime = sqlite3_column_int64(stmt, 4);
+        item->notified = sqlite3_column_int(stmt, 5);
+        item->end_datetime = sqlite3_column_int64(stmt, 6);
+    }
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to read items: %s\n", rc == SQLITE_NOMEM ? "out of memory" : sqlite3_errmsg(conn));
+        sqlite3_finalize(stmt);
+        if (!arena) free(rows);
+        *items = NULL;
+        *count = 0;
+        return -1;
+    }
+
+    sqlite3_finalize(stmt);
+    *items = rows;
+    return 0;
+}
+
+int db_get_items(calendar_t* cal, arena_t* arena, view_type_t view, agenda_item_t** items, int* count) {
+    time_t start_time, end_time;
+    if (view_time_range(view, clock_now(), &start_time, &end_time) != 0) {
+        return -1;
+    }
+    return db_get_items_between(cal, arena, start_time, end_time, NULL, items, count);
+}
+
+// The ids of a small filter as a JSON array for json_each, in memory for
+// the caller to free
+static char* filter_id_list(const bitmap_t* filter) {
+    uint32_t ids[TAG_LOOKUP_MAX_ITEMS];
+    uint32_t id_count = bitmap_values(filter, ids, TAG_LOOKUP_MAX_ITEMS);
+
+    size_t size = 3 + (size_t)id_count * 11;
+    char* list = malloc(size);
+    if (!list) {
+        return NULL;
+    }
+    size_t used = snprintf(list, size, "[");
+    for (uint32_t i = 0; i < id_count; i++) {
+        used += snprintf(list + used, size - used, i ? ",%u" : "%u", ids[i]);
+    }
+    snprintf(list + used, size - used, "]");
+    return list;
+}
+
+// Items starting in [start, end), in datetime order. Ranges may reach
+// back into the archive. With a filter (from tag_filter), only the items
+// in it: a small one is read by id, a larger one while scanning the
+// range, each row costing a bitmap probe.
+int db_get_items_between(calendar_t* cal, arena_t* arena, time_t start, time_t end, const bitmap_t* filter,
+                         agenda_item_t** items, int* count) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    uint32_t filter_size = filter ? bitmap_cardinality(filter) : 0;
+    if (filter && filter_size == 0) {
+        *items = NULL;
+        *count = 0;
+        return 0;
+    }
+
+    char* id_list = NULL;
+    const char* sql = BOTH_TIERS_SQL("datetime >= ?1 AND datetime < ?2", "datetime");
+    if (filter && filter_size <= TAG_LOOKUP_MAX_ITEMS) {
+        if (!(id_list = filter_id_list(filter))) {
             return -1;
+        }
+        sql = BOTH_TIERS_SQL("id IN (SELECT value FROM json_each(?3)) AND datetime >= ?1 AND datetime < ?2",
+                             "datetime");
+    } else if (filter) {
+        sql = BOTH_TIERS_SQL("datetime >= ?1 AND datetime < ?2 AND algen_tagged(?3, id)", "datetime");
+    }
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        free(id_list);
+        return -1;
+    }
+
+    sqlite3_bind_int64(stmt, 1, start);
+    sqlite3_bind_int64(stmt, 2, end);
+    if (id_list) {
+        sqlite3_bind_text(stmt, 3, id_list, -1, free);
+    } else if (filter) {
+        sqlite3_bind_pointer(stmt, 3, (void*)filter, "algen_bitmap", NULL);
+    }
+    return fetch_items(conn, stmt, arena, items, count);
+}
+
+// How many items start in [start, end), and the first and last of their
+// start times, from the datetime indexes of both tiers. With no items,
+// count is 0 and first and last are end.
+int db_get_item_bounds(calendar_t* cal, time_t start, time_t end, int* count, time_t* first, time_t* last) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    const char* sql =
+        "SELECT count(*), min(datetime), max(datetime) FROM ("
+        "SELECT datetime FROM main.agenda_items WHERE datetime >= ?1 AND datetime < ?2 "
+        "UNION ALL "
+        "SELECT datetime FROM archive.agenda_items a WHERE datetime >= ?1 AND datetime < ?2 "
+        "AND NOT EXISTS (SELECT 1 FROM main.agenda_items m WHERE m.id = a.id));";
+
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
     }
 
-    const char* sql = "SELECT id, date, time, description, datetime, notified "
-                     "FROM agenda_items WHERE datetime >= ? AND datetime < ? "
-                     "ORDER BY datetime;";
+    sqlite3_bind_int64(stmt, 1, start);
+    sqlite3_bind_int64(stmt, 2, end);
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_ROW) {
+        fprintf(stderr, "Failed to read item bounds: %s\n", sqlite3_errmsg(conn));
+        sqlite3_finalize(stmt);
+        return -1;
+    }
+
+    *count = sqlite3_column_int(stmt, 0);
+    *first = *count ? sqlite3_column_int64(stmt, 1) : end;
+    *last = *count ? sqlite3_column_int64(stmt, 2) : end;
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+// Items overlapping [start, end), in datetime order. An item without an
+// end is the single moment it starts; two items meet when each starts
+// before the other ends, or when they start together. The R*-tree narrows
+// the candidates to whole minutes, the exact times decide. As an IN list
+// the candidates are rowid lookups in each tier; a join would make SQLite
+// scan the tier first.
+int db_get_overlapping_items(calendar_t* cal, arena_t* arena, time_t start, time_t end,
+                             agenda_item_t** items, int* count) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    const char* sql = BOTH_TIERS_SQL(
+        "id IN (SELECT id FROM item_spans WHERE start_minute <= ?3 AND end_minute >= ?4) "
+        "AND ((datetime < ?2 AND ?1 < COALESCE(end_datetime, datetime)) OR datetime = ?1)",
+        "datetime, id");
     
     sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    if (end < start) {
+        end = start;
+    }
+    sqlite3_bind_int64(stmt, 1, start);
+    sqlite3_bind_int64(stmt, 2, end);
+    sqlite3_bind_int64(stmt, 3, (end + 59) / 60);
+    sqlite3_bind_int64(stmt, 4, start / 60);
+
+    return fetch_items(conn, stmt, arena, items, count);
+}
+
+static const char* const due_reminders_sql =
+    "SELECT r.id, r.offset_minutes, r.fire_at, "
+    "a.id, a.date, a.time, a.description, a.datetime, a.notified "
+    "FROM reminders r JOIN agenda_items a ON a.id = r.item_id "
+    "WHERE r.delivered = 0 AND r.fire_at <= ? "
+    "ORDER BY r.fire_at;";
+
+// Reads every due reminder with one range scan over the partial index of
+// undelivered reminders, however many offsets each item carries
+static int fetch_due_reminders(sqlite3* conn, time_t now, reminder_t** reminders, int* count) {
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(conn, due_reminders_sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
         return -1;
     }
 
-    sqlite3_bind_int64(stmt, 1, start_time);
-    sqlite3_bind_int64(stmt, 2, end_time);
+    sqlite3_bind_int64(stmt, 1, now);
 
-    // Count items first
+    // Count reminders first
     *count = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         (*count)++;
@@ -135,59 +909,287 @@ int db_get_items(view_type_t view, agenda_item_t** items, int* count) {
 
     if (*count == 0) {
         sqlite3_finalize(stmt);
-        *items = NULL;
+        *reminders = NULL;
         return 0;
     }
 
-    // Allocate memory for items
-    *items = malloc(*count * sizeof(agenda_item_t));
-    if (!*items) {
+    // Allocate memory for reminders
+    *reminders = calloc(*count, sizeof(reminder_t));
+    if (!*reminders) {
         sqlite3_finalize(stmt);
         return -1;
     }
 
-    // Fetch items
+    // Fetch reminders
     int i = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW && i < *count) {
-        (*items)[i].id = sqlite3_column_int(stmt, 0);
-        strncpy((*items)[i].date, (const char*)sqlite3_column_text(stmt, 1), MAX_DATE_LEN - 1);
-        strncpy((*items)[i].time, (const char*)sqlite3_column_text(stmt, 2), MAX_TIME_LEN - 1);
-        strncpy((*items)[i].description, (const char*)sqlite3_column_text(stmt, 3), MAX_DESCRIPTION_LEN - 1);
-        (*items)[i].datetime = sqlite3_column_int64(stmt, 4);
-        (*items)[i].notified = sqlite3_column_int(stmt, 5);
+        reminder_t* reminder = &(*reminders)[i];
+        reminder->id = sqlite3_column_int(stmt, 0);
+        reminder->offset_minutes = sqlite3_column_int(stmt, 1);
+        reminder->fire_at = sqlite3_column_int64(stmt, 2);
+        reminder->item.id = sqlite3_column_int(stmt, 3);
+        strncpy(reminder->item.date, (const char*)sqlite3_column_text(stmt, 4), MAX_DATE_LEN - 1);
+        strncpy(reminder->item.time, (const char*)sqlite3_column_text(stmt, 5), MAX_TIME_LEN - 1);
+        strncpy(reminder->item.description, (const char*)sqlite3_column_text(stmt, 6), MAX_DESCRIPTION_LEN - 1);
+        reminder->item.datetime = sqlite3_column_int64(stmt, 7);
+        reminder->item.notified = sqlite3_column_int(stmt, 8);
         i++;
     }
+    *count = i;
 
     sqlite3_finalize(stmt);
     return 0;
 }
 
-int db_get_pending_notifications(agenda_item_t** items, int* count) {
-    if (!db) {
-        if (db_init() != 0) return -1;
+int db_get_due_reminders(calendar_t* cal, time_t now, reminder_t** reminders, int* count) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    return fetch_due_reminders(conn, now, reminders, count);
+}
+
+// Claims run inside a transaction their caller opened, like the other
+// writes, and return the reminders they marked delivered
+static int claim_due_reminders_on(sqlite3* conn, time_t now, reminder_t** reminders, int* count) {
+    if (fetch_due_reminders(conn, now, reminders, count) != 0) {
+        return -1;
+    }
+
+    if (*count == 0) {
+        return 0;
+    }
+
+    // The item counts as notified once any of its reminders went out
+    static const char* const statements[] = {
+        "UPDATE agenda_items SET notified = 1 WHERE id IN "
+        "(SELECT item_id FROM reminders WHERE delivered = 0 AND fire_at <= ?);",
+        "UPDATE reminders SET delivered = 1 WHERE delivered = 0 AND fire_at <= ?;"
+    };
+    int rc = SQLITE_OK;
+
+    for (int i = 0; i < 2 && rc == SQLITE_OK; i++) {
+        sqlite3_stmt* stmt;
+        rc = write_prepare(conn, statements[i], &stmt);
+        if (rc != SQLITE_OK) break;
+        sqlite3_bind_int64(stmt, 1, now);
+        rc = (sqlite3_step(stmt) == SQLITE_DONE) ? SQLITE_OK : SQLITE_ERROR;
+        write_finalize(conn, stmt);
+    }
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to claim reminders: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+    return 0;
+}
+
+// The write lock is taken before reading, so no other connection or
+// server instance can claim the same reminders between the read and the
+// updates. The whole batch costs one commit, shared with whatever else
+// the writer is committing.
+int db_claim_due_reminders(calendar_t* cal, time_t now, reminder_t** reminders, int* count) {
+    *reminders = NULL;
+    *count = 0;
+
+    write_request_t request = { .op = WRITE_CLAIM_REMINDERS, .now = now,
+                                .reminders = reminders, .reminder_count = count };
+    if (write_submit(cal, &request) != 0) {
+        free(*reminders);
+        *reminders = NULL;
+        *count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// When the earliest undelivered reminder fires, from the partial index
+// alone; 0 when none is pending
+int db_next_reminder_time(calendar_t* cal, time_t* fire_at) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn, "SELECT min(fire_at) FROM reminders WHERE delivered = 0;",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    int rc = sqlite3_step(stmt);
+    *fire_at = (rc == SQLITE_ROW) ? (time_t)sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_ROW) ? 0 : -1;
+}
+
+// The version of item_tags, bumped by triggers on every tag added or
+// removed; unchanged means the tag indexes are current
+int db_get_tags_version(calendar_t* cal, long long* version) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn,
+            "SELECT COALESCE((SELECT value FROM main.db_state WHERE key = 'tags_version'), 0);",
+            -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
     }
 
-    time_t now = time(NULL);
-    // Look for events that are exactly 15 minutes away (with a 1-minute window for safety)
-    time_t target_time = now + (NOTIFICATION_ADVANCE_MINUTES * 60);
-    time_t notification_start = target_time - 30; // 30 seconds before the 15-minute mark
-    time_t notification_end = target_time + 30;   // 30 seconds after the 15-minute mark
+    int rc = sqlite3_step(stmt);
+    *version = (rc == SQLITE_ROW) ? sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_ROW) ? 0 : -1;
+}
+
+// Calls visit with every tag of every item, by tag and then item id,
+// until it returns nonzero
+int db_each_item_tag(calendar_t* cal, int (*visit)(const char* tag, int item_id, void* context), void* context) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn, "SELECT tag, item_id FROM item_tags ORDER BY tag, item_id;",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
 
-    const char* sql = "SELECT id, date, time, description, datetime, notified "
-                     "FROM agenda_items WHERE datetime >= ? AND datetime <= ? AND notified = 0 "
-                     "ORDER BY datetime;";
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (visit((const char*)sqlite3_column_text(stmt, 0), sqlite3_column_int(stmt, 1), context) != 0) {
+            sqlite3_finalize(stmt);
+            return -1;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to read tags: %s\n", sqlite3_errmsg(conn));
+    }
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+// Turns free text into an FTS5 query: every word becomes a quoted phrase
+// (so punctuation can't break the syntax) and a trailing * keeps prefix
+// matching. Words are ANDed.
+static int build_fts_query(const char* terms, char* query, size_t query_size) {
+    size_t length = 0;
+    const char* p = terms;
+    
+    while (*p) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        
+        size_t word_length = strcspn(p, " \t");
+        int prefix = (word_length > 1 && p[word_length - 1] == '*');
+        if (prefix) word_length--;
+        
+        if (length + word_length * 2 + 5 >= query_size) {
+            return -1;
+        }
+        
+        if (length > 0) query[length++] = ' ';
+        query[length++] = '"';
+        for (size_t i = 0; i < word_length; i++) {
+            if (p[i] == '"') query[length++] = '"';
+            query[length++] = p[i];
+        }
+        query[length++] = '"';
+        if (prefix) query[length++] = '*';
+        
+        p += word_length + prefix;
+    }
+    
+    query[length] = '\0';
+    return (length > 0) ? 0 : -1;
+}
+
+int db_search_items(calendar_t* cal, arena_t* arena, const char* terms, time_t from, time_t to, int limit,
+                    search_result_t** results, int* count) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    char query[1024];
+    if (build_fts_query(terms, query, sizeof(query)) != 0) {
+        fprintf(stderr, "Invalid search terms\n");
+        return -1;
+    }
+
+    // Snippet matches are wrapped in SEARCH_MATCH_START/END so each output
+    // format can render them its own way
+    const char* sql = "SELECT a.id, a.date, a.time, a.description, a.datetime, a.notified, "
+                     "snippet(agenda_fts, 0, char(2), char(3), '...', 16), bm25(agenda_fts), a.end_datetime "
+                     "FROM agenda_fts JOIN agenda_items a ON a.id = agenda_fts.rowid "
+                     "WHERE agenda_fts MATCH ? AND a.datetime >= ? AND a.datetime < ? "
+                     "ORDER BY bm25(agenda_fts) LIMIT ?;";
+    
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, from);
+    sqlite3_bind_int64(stmt, 3, to);
+    sqlite3_bind_int(stmt, 4, limit);
+
+    // LIMIT bounds the result, so allocate for it up front
+    *results = alloc_rows(arena, limit > 0 ? limit : 1, sizeof(search_result_t));
+    if (!*results) {
+        sqlite3_finalize(stmt);
+        return -1;
+    }
+
+    int i = 0;
+    while (i < limit && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        search_result_t* result = &(*results)[i];
+        result->item.id = sqlite3_column_int(stmt, 0);
+        strncpy(result->item.date, (const char*)sqlite3_column_text(stmt, 1), MAX_DATE_LEN - 1);
+        strncpy(result->item.time, (const char*)sqlite3_column_text(stmt, 2), MAX_TIME_LEN - 1);
+        strncpy(result->item.description, (const char*)sqlite3_column_text(stmt, 3), MAX_DESCRIPTION_LEN - 1);
+        result->item.datetime = sqlite3_column_int64(stmt, 4);
+        result->item.notified = sqlite3_column_int(stmt, 5);
+        strncpy(result->snippet, (const char*)sqlite3_column_text(stmt, 6), sizeof(result->snippet) - 1);
+        result->rank = sqlite3_column_double(stmt, 7);
+        result->item.end_datetime = sqlite3_column_int64(stmt, 8);
+        i++;
+    }
+    *count = i;
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        fprintf(stderr, "Search failed: %s\n", sqlite3_errmsg(conn));
+        sqlite3_finalize(stmt);
+        if (!arena) free(*results);
+        *results = NULL;
+        return -1;
+    }
+
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+// Reads the aggregate rows for dates in [from_date, to_date), YYYY-MM-DD;
+// a year is at most 366 rows however many items it holds
+int db_get_day_stats(calendar_t* cal, arena_t* arena, const char* from_date, const char* to_date,
+                     day_stats_t** stats, int* count) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    const char* sql = "SELECT date, item_count, notified_count, first_time, last_time "
+                     "FROM day_stats WHERE date >= ? AND date < ? ORDER BY date;";
     
     sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    int rc = sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
         return -1;
     }
 
-    sqlite3_bind_int64(stmt, 1, notification_start);
-    sqlite3_bind_int64(stmt, 2, notification_end);
+    sqlite3_bind_text(stmt, 1, from_date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, to_date, -1, SQLITE_STATIC);
 
-    // Count items first
+    // Count rows first
     *count = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         (*count)++;
@@ -197,89 +1199,638 @@ int db_get_pending_notifications(agenda_item_t** items, int* count) {
 
     if (*count == 0) {
         sqlite3_finalize(stmt);
-        *items = NULL;
+        *stats = NULL;
         return 0;
     }
 
-    // Allocate memory for items
-    *items = malloc(*count * sizeof(agenda_item_t));
-    if (!*items) {
+    *stats = alloc_rows(arena, *count, sizeof(day_stats_t));
+    if (!*stats) {
         sqlite3_finalize(stmt);
         return -1;
     }
 
-    // Fetch items
     int i = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW && i < *count) {
-        (*items)[i].id = sqlite3_column_int(stmt, 0);
-        strncpy((*items)[i].date, (const char*)sqlite3_column_text(stmt, 1), MAX_DATE_LEN - 1);
-        strncpy((*items)[i].time, (const char*)sqlite3_column_text(stmt, 2), MAX_TIME_LEN - 1);
-        strncpy((*items)[i].description, (const char*)sqlite3_column_text(stmt, 3), MAX_DESCRIPTION_LEN - 1);
-        (*items)[i].datetime = sqlite3_column_int64(stmt, 4);
-        (*items)[i].notified = sqlite3_column_int(stmt, 5);
+        day_stats_t* day = &(*stats)[i];
+        strncpy(day->date, (const char*)sqlite3_column_text(stmt, 0), MAX_DATE_LEN - 1);
+        day->item_count = sqlite3_column_int(stmt, 1);
+        day->notified_count = sqlite3_column_int(stmt, 2);
+        strncpy(day->first_time, (const char*)sqlite3_column_text(stmt, 3), MAX_TIME_LEN - 1);
+        strncpy(day->last_time, (const char*)sqlite3_column_text(stmt, 4), MAX_TIME_LEN - 1);
         i++;
     }
+    *count = i;
 
     sqlite3_finalize(stmt);
     return 0;
 }
 
-int db_mark_notified(int id) {
-    if (!db) {
-        if (db_init() != 0) return -1;
-    }
+int db_mark_notified(calendar_t* cal, int id) {
+    write_request_t request = { .op = WRITE_MARK_NOTIFIED, .id = id };
+    return write_submit(cal, &request);
+}
+
+int db_remove_item(calendar_t* cal, int id) {
+    write_request_t request = { .op = WRITE_REMOVE_ITEM, .id = id };
+    return write_submit(cal, &request);
+}
 
+static int mark_notified_on(sqlite3* conn, int id) {
     const char* sql = "UPDATE agenda_items SET notified = 1 WHERE id = ?;";
     sqlite3_stmt* stmt;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    int rc = write_prepare(conn, sql, &stmt);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
         return -1;
     }
 
     sqlite3_bind_int(stmt, 1, id);
 
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    write_finalize(conn, stmt);
 
     if (rc != SQLITE_DONE) {
-        fprintf(stderr, "Failed to update item: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to update item: %s\n", sqlite3_errmsg(conn));
         return -1;
     }
 
     return 0;
 }
 
-int db_remove_item(int id) {
-    const char* sql = "DELETE FROM agenda_items WHERE id = ?";
-    sqlite3_stmt* stmt;
+static int remove_item_on(sqlite3* conn, int id) {
+    // An item lives in exactly one tier
+    static const char* const statements[] = {
+        "DELETE FROM main.agenda_items WHERE id = ?",
+        "DELETE FROM archive.agenda_items WHERE id = ?"
+    };
+    int changes = 0;
     
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+    for (int i = 0; i < 2 && changes == 0; i++) {
+        sqlite3_stmt* stmt;
+        int rc = write_prepare(conn, statements[i], &stmt);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+            return -1;
+        }
+
+        sqlite3_bind_int(stmt, 1, id);
+
+        rc = sqlite3_step(stmt);
+        write_finalize(conn, stmt);
+
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "Failed to remove item: %s\n", sqlite3_errmsg(conn));
+            return -1;
+        }
+        changes = sqlite3_changes(conn);
+    }
+
+    // Check if any rows were actually deleted
+    if (changes == 0) {
+        fprintf(stderr, "No item found with ID %d\n", id);
         return -1;
     }
 
-    sqlite3_bind_int(stmt, 1, id);
+    return 0;
+}
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+static int apply_write(sqlite3* conn, write_request_t* request) {
+    switch (request->op) {
+    case WRITE_ADD_ITEM:
+        return add_item_on(conn, request->date, request->time, request->duration_minutes,
+                           request->description, request->offsets, request->offset_count,
+                           request->tags, request->tag_count);
+    case WRITE_REMOVE_ITEM:
+        return remove_item_on(conn, request->id);
+    case WRITE_MARK_NOTIFIED:
+        return mark_notified_on(conn, request->id);
+    case WRITE_CLAIM_REMINDERS:
+        return claim_due_reminders_on(conn, request->now, request->reminders, request->reminder_count);
+    }
+    return -1;
+}
 
-    if (rc != SQLITE_DONE) {
-        fprintf(stderr, "Failed to remove item: %s\n", sqlite3_errmsg(db));
+// Group commit. While the writer thread runs it owns a write connection to
+// the default calendar and commits queued writes together: one fsync for
+// up to WRITE_GROUP_MAX writes instead of one each. A caller returns only
+// once the commit holding its write is done, so a write that returned 0 is
+// as durable as before. In the server that covers reminder claims and the
+// adds and removes clients hand over through src/write_channel.c. Named
+// calendars, and processes without a writer, commit each write directly.
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_committed = PTHREAD_COND_INITIALIZER;
+static write_request_t* write_queue_head = NULL;
+static write_request_t* write_queue_tail = NULL;
+static int write_queue_length = 0;
+static int writer_running = 0;
+static int last_group_size = 0;
+static pthread_t writer_thread_id;
+
+static int write_direct(calendar_t* cal, write_request_t* request) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    // An item and its reminders become visible together
+    if (db_exec_on(conn, "BEGIN IMMEDIATE;") != 0) {
+        return -1;
+    }
+    if (apply_write(conn, request) != 0) {
+        db_exec_on(conn, "ROLLBACK;");
         return -1;
     }
+    return db_exec_on(conn, "COMMIT;");
+}
 
-    // Check if any rows were actually deleted
-    if (sqlite3_changes(db) == 0) {
-        fprintf(stderr, "No item found with ID %d\n", id);
+static int write_submit(calendar_t* cal, write_request_t* request) {
+    pthread_mutex_lock(&writer_mutex);
+    if (cal || !writer_running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return write_direct(cal, request);
+    }
+
+    request->next = NULL;
+    if (write_queue_tail) write_queue_tail->next = request;
+    else write_queue_head = request;
+    write_queue_tail = request;
+    write_queue_length++;
+    pthread_cond_signal(&writer_queued);
+
+    while (!request->done) {
+        pthread_cond_wait(&writer_committed, &writer_mutex);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return request->result;
+}
+
+// Called on the writer thread after every committed group that added or
+// removed items; claims alone change nothing worth rescheduling for
+static void (*commit_hook)(void) = NULL;
+
+void db_set_commit_hook(void (*hook)(void)) {
+    commit_hook = hook;
+}
+
+// Runs the writes of a group inside the open transaction. The first run
+// has no savepoints and stops at the first failing write, returning 1 with
+// it in *failed; the caller rolls back and runs the group again, skipping
+// that write and giving each of the others a savepoint so a further
+// failure is undone on its own. Returns -1 when the transaction failed.
+static int apply_group(write_request_t* group, write_request_t** failed, int* items_changed) {
+    write_request_t* skip = *failed;
+    int savepoints = (skip != NULL);
+
+    for (write_request_t* request = group; request; request = request->next) {
+        if (request == skip) {
+            continue;
+        }
+        if (savepoints && db_exec_on(writer_conn, "SAVEPOINT write_request;") != 0) {
+            return -1;
+        }
+        request->result = apply_write(writer_conn, request);
+        if (request->result != 0) {
+            if (!savepoints) {
+                *failed = request;
+                return 1;
+            }
+            db_exec_on(writer_conn, "ROLLBACK TO write_request;");
+        } else if (request->op == WRITE_ADD_ITEM || request->op == WRITE_REMOVE_ITEM) {
+            *items_changed = 1;
+        }
+        if (savepoints) {
+            db_exec_on(writer_conn, "RELEASE write_request;");
+        }
+    }
+    return 0;
+}
+
+// Applies a group in one transaction. Writes almost never fail, and a
+// savepoint per write costs about a fifth of an insert, so the group first
+// runs without them. A failing write (say, removing an unknown id) costs
+// the group a rollback and a second run without it.
+static void commit_group(write_request_t* group) {
+    write_request_t* request;
+    write_request_t* failed = NULL;
+    int items_changed = 0;
+    int status = db_exec_on(writer_conn, "BEGIN IMMEDIATE;") != 0 ? -1 : apply_group(group, &failed, &items_changed);
+
+    if (status == 1) {
+        db_exec_on(writer_conn, "ROLLBACK;");
+        if (!group->next) {
+            return;
+        }
+        for (request = group; request; request = request->next) {
+            if (request->op == WRITE_CLAIM_REMINDERS && request != failed) {
+                free(*request->reminders);
+                *request->reminders = NULL;
+                *request->reminder_count = 0;
+            }
+        }
+        items_changed = 0;
+        status = db_exec_on(writer_conn, "BEGIN IMMEDIATE;") != 0 ? -1 : apply_group(group, &failed, &items_changed);
+    }
+
+    if (status != 0 || db_exec_on(writer_conn, "COMMIT;") != 0) {
+        fprintf(stderr, "Group commit failed: %s\n", sqlite3_errmsg(writer_conn));
+        if (!sqlite3_get_autocommit(writer_conn)) {
+            db_exec_on(writer_conn, "ROLLBACK;");
+        }
+        for (request = group; request; request = request->next) {
+            request->result = -1;
+        }
+        return;
+    }
+
+    if (commit_hook && items_changed) {
+        commit_hook();
+    }
+}
+
+static void* writer_thread(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&writer_mutex);
+    for (;;) {
+        while (!write_queue_head && writer_running) {
+            pthread_cond_wait(&writer_queued, &writer_mutex);
+        }
+        if (!write_queue_head) {
+            break;
+        }
+
+        // Linger a moment so writers arriving together share the commit.
+        // A lone writer never had company, so it doesn't wait for any.
+        if (last_group_size > 1 && write_queue_length < WRITE_GROUP_MAX && writer_running) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WRITE_GROUP_WINDOW_US * 1000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (write_queue_length < WRITE_GROUP_MAX && writer_running &&
+                   pthread_cond_timedwait(&writer_queued, &writer_mutex, &deadline) == 0) {
+            }
+        }
+
+        // Take up to WRITE_GROUP_MAX writes off the queue
+        write_request_t* group = write_queue_head;
+        write_request_t* last = group;
+        int taken = 1;
+        while (last->next && taken < WRITE_GROUP_MAX) {
+            last = last->next;
+            taken++;
+        }
+        write_queue_head = last->next;
+        if (!write_queue_head) write_queue_tail = NULL;
+        write_queue_length -= taken;
+        last_group_size = taken;
+        last->next = NULL;
+        pthread_mutex_unlock(&writer_mutex);
+
+        commit_group(group);
+
+        pthread_mutex_lock(&writer_mutex);
+        for (write_request_t* request = group; request; request = request->next) {
+            request->done = 1;
+        }
+        pthread_cond_broadcast(&writer_committed);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+int db_writer_start(void) {
+    if (writer_running) {
+        return 0;
+    }
+    if (db_open_calendar(DB_PATH, ARCHIVE_DB_PATH, 1, &writer_conn) != 0) {
+        return -1;
+    }
+
+    writer_running = 1;
+    if (pthread_create(&writer_thread_id, NULL, writer_thread, NULL) != 0) {
+        writer_running = 0;
+        sqlite3_close(writer_conn);
+        writer_conn = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Commits whatever is still queued, then returns writes to the direct path
+void db_writer_stop(void) {
+    pthread_mutex_lock(&writer_mutex);
+    if (!writer_running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return;
+    }
+    writer_running = 0;
+    pthread_cond_signal(&writer_queued);
+    pthread_mutex_unlock(&writer_mutex);
+
+    pthread_join(writer_thread_id, NULL);
+    for (int i = 0; i < WRITER_STATEMENT_CACHE && writer_statements[i].sql; i++) {
+        sqlite3_finalize(writer_statements[i].stmt);
+        writer_statements[i].sql = NULL;
+    }
+    sqlite3_close(writer_conn);
+    writer_conn = NULL;
+}
+
+// Moves one batch of items older than cutoff into the archive. Returns the
+// number moved, 0 once nothing is left, -1 on error.
+//
+// In WAL mode a transaction over attached databases is atomic per file
+// only, so the move is two commits: copy into the archive, then delete
+// what the archive now holds. A crash in between leaves the item in both
+// tiers, which all_items hides and the next pass cleans up; it can never
+// lose an item.
+static int archive_batch(sqlite3* conn, time_t cutoff) {
+    const char* statements[] = {
+        "INSERT OR IGNORE INTO archive.agenda_items (id, date, time, description, datetime, notified, end_datetime) "
+        "SELECT id, date, time, algen_deflate(description), datetime, notified, end_datetime "
+        "FROM main.agenda_items WHERE datetime < ?1 ORDER BY datetime, id LIMIT ?2;",
+        "DELETE FROM main.agenda_items WHERE id IN "
+        "(SELECT m.id FROM main.agenda_items m WHERE m.datetime < ?1 "
+        "AND EXISTS (SELECT 1 FROM archive.agenda_items a WHERE a.id = m.id));"
+    };
+    int moved = 0;
+    
+    for (int i = 0; i < 2; i++) {
+        sqlite3_stmt* stmt;
+        int rc = sqlite3_prepare_v2(conn, statements[i], -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Failed to archive items: %s\n", sqlite3_errmsg(conn));
+            return -1;
+        }
+        sqlite3_bind_int64(stmt, 1, cutoff);
+        if (i == 0) sqlite3_bind_int(stmt, 2, ARCHIVE_BATCH_SIZE);
+        
+        // The copy commits on its own. The delete shares a transaction with
+        // the suppress_stats flag, so day_stats keeps counting the items.
+        if (i == 1 && (db_exec_on(conn, "BEGIN IMMEDIATE;") != 0 ||
+                       db_exec_on(conn, "UPDATE db_state SET value = 1 WHERE key = 'suppress_stats';") != 0)) {
+            sqlite3_finalize(stmt);
+            db_exec_on(conn, "ROLLBACK;");
+            return -1;
+        }
+        
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (i == 1) {
+            moved = sqlite3_changes(conn);
+            if (rc == SQLITE_DONE &&
+                (db_exec_on(conn, "UPDATE db_state SET value = 0 WHERE key = 'suppress_stats';") != 0 ||
+                 db_exec_on(conn, "COMMIT;") != 0)) {
+                rc = SQLITE_ERROR;
+            }
+        }
+        if (rc != SQLITE_DONE) {
+            fprintf(stderr, "Failed to archive items: %s\n", sqlite3_errmsg(conn));
+            if (i == 1) db_exec_on(conn, "ROLLBACK;");
+            return -1;
+        }
+    }
+    
+    return moved;
+}
+
+static int archive_items_on(sqlite3* conn, time_t cutoff, int* archived) {
+    *archived = 0;
+    
+    // Short transactions keep the write lock free for the client and the
+    // notification thread between batches
+    int moved;
+    while ((moved = archive_batch(conn, cutoff)) > 0) {
+        *archived += moved;
+    }
+    
+    return (moved < 0) ? -1 : 0;
+}
+
+int db_archive_items(calendar_t* cal, time_t cutoff, int* archived) {
+    sqlite3* conn = db_connection(cal);
+    if (!conn) return -1;
+
+    return archive_items_on(conn, cutoff, archived);
+}
+
+static int query_int(sqlite3* conn, const char* sql) {
+    sqlite3_stmt* stmt;
+    int value = -1;
+    if (sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+// Returns free pages to the filesystem a slice at a time, so no single
+// step holds the write lock for long
+static int incremental_vacuum(sqlite3* conn, const char* schema) {
+    char sql[96];
+    int freed = 0;
+    
+    snprintf(sql, sizeof(sql), "PRAGMA %s.auto_vacuum;", schema);
+    if (query_int(conn, sql) != 2) {
+        return 0;
+    }
+    
+    snprintf(sql, sizeof(sql), "PRAGMA %s.freelist_count;", schema);
+    int free_pages = query_int(conn, sql);
+    
+    while (free_pages > 0) {
+        char step[96];
+        snprintf(step, sizeof(step), "PRAGMA %s.incremental_vacuum(%d);", schema, VACUUM_SLICE_PAGES);
+        if (db_exec_on(conn, step) != 0) {
+            return -1;
+        }
+        
+        int remaining = query_int(conn, sql);
+        if (remaining < 0 || remaining >= free_pages) break;
+        freed += free_pages - remaining;
+        free_pages = remaining;
+        
+        usleep(10000);
+    }
+    
+    return freed;
+}
+
+int db_run_maintenance(calendar_t* cal, int retention_days) {
+    sqlite3* conn;
+    if (db_open_separate(cal, &conn) != 0) {
         return -1;
     }
+    
+    int archived = 0;
+    int result = 0;
+    
+    if (retention_days > 0) {
+        time_t cutoff = clock_now() - (time_t)retention_days * 24 * 60 * 60;
+        result = archive_items_on(conn, cutoff, &archived);
+    }
+    
+    // Databases created before incremental auto_vacuum need one full VACUUM
+    // to switch modes; say so instead of stalling the server here
+    if (query_int(conn, "PRAGMA main.auto_vacuum;") != 2) {
+        printf("Database %s has no incremental auto_vacuum; enable it once with:\n"
+               "  sqlite3 %s 'PRAGMA auto_vacuum = INCREMENTAL; VACUUM;'\n",
+               sqlite3_db_filename(conn, "main"), sqlite3_db_filename(conn, "main"));
+    }
+    
+    // Replicas further behind than the retained log resync from a snapshot
+    db_exec_on(conn, "DELETE FROM changelog WHERE seq <= "
+                     "(SELECT max(seq) FROM changelog) - " SQL_INT(REPLICATION_LOG_RETAIN) ";");
+    
+    int freed_main = incremental_vacuum(conn, "main");
+    int freed_archive = incremental_vacuum(conn, "archive");
+    if (freed_main < 0 || freed_archive < 0) {
+        result = -1;
+    }
+    
+    if (archived > 0 || freed_main > 0 || freed_archive > 0) {
+        printf("Maintenance: archived %d items, freed %d pages\n",
+               archived, (freed_main > 0 ? freed_main : 0) + (freed_archive > 0 ? freed_archive : 0));
+    }
+    
+    sqlite3_close(conn);
+    return result;
+}
 
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int query_schema_int(sqlite3* conn, const char* schema, const char* format) {
+    char sql[128];
+    snprintf(sql, sizeof(sql), format, schema);
+    return query_int(conn, sql);
+}
+
+// Copies one attached database into dest_path with the online backup API.
+// A read transaction pins one WAL snapshot for the whole copy, so writers
+// on other connections carry on and the copy never restarts. Each step
+// copies BACKUP_STEP_PAGES pages and then yields the CPU and the disk.
+static int backup_schema(sqlite3* source, const char* schema, const char* dest_path,
+                         backup_stats_t* stats) {
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", dest_path);
+    unlink(temp_path);
+    
+    sqlite3* dest;
+    if (sqlite3_open(temp_path, &dest) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open backup file %s: %s\n", temp_path, sqlite3_errmsg(dest));
+        sqlite3_close(dest);
+        return -1;
+    }
+    
+    // Touching the schema starts the read transaction on this file
+    if (db_exec_on(source, "BEGIN;") != 0 ||
+        query_schema_int(source, schema, "SELECT count(*) FROM %s.sqlite_master;") < 0) {
+        db_exec_on(source, "ROLLBACK;");
+        sqlite3_close(dest);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    sqlite3_backup* backup = sqlite3_backup_init(dest, "main", source, schema);
+    if (!backup) {
+        fprintf(stderr, "Cannot start backup of %s: %s\n", schema, sqlite3_errmsg(dest));
+        db_exec_on(source, "ROLLBACK;");
+        sqlite3_close(dest);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    int rc;
+    while ((rc = sqlite3_backup_step(backup, BACKUP_STEP_PAGES)) == SQLITE_OK ||
+           rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+        usleep(BACKUP_YIELD_MS * 1000);
+    }
+    
+    stats->pages += sqlite3_backup_pagecount(backup);
+    sqlite3_backup_finish(backup);
+    
+    // Still inside the snapshot the copy was taken from, so the row count
+    // to compare against is exact
+    int source_rows = query_schema_int(source, schema, "SELECT count(*) FROM %s.agenda_items;");
+    db_exec_on(source, "COMMIT;");
+    
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Backup of %s failed: %s\n", schema, sqlite3_errstr(rc));
+        sqlite3_close(dest);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    // Restore check: the copy must open, pass quick_check and hold the
+    // same rows
+    sqlite3_stmt* stmt;
+    int check_ok = 0;
+    if (sqlite3_prepare_v2(dest, "PRAGMA quick_check;", -1, &stmt, NULL) == SQLITE_OK) {
+        check_ok = (sqlite3_step(stmt) == SQLITE_ROW &&
+                    strcmp((const char*)sqlite3_column_text(stmt, 0), "ok") == 0);
+        sqlite3_finalize(stmt);
+    }
+    
+    int dest_rows = query_int(dest, "SELECT count(*) FROM agenda_items;");
+    sqlite3_close(dest);
+    
+    if (!check_ok || dest_rows < 0 || dest_rows != source_rows) {
+        fprintf(stderr, "Backup of %s failed verification (quick_check %s, %d of %d rows)\n",
+                schema, check_ok ? "ok" : "failed", dest_rows, source_rows);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    // Only a verified copy replaces the previous backup
+    if (rename(temp_path, dest_path) != 0) {
+        perror("rename");
+        unlink(temp_path);
+        return -1;
+    }
+    
+    stats->rows += dest_rows;
     return 0;
 }
 
+// Writes a consistent copy of the database to path and of the archive to
+// path.archive while the server keeps running
+int db_backup(calendar_t* cal, const char* path, backup_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    // A dedicated connection, so the copy never competes with statements
+    // on the shared one
+    sqlite3* source;
+    if (db_open_separate(cal, &source) != 0) {
+        return -1;
+    }
+    
+    char archive_path[512];
+    snprintf(archive_path, sizeof(archive_path), "%s.archive", path);
+    
+    int result = 0;
+    if (backup_schema(source, "main", path, stats) != 0 ||
+        backup_schema(source, "archive", archive_path, stats) != 0) {
+        result = -1;
+    }
+    
+    sqlite3_close(source);
+    stats->seconds = elapsed_seconds(&start);
+    return result;
+}
+
 void db_close(void) {
     if (db) {
         sqlite3_close(db);
@@ -0,0 +1,387 @@
+#include "agenda.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ESCAPE_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define ESCAPE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Escaping for HTML and for iCalendar TEXT values. The scan kernels find
+// the first byte needing an escape 16 or 32 bytes at a time; the runs in
+// between are copied with memcpy. The kernel is picked once from what the
+// CPU supports.
+
+typedef size_t (*scan_fn)(const char* s, size_t length);
+
+typedef struct {
+    const char* name;
+    scan_fn scan_html;           // & < > " '
+    scan_fn scan_ics;            // \ ; , CR LF
+} escape_kernel_t;
+
+// Bytes each format escapes, as a table so the scalar scan has one load and
+// one test per byte
+#define ESCAPE_HTML 1
+#define ESCAPE_ICS 2
+
+static const unsigned char escape_class[256] = {
+    ['&'] = ESCAPE_HTML, ['<'] = ESCAPE_HTML, ['>'] = ESCAPE_HTML,
+    ['"'] = ESCAPE_HTML, ['\''] = ESCAPE_HTML,
+    ['\\'] = ESCAPE_ICS, [';'] = ESCAPE_ICS, [','] = ESCAPE_ICS,
+    ['\r'] = ESCAPE_ICS, ['\n'] = ESCAPE_ICS
+};
+
+static size_t scan_html_scalar(const char* s, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (escape_class[(unsigned char)s[i]] & ESCAPE_HTML) {
+            return i;
+        }
+    }
+    return length;
+}
+
+static size_t scan_ics_scalar(const char* s, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (escape_class[(unsigned char)s[i]] & ESCAPE_ICS) {
+            return i;
+        }
+    }
+    return length;
+}
+
+#ifdef ESCAPE_X86
+// Bit i set where byte i of the block needs escaping
+static inline __attribute__((always_inline)) int block_mask_16(__m128i v, int ics) {
+    __m128i hits;
+    if (ics) {
+        hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')), _mm_cmpeq_epi8(v, _mm_set1_epi8(';'))),
+                            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    } else {
+        hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')), _mm_cmpeq_epi8(v, _mm_set1_epi8('<'))),
+                            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    }
+    return _mm_movemask_epi8(hits);
+}
+
+// Scans 16 bytes at a time. A ragged end is covered by one more block
+// overlapping the last one, with the bytes already seen masked off, so
+// only strings under 16 bytes take the scalar loop.
+static inline __attribute__((always_inline)) size_t scan_16(const char* s, size_t length, int ics) {
+    if (length < 16) {
+        return ics ? scan_ics_scalar(s, length) : scan_html_scalar(s, length);
+    }
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        int mask = block_mask_16(_mm_loadu_si128((const __m128i*)(s + i)), ics);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    if (i < length) {
+        int mask = block_mask_16(_mm_loadu_si128((const __m128i*)(s + length - 16)), ics);
+        mask >>= 16 - (length - i);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return length;
+}
+
+static size_t scan_html_sse2(const char* s, size_t length) {
+    return scan_16(s, length, 0);
+}
+
+static size_t scan_ics_sse2(const char* s, size_t length) {
+    return scan_16(s, length, 1);
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) unsigned int block_mask_32(__m256i v, int ics) {
+    __m256i hits;
+    if (ics) {
+        hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';'))),
+                               _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    } else {
+        hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<'))),
+                               _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    }
+    return _mm256_movemask_epi8(hits);
+}
+
+// The same with 32-byte blocks. Everything stays VEX-encoded, so there is
+// no penalty for mixing with legacy SSE code on the way out.
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) size_t scan_32(const char* s, size_t length, int ics) {
+    if (length < 32) {
+        return scan_16(s, length, ics);
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        unsigned int mask = block_mask_32(_mm256_loadu_si256((const __m256i*)(s + i)), ics);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    if (i < length) {
+        unsigned int mask = block_mask_32(_mm256_loadu_si256((const __m256i*)(s + length - 32)), ics);
+        mask >>= 32 - (length - i);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return length;
+}
+
+__attribute__((target("avx2")))
+static size_t scan_html_avx2(const char* s, size_t length) {
+    return scan_32(s, length, 0);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_ics_avx2(const char* s, size_t length) {
+    return scan_32(s, length, 1);
+}
+#endif
+
+#ifdef ESCAPE_NEON
+// NEON has no movemask; a block with a hit is searched byte by byte
+static size_t scan_html_neon(const char* s, size_t length) {
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t gt = vdupq_n_u8('>');
+    const uint8x16_t quot = vdupq_n_u8('"');
+    const uint8x16_t apos = vdupq_n_u8('\'');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)(s + i));
+        uint8x16_t hits = vorrq_u8(vorrq_u8(vceqq_u8(v, amp), vceqq_u8(v, lt)),
+                                   vorrq_u8(vceqq_u8(v, gt), vceqq_u8(v, quot)));
+        if (vmaxvq_u8(vorrq_u8(hits, vceqq_u8(v, apos)))) {
+            return i + scan_html_scalar(s + i, 16);
+        }
+    }
+    return i + scan_html_scalar(s + i, length - i);
+}
+
+static size_t scan_ics_neon(const char* s, size_t length) {
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t semicolon = vdupq_n_u8(';');
+    const uint8x16_t comma = vdupq_n_u8(',');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t lf = vdupq_n_u8('\n');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)(s + i));
+        uint8x16_t hits = vorrq_u8(vorrq_u8(vceqq_u8(v, backslash), vceqq_u8(v, semicolon)),
+                                   vorrq_u8(vceqq_u8(v, comma), vceqq_u8(v, cr)));
+        if (vmaxvq_u8(vorrq_u8(hits, vceqq_u8(v, lf)))) {
+            return i + scan_ics_scalar(s + i, 16);
+        }
+    }
+    return i + scan_ics_scalar(s + i, length - i);
+}
+#endif
+
+// Best first
+static const escape_kernel_t kernels[] = {
+#ifdef ESCAPE_X86
+    { "avx2", scan_html_avx2, scan_ics_avx2 },
+    { "sse2", scan_html_sse2, scan_ics_sse2 },
+#endif
+#ifdef ESCAPE_NEON
+    { "neon", scan_html_neon, scan_ics_neon },
+#endif
+    { "scalar", scan_html_scalar, scan_ics_scalar }
+};
+
+static const escape_kernel_t* kernel = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static int kernel_supported(const escape_kernel_t* candidate) {
+#ifdef ESCAPE_X86
+    if (strcmp(candidate->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    (void)candidate;
+    return 1;
+}
+
+static void select_kernel(void) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (kernel_supported(&kernels[i])) {
+            kernel = &kernels[i];
+            return;
+        }
+    }
+}
+
+static const escape_kernel_t* current_kernel(void) {
+    pthread_once(&kernel_once, select_kernel);
+    return kernel;
+}
+
+// Name of the kernel in use
+const char* escape_kernel_name(void) {
+    return current_kernel()->name;
+}
+
+// Switches to the named kernel, for benchmarks and tests. Returns -1 when
+// it isn't built in or the CPU lacks it.
+int escape_use_kernel(const char* name) {
+    current_kernel();
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, name) == 0 && kernel_supported(&kernels[i])) {
+            kernel = &kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Offset of the first byte of s that HTML needs escaped, or length
+size_t html_escape_find(const char* s, size_t length) {
+    return current_kernel()->scan_html(s, length);
+}
+
+// Escapes text for HTML element and attribute content. Output is always
+// terminated; returns the escaped length.
+size_t html_escape(const char* input, char* output, size_t output_size) {
+    scan_fn scan = current_kernel()->scan_html;
+    size_t input_length = strlen(input);
+    size_t length = 0;
+    size_t i = 0;
+
+    while (i < input_length) {
+        size_t run = scan(input + i, input_length - i);
+        if (length + run >= output_size) {
+            run = output_size - 1 - length;
+            memcpy(output + length, input + i, run);
+            length += run;
+            break;
+        }
+        memcpy(output + length, input + i, run);
+        length += run;
+        i += run;
+        if (i == input_length) break;
+
+        const char* entity = NULL;
+        switch (input[i]) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            default: entity = "&#39;"; break;
+        }
+
+        size_t needed = strlen(entity);
+        if (length + needed >= output_size) break;
+        memcpy(output + length, entity, needed);
+        length += needed;
+        i++;
+    }
+
+    output[length] = '\0';
+    return length;
+}
+
+// Output of ics_append_text; writes past the end are dropped
+typedef struct {
+    char* data;
+    size_t size;
+    size_t length;
+    size_t line;                 // Octets on the current line
+} ics_line_t;
+
+static void ics_put(ics_line_t* out, const char* bytes, size_t count) {
+    if (out->length + count >= out->size) {
+        count = out->length < out->size ? out->size - 1 - out->length : 0;
+    }
+    memcpy(out->data + out->length, bytes, count);
+    out->length += count;
+    out->line += count;
+}
+
+static void ics_fold(ics_line_t* out) {
+    ics_put(out, "\r\n ", 3);
+    out->line = 1;
+}
+
+// Copies a run that needs no escaping, folding before the line passes
+// ICS_LINE_OCTETS without splitting a UTF-8 sequence
+static void ics_put_run(ics_line_t* out, const char* run, size_t count) {
+    while (count > 0) {
+        if (out->line >= ICS_LINE_OCTETS) {
+            ics_fold(out);
+        }
+        size_t room = ICS_LINE_OCTETS - out->line;
+        if (count <= room) {
+            ics_put(out, run, count);
+            return;
+        }
+
+        // Back up over continuation bytes so the fold lands on a character
+        size_t take = room;
+        while (take > 0 && ((unsigned char)run[take] & 0xC0) == 0x80) {
+            take--;
+        }
+        if (take == 0 && out->line == 1) {
+            take = room;        // Not UTF-8; split anyway rather than stall
+        }
+        ics_put(out, run, take);
+        ics_fold(out);
+        run += take;
+        count -= take;
+    }
+}
+
+// Appends "NAME:value" with CRLF as an RFC 5545 TEXT property: backslash,
+// semicolon, comma and newline are escaped, CR is dropped, and lines are
+// folded at ICS_LINE_OCTETS. Returns the bytes written; output_size of
+// ICS_TEXT_SIZE(strlen(name), strlen(value)) always suffices.
+size_t ics_append_text(char* output, size_t output_size, const char* name, const char* value) {
+    ics_line_t out = { output, output_size, 0, 0 };
+    if (output_size == 0) {
+        return 0;
+    }
+
+    scan_fn scan = current_kernel()->scan_ics;
+    ics_put(&out, name, strlen(name));
+    ics_put(&out, ":", 1);
+
+    size_t value_length = strlen(value);
+    size_t i = 0;
+    while (i < value_length) {
+        size_t run = scan(value + i, value_length - i);
+        ics_put_run(&out, value + i, run);
+        i += run;
+        if (i == value_length) break;
+
+        char escaped[2] = { '\\', value[i] };
+        if (value[i] == '\n') {
+            escaped[1] = 'n';
+        }
+        i++;
+        if (value[i - 1] == '\r') continue;
+
+        if (out.line + 2 > ICS_LINE_OCTETS) {
+            ics_fold(&out);
+        }
+        ics_put(&out, escaped, 2);
+    }
+
+    ics_put(&out, "\r\n", 2);
+    output[out.length] = '\0';
+    return out.length;
+}
@@ -0,0 +1,281 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+
+// The server's main thread sleeps in one place: signals, the next reminder
+// deadline, wakeups from other threads and HTTP traffic all arrive as file
+// descriptor events. With nothing pending it sleeps indefinitely.
+//
+// On Linux this is epoll over a signalfd, a timerfd, an eventfd and
+// libmicrohttpd's own epoll fd. Elsewhere it is select() over a self-pipe
+// (written by the signal handler and by event_loop_wake) and
+// libmicrohttpd's fd set, with the deadline as the timeout.
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#define EVENT_LOOP_EPOLL 1
+#else
+#include <sys/select.h>
+#endif
+
+static const int loop_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGUSR1 };
+#define LOOP_SIGNAL_COUNT ((int)(sizeof(loop_signals) / sizeof(loop_signals[0])))
+
+static time_t loop_deadline = 0;
+
+#ifdef EVENT_LOOP_EPOLL
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int timer_fd = -1;
+static int wake_fd = -1;
+
+int event_loop_init(void) {
+    // Signals are blocked in every thread and read from the signalfd, so
+    // no handler ever runs; threads started later inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    for (int i = 0; i < LOOP_SIGNAL_COUNT; i++) {
+        sigaddset(&signals, loop_signals[i]);
+    }
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    // Reminders fire at wall-clock times, so the timer follows clock changes
+    timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || signal_fd < 0 || timer_fd < 0 || wake_fd < 0) {
+        perror("event loop");
+        event_loop_close();
+        return -1;
+    }
+
+    int fds[] = { signal_fd, timer_fd, wake_fd };
+    for (int i = 0; i < 3; i++) {
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = fds[i] };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) != 0) {
+            perror("epoll_ctl");
+            event_loop_close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+unsigned int event_loop_web_flags(void) {
+    return MHD_USE_EPOLL;
+}
+
+void event_loop_wake(void) {
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("event loop wake");
+    }
+}
+
+void event_loop_set_deadline(time_t at) {
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = at;   // 0 disarms; a past time fires at once
+
+    loop_deadline = at;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+int event_loop_run(struct MHD_Daemon* web, event_handler_t handler) {
+    const union MHD_DaemonInfo* info = MHD_get_daemon_info(web, MHD_DAEMON_INFO_EPOLL_FD);
+    if (!info) {
+        fprintf(stderr, "Web server has no epoll descriptor\n");
+        return -1;
+    }
+    struct epoll_event web_event = { .events = EPOLLIN, .data.fd = info->epoll_fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, info->epoll_fd, &web_event) != 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    int stop = 0;
+    while (!stop) {
+        // libmicrohttpd asks for a timeout only while connections are open
+        MHD_UNSIGNED_LONG_LONG web_timeout;
+        int timeout = -1;
+        if (MHD_get_timeout(web, &web_timeout) == MHD_YES) {
+            timeout = (web_timeout > INT32_MAX) ? INT32_MAX : (int)web_timeout;
+        }
+
+        struct epoll_event events[8];
+        int count = epoll_wait(epoll_fd, events, 8, timeout);
+        if (count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < count && !stop; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == signal_fd) {
+                struct signalfd_siginfo signal_info;
+                while (read(signal_fd, &signal_info, sizeof(signal_info)) == sizeof(signal_info) && !stop) {
+                    int sig = (int)signal_info.ssi_signo;
+                    event_t event = (sig == SIGHUP) ? EVENT_RELOAD :
+                                    (sig == SIGUSR1) ? EVENT_WAKE : EVENT_SHUTDOWN;
+                    stop = handler(event);
+                }
+            } else if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    loop_deadline = 0;
+                    stop = handler(EVENT_DEADLINE);
+                }
+            } else if (fd == wake_fd) {
+                uint64_t wakeups;
+                if (read(wake_fd, &wakeups, sizeof(wakeups)) == sizeof(wakeups)) {
+                    stop = handler(EVENT_WAKE);
+                }
+            }
+        }
+
+        MHD_run(web);
+    }
+    return 0;
+}
+
+void event_loop_close(void) {
+    int* fds[] = { &epoll_fd, &signal_fd, &timer_fd, &wake_fd };
+    for (int i = 0; i < 4; i++) {
+        if (*fds[i] >= 0) {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+}
+
+#else
+
+// Self-pipe: the signal handler writes the signal number, which is the
+// only thing it may safely do
+static int wake_pipe[2] = { -1, -1 };
+
+static void loop_signal_handler(int sig) {
+    int saved_errno = errno;
+    unsigned char byte = (unsigned char)sig;
+    if (write(wake_pipe[1], &byte, 1) < 0) {
+        // Pipe full: plenty of wakeups are pending already
+    }
+    errno = saved_errno;
+}
+
+int event_loop_init(void) {
+    if (pipe(wake_pipe) != 0) {
+        perror("event loop");
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = loop_signal_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    for (int i = 0; i < LOOP_SIGNAL_COUNT; i++) {
+        sigaction(loop_signals[i], &action, NULL);
+    }
+    return 0;
+}
+
+unsigned int event_loop_web_flags(void) {
+    return MHD_NO_FLAG;
+}
+
+void event_loop_wake(void) {
+    unsigned char byte = 0;
+    if (wake_pipe[1] >= 0 && write(wake_pipe[1], &byte, 1) < 0 && errno != EAGAIN) {
+        perror("event loop wake");
+    }
+}
+
+void event_loop_set_deadline(time_t at) {
+    loop_deadline = at;
+}
+
+int event_loop_run(struct MHD_Daemon* web, event_handler_t handler) {
+    int stop = 0;
+
+    while (!stop) {
+        fd_set read_set, write_set, error_set;
+        MHD_socket max_fd = wake_pipe[0];
+        FD_ZERO(&read_set);
+        FD_ZERO(&write_set);
+        FD_ZERO(&error_set);
+        FD_SET(wake_pipe[0], &read_set);
+        MHD_get_fdset(web, &read_set, &write_set, &error_set, &max_fd);
+
+        // Sleep until the earlier of the reminder deadline and the web
+        // server's own timeout, or indefinitely
+        struct timeval timeout;
+        struct timeval* timeout_ptr = NULL;
+        MHD_UNSIGNED_LONG_LONG web_timeout;
+        long long timeout_ms = -1;
+        if (MHD_get_timeout(web, &web_timeout) == MHD_YES) {
+            timeout_ms = (long long)web_timeout;
+        }
+        if (loop_deadline > 0) {
+            long long until_deadline = ((long long)loop_deadline - time(NULL)) * 1000;
+            if (until_deadline < 0) until_deadline = 0;
+            if (timeout_ms < 0 || until_deadline < timeout_ms) timeout_ms = until_deadline;
+        }
+        if (timeout_ms >= 0) {
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_usec = (timeout_ms % 1000) * 1000;
+            timeout_ptr = &timeout;
+        }
+
+        int count = select(max_fd + 1, &read_set, &write_set, &error_set, timeout_ptr);
+        if (count < 0 && errno != EINTR) {
+            perror("select");
+            return -1;
+        }
+
+        if (count > 0 && FD_ISSET(wake_pipe[0], &read_set)) {
+            unsigned char bytes[64];
+            ssize_t length;
+            while (!stop && (length = read(wake_pipe[0], bytes, sizeof(bytes))) > 0) {
+                for (ssize_t i = 0; i < length && !stop; i++) {
+                    event_t event = (bytes[i] == SIGHUP) ? EVENT_RELOAD :
+                                    (bytes[i] == SIGINT || bytes[i] == SIGTERM) ? EVENT_SHUTDOWN : EVENT_WAKE;
+                    stop = handler(event);
+                }
+            }
+        }
+
+        if (!stop && loop_deadline > 0 && time(NULL) >= loop_deadline) {
+            loop_deadline = 0;
+            stop = handler(EVENT_DEADLINE);
+        }
+
+        MHD_run(web);
+    }
+    return 0;
+}
+
+void event_loop_close(void) {
+    for (int i = 0; i < 2; i++) {
+        if (wake_pipe[i] >= 0) {
+            close(wake_pipe[i]);
+            wake_pipe[i] = -1;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,211 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+#include <unistd.h>
+
+// Large ICS exports, rendered in chunks on a pool of threads and stitched
+// together in order. The range is cut into chunks of equal time. The
+// requesting thread and up to one pool thread per core (the lanes) each
+// claim the next chunk nobody has rendered yet until none are left, so a
+// busy stretch of the calendar doesn't hold the others up. Every pool
+// lane reads on a connection of its own and writes into its own arena.
+// The finished chunks are copied into the page's arena in order.
+
+typedef struct {
+    const char* text;
+    size_t length;
+} export_chunk_t;
+
+typedef struct export export_t;
+
+typedef struct {
+    export_t* export;
+    arena_t* arena;              // This lane's chunks
+} export_lane_t;
+
+struct export {
+    calendar_t* cal;
+    time_t start;
+    time_t end;
+    const bitmap_t* filter;      // Read-only, shared by the lanes
+    time_t chunk_seconds;
+    int chunk_count;
+    int next_chunk;              // Next chunk to claim; atomic
+    int failed;                  // Atomic
+    export_chunk_t* chunks;
+    export_lane_t lanes[ICS_EXPORT_MAX_THREADS + 1];  // Last one is the requesting thread
+    int lanes_running;           // Pool lanes not done yet
+    pthread_mutex_t mutex;
+    pthread_cond_t lanes_done;
+};
+
+static worker_pool_t* export_pool = NULL;
+static int export_threads = 0;
+
+// Renders chunks until there are none left or a lane failed
+static void render_chunks(export_t* export, calendar_t* cal, arena_t* out) {
+    for (;;) {
+        if (__atomic_load_n(&export->failed, __ATOMIC_RELAXED)) {
+            return;
+        }
+        int chunk = __atomic_fetch_add(&export->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= export->chunk_count) {
+            return;
+        }
+
+        time_t start = export->start + chunk * export->chunk_seconds;
+        time_t end = (chunk == export->chunk_count - 1) ? export->end : start + export->chunk_seconds;
+
+        // The chunk's rows are only needed until its text is written
+        arena_t* scratch = arena_create();
+        size_t length = 0;
+        const char* text = scratch ? ics_render_events(cal, scratch, out, start, end, export->filter, "", "", &length) : NULL;
+        arena_destroy(scratch);
+
+        if (!text) {
+            __atomic_store_n(&export->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        export->chunks[chunk].text = text;
+        export->chunks[chunk].length = length;
+    }
+}
+
+// Runs on the export pool. A lane that finds no chunks left, or can't
+// open its connection, leaves the work to the others.
+static void run_lane(void* arg, int worker) {
+    (void)worker;
+    export_lane_t* lane = arg;
+    export_t* export = lane->export;
+
+    if (__atomic_load_n(&export->next_chunk, __ATOMIC_RELAXED) < export->chunk_count) {
+        calendar_t reader;
+        memset(&reader, 0, sizeof(reader));
+        snprintf(reader.path, sizeof(reader.path), "%s", export->cal ? export->cal->path : DB_PATH);
+        snprintf(reader.archive_path, sizeof(reader.archive_path), "%s",
+                 export->cal ? export->cal->archive_path : ARCHIVE_DB_PATH);
+
+        if (db_open_reader(reader.path, reader.archive_path, &reader.conn) == 0) {
+            lane->arena = arena_create();
+            if (lane->arena) {
+                render_chunks(export, &reader, lane->arena);
+            }
+            sqlite3_close(reader.conn);
+        }
+    }
+
+    pthread_mutex_lock(&export->mutex);
+    if (--export->lanes_running == 0) {
+        pthread_cond_signal(&export->lanes_done);
+    }
+    pthread_mutex_unlock(&export->mutex);
+}
+
+// Renders the items starting in [start, end), only those in filter unless
+// it is NULL, as chunk_count chunks of VEVENTs between before and after.
+// Without a running export pool the calling thread renders every chunk
+// itself.
+char* ics_export_chunks(calendar_t* cal, arena_t* arena, time_t start, time_t end, const bitmap_t* filter,
+                        int chunk_count, const char* before, const char* after, size_t* length) {
+    export_t export;
+    memset(&export, 0, sizeof(export));
+    export.cal = cal;
+    export.start = start;
+    export.end = end;
+    export.filter = filter;
+    export.chunk_seconds = (end - start + chunk_count - 1) / chunk_count;
+    if (export.chunk_seconds < 1) {
+        export.chunk_seconds = 1;
+    }
+    export.chunk_count = (int)((end - start + export.chunk_seconds - 1) / export.chunk_seconds);
+    export.chunks = arena_alloc(arena, export.chunk_count * sizeof(export_chunk_t));
+    if (!export.chunks) {
+        return NULL;
+    }
+    pthread_mutex_init(&export.mutex, NULL);
+    pthread_cond_init(&export.lanes_done, NULL);
+
+    int lane_count = export.chunk_count - 1;
+    if (lane_count > export_threads) {
+        lane_count = export_threads;
+    }
+    for (int i = 0; i < lane_count; i++) {
+        export.lanes[i].export = &export;
+        pthread_mutex_lock(&export.mutex);
+        export.lanes_running++;
+        pthread_mutex_unlock(&export.mutex);
+
+        // A full queue just means fewer lanes
+        if (!export_pool || worker_pool_submit(export_pool, &export.lanes[i]) != 0) {
+            pthread_mutex_lock(&export.mutex);
+            export.lanes_running--;
+            pthread_mutex_unlock(&export.mutex);
+            break;
+        }
+    }
+
+    // The requesting thread renders too, on the calendar's connection
+    export_lane_t* own = &export.lanes[ICS_EXPORT_MAX_THREADS];
+    own->arena = arena_create();
+    if (own->arena) {
+        render_chunks(&export, cal, own->arena);
+    } else {
+        __atomic_store_n(&export.failed, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&export.mutex);
+    while (export.lanes_running > 0) {
+        pthread_cond_wait(&export.lanes_done, &export.mutex);
+    }
+    pthread_mutex_unlock(&export.mutex);
+
+    char* content = NULL;
+    if (!export.failed) {
+        size_t before_length = strlen(before);
+        size_t after_length = strlen(after);
+        size_t total = before_length + after_length;
+        for (int i = 0; i < export.chunk_count; i++) {
+            total += export.chunks[i].length;
+        }
+
+        content = arena_alloc(arena, total + 1);
+        if (content) {
+            char* p = content;
+            memcpy(p, before, before_length);
+            p += before_length;
+            for (int i = 0; i < export.chunk_count; i++) {
+                memcpy(p, export.chunks[i].text, export.chunks[i].length);
+                p += export.chunks[i].length;
+            }
+            memcpy(p, after, after_length + 1);
+            *length = total;
+        }
+    }
+
+    for (int i = 0; i <= ICS_EXPORT_MAX_THREADS; i++) {
+        arena_destroy(export.lanes[i].arena);
+    }
+    pthread_cond_destroy(&export.lanes_done);
+    pthread_mutex_destroy(&export.mutex);
+    return content;
+}
+
+// One thread per core, up to ICS_EXPORT_MAX_THREADS
+int ics_export_start(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    export_threads = (cores < 1) ? 1 : (cores > ICS_EXPORT_MAX_THREADS) ? ICS_EXPORT_MAX_THREADS : (int)cores;
+
+    // Every web worker may be exporting at once
+    export_pool = worker_pool_create(export_threads, export_threads * WEB_WORKER_THREADS, run_lane);
+    if (!export_pool) {
+        export_threads = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Exports still running finish first; stop the web workers before this
+void ics_export_stop(void) {
+    worker_pool_destroy(export_pool);
+    export_pool = NULL;
+    export_threads = 0;
+}
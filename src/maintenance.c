@@ -0,0 +1,85 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+
+// The thread sleeps on maintenance_wakeup between passes; stopping
+// signals it, so shutdown never waits out an interval
+static pthread_mutex_t running_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maintenance_wakeup = PTHREAD_COND_INITIALIZER;
+static int maintenance_thread_running = 1;
+
+// Settings may change under a running thread (SIGHUP); each pass works
+// on a copy
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static maintenance_config_t current_config;
+
+void maintenance_configure(const maintenance_config_t* config) {
+    pthread_mutex_lock(&config_mutex);
+    current_config = *config;
+    pthread_mutex_unlock(&config_mutex);
+}
+
+static void run_scheduled_backup(const char* path) {
+    backup_stats_t stats;
+    
+    if (db_backup(NULL, path, &stats) != 0) {
+        printf("Scheduled backup to %s failed\n", path);
+        return;
+    }
+    
+    printf("Backed up %d pages (%d items) to %s in %.2fs\n",
+           stats.pages, stats.rows, path, stats.seconds);
+}
+
+// Archives old items, returns freed pages to the filesystem and takes the
+// scheduled backup. arg points to the initial maintenance_config_t.
+void* maintenance_thread(void* arg) {
+    maintenance_config_t config;
+    time_t last_backup = 0;
+    
+    maintenance_configure(arg);
+    printf("Maintenance thread started (retention: %d days)\n", ((const maintenance_config_t*)arg)->retention_days);
+    
+    for (;;) {
+        pthread_mutex_lock(&config_mutex);
+        config = current_config;
+        pthread_mutex_unlock(&config_mutex);
+        
+        if (db_run_maintenance(NULL, config.retention_days) != 0) {
+            printf("Maintenance pass failed; retrying next interval\n");
+        }
+        
+        int closed = calendar_cache_trim(CALENDAR_IDLE_SECONDS);
+        if (closed > 0) {
+            printf("Closed %d idle calendars\n", closed);
+        }
+        
+        if (config.backup_path[0] && time(NULL) - last_backup >= BACKUP_INTERVAL_SECONDS) {
+            run_scheduled_backup(config.backup_path);
+            last_backup = time(NULL);
+        }
+        
+        struct timespec next_pass;
+        clock_gettime(CLOCK_REALTIME, &next_pass);
+        next_pass.tv_sec += MAINTENANCE_INTERVAL_SECONDS;
+        
+        pthread_mutex_lock(&running_mutex);
+        while (maintenance_thread_running &&
+               pthread_cond_timedwait(&maintenance_wakeup, &running_mutex, &next_pass) == 0) {
+        }
+        int running = maintenance_thread_running;
+        pthread_mutex_unlock(&running_mutex);
+        if (!running) {
+            break;
+        }
+    }
+    
+    printf("Maintenance thread stopped\n");
+    return NULL;
+}
+
+void stop_maintenance_thread(void) {
+    pthread_mutex_lock(&running_mutex);
+    maintenance_thread_running = 0;
+    pthread_cond_signal(&maintenance_wakeup);
+    pthread_mutex_unlock(&running_mutex);
+}
@@ -0,0 +1,232 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// The stack instance owns a datagram socket; every notification is a single
+// fixed-size datagram, so delivery is one sendto() with no connection setup.
+
+// Whether path is a directory of ours that nobody else can enter
+static int ipc_private_directory(const char* path) {
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+        (st.st_mode & 077) != 0) {
+        fprintf(stderr, "Notification directory %s is not a private directory of this user\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Longest path that still fits a socket address
+#define IPC_PATH_MAX sizeof(((struct sockaddr_un*)0)->sun_path)
+
+// Writes the path of name in the user's runtime directory: $XDG_RUNTIME_DIR,
+// or a 0700 directory under /tmp created on first use. In a shared /tmp
+// another user could otherwise claim the socket or the lock first and
+// receive the reminders. A path that doesn't fit is an error, never
+// truncated into some other directory.
+static int ipc_runtime_path(const char* name, char* path, size_t path_size) {
+    char directory[IPC_PATH_MAX];
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    int length;
+
+    if (runtime && runtime[0] == '/') {
+        length = snprintf(directory, sizeof(directory), "%s", runtime);
+    } else {
+        runtime = NULL;
+        length = snprintf(directory, sizeof(directory), NOTIFY_RUNTIME_DIR_FMT, (unsigned)getuid());
+    }
+    if (length < 0 || (size_t)length >= sizeof(directory)) {
+        fprintf(stderr, "Notification directory path too long: %s\n", runtime ? runtime : directory);
+        return -1;
+    }
+    if (!runtime && mkdir(directory, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    if (ipc_private_directory(directory) != 0) {
+        return -1;
+    }
+    length = snprintf(path, path_size, "%s/%s", directory, name);
+    if (length < 0 || (size_t)length >= path_size) {
+        fprintf(stderr, "Notification path too long: %s/%s\n", directory, name);
+        return -1;
+    }
+    return 0;
+}
+
+static int ipc_socket_address(struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    return ipc_runtime_path(NOTIFY_SOCKET_NAME, addr->sun_path, sizeof(addr->sun_path));
+}
+
+static int ipc_acquire_instance_lock(void) {
+    char lock_path[IPC_PATH_MAX];
+    if (ipc_runtime_path(NOTIFY_LOCK_NAME, lock_path, sizeof(lock_path)) != 0) {
+        return -1;
+    }
+
+    int fd = open(lock_path, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+
+    // The lock lives as long as the process, so a crashed instance never
+    // leaves a stale owner behind
+    if (fcntl(fd, F_SETLK, &lock) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int notification_ipc_send(const char* title, const char* message, const char* time_str) {
+    notification_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    snprintf(msg.title, sizeof(msg.title), "%s", title);
+    snprintf(msg.message, sizeof(msg.message), "%s", message);
+    snprintf(msg.time_str, sizeof(msg.time_str), "%s", time_str);
+
+    struct sockaddr_un addr;
+    if (ipc_socket_address(&addr) != 0) {
+        errno = EACCES;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Never block the caller on a stalled stack process
+    ssize_t sent = sendto(fd, &msg, sizeof(msg), MSG_DONTWAIT,
+                          (struct sockaddr*)&addr, sizeof(addr));
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    return (sent == (ssize_t)sizeof(msg)) ? 0 : -1;
+}
+
+int notification_ipc_listen(void) {
+    if (ipc_acquire_instance_lock() < 0) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    if (ipc_socket_address(&addr) != 0) {
+        return -1;
+    }
+
+    // We hold the instance lock, so any socket file left behind is stale
+    unlink(addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int notification_ipc_receive(int fd, notification_msg_t* msg) {
+    ssize_t received;
+    do {
+        received = recv(fd, msg, sizeof(*msg), 0);
+    } while (received < 0 && errno == EINTR);
+
+    if (received != (ssize_t)sizeof(*msg)) {
+        return -1;
+    }
+
+    msg->title[sizeof(msg->title) - 1] = '\0';
+    msg->message[sizeof(msg->message) - 1] = '\0';
+    msg->time_str[sizeof(msg->time_str) - 1] = '\0';
+    return 0;
+}
+
+void notification_ipc_close(int fd) {
+    struct sockaddr_un addr;
+    if (ipc_socket_address(&addr) == 0) {
+        unlink(addr.sun_path);
+    }
+    close(fd);
+}
+
+int notification_ipc_spawn_stack(void) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Double fork so the stack is reparented to init and never becomes
+        // a zombie of the server
+        setsid();
+        if (fork() != 0) {
+            _exit(0);
+        }
+        // Signals the server's event loop blocked would stay blocked
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execl("./algen-stack", "algen-stack", (char*)NULL);
+        execlp("algen-stack", "algen-stack", (char*)NULL);
+        _exit(1);
+    }
+
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+int notification_ipc_deliver(const char* title, const char* message, const char* time_str) {
+    if (notification_ipc_send(title, message, time_str) == 0) {
+        return 0;
+    }
+
+    // A full socket means the stack is working through a burst and has
+    // stopped reading until its queue drains; give it time to catch up
+    for (int attempt = 0; attempt < 50 && (errno == EAGAIN || errno == EWOULDBLOCK); attempt++) {
+        usleep(20000);
+        if (notification_ipc_send(title, message, time_str) == 0) {
+            return 0;
+        }
+    }
+
+    if (errno != ENOENT && errno != ECONNREFUSED) {
+        return -1;
+    }
+
+    // No instance yet: start one and wait for its socket to come up
+    if (notification_ipc_spawn_stack() != 0) {
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < 100; attempt++) {
+        usleep(20000);
+        if (notification_ipc_send(title, message, time_str) == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
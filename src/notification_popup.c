@@ -1,4 +1,4 @@
-#include "agenda.h"
+#include "notification_ui.h"
 
 int main(int argc, char* argv[]) {
     if (argc != 4) {
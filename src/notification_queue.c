@@ -0,0 +1,115 @@
+#include "agenda.h"
+
+// Bounded lock-free queue from any number of producers to the algen-stack
+// render thread, which drains it at the start of each frame. Each entry's
+// sequence says whose turn it is: lap(pos) when free for the producer at
+// pos, lap(pos) + 1 once filled, where lap(pos) is pos rounded down to a
+// multiple of the capacity. Zeroed memory is an empty queue. Kept apart
+// from the raylib code so tools/stress_notify_queue.c can link it.
+#define QUEUE_MASK (NOTIFICATION_QUEUE_CAPACITY - 1)
+#define QUEUE_LAP(pos) ((pos) & ~(unsigned int)QUEUE_MASK)
+
+static struct {
+    unsigned int sequence;
+    notification_msg_t msg;
+} notification_queue[NOTIFICATION_QUEUE_CAPACITY];
+static unsigned int queue_tail = 0;   // Next position to claim, shared by producers
+static unsigned int queue_head = 0;   // Next position to read, render thread only
+
+// The mutex is only taken to sleep: by the render thread when the queue
+// is empty, by producers when it is full. Each side announces it is
+// about to sleep before its last look at the queue, and the other side
+// checks the announcement after its update, so no wakeup is lost.
+static int render_sleeping = 0;
+static int producers_waiting = 0;
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;    // Something was queued
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;   // Something was taken
+
+static int queue_is_full(void) {
+    unsigned int pos = __atomic_load_n(&queue_tail, __ATOMIC_SEQ_CST);
+    unsigned int sequence = __atomic_load_n(&notification_queue[pos & QUEUE_MASK].sequence, __ATOMIC_SEQ_CST);
+    return (int)(sequence - QUEUE_LAP(pos)) < 0;
+}
+
+static int queue_has_notification(void) {
+    unsigned int sequence = __atomic_load_n(&notification_queue[queue_head & QUEUE_MASK].sequence, __ATOMIC_SEQ_CST);
+    return sequence == QUEUE_LAP(queue_head) + 1;
+}
+
+// Producers: waits until the render thread has taken something
+static void wait_for_space(void) {
+    pthread_mutex_lock(&wake_mutex);
+    __atomic_add_fetch(&producers_waiting, 1, __ATOMIC_SEQ_CST);
+    while (queue_is_full()) {
+        pthread_cond_wait(&space_cond, &wake_mutex);
+    }
+    __atomic_sub_fetch(&producers_waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&wake_mutex);
+}
+
+// Safe from any thread and never blocks on a frame being drawn. When the
+// queue is full the render thread is behind, and the producer waits for
+// it to drain rather than losing the notification; the IPC receiver then
+// stops reading and the socket pushes back on senders.
+void notification_queue_push(const char* title, const char* message, const char* time_str) {
+    unsigned int pos = __atomic_load_n(&queue_tail, __ATOMIC_RELAXED);
+    for (;;) {
+        unsigned int sequence = __atomic_load_n(&notification_queue[pos & QUEUE_MASK].sequence, __ATOMIC_ACQUIRE);
+        int turn = (int)(sequence - QUEUE_LAP(pos));
+        if (turn == 0) {
+            // Free for this lap; claim it unless another producer did first
+            if (__atomic_compare_exchange_n(&queue_tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (turn < 0) {
+            wait_for_space();
+            pos = __atomic_load_n(&queue_tail, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&queue_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    notification_msg_t* msg = &notification_queue[pos & QUEUE_MASK].msg;
+    snprintf(msg->title, sizeof(msg->title), "%s", title);
+    snprintf(msg->message, sizeof(msg->message), "%s", message);
+    snprintf(msg->time_str, sizeof(msg->time_str), "%s", time_str);
+    __atomic_store_n(&notification_queue[pos & QUEUE_MASK].sequence, QUEUE_LAP(pos) + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&render_sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&wake_mutex);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+}
+
+// Render thread: takes the oldest queued notification; 0 when empty
+int notification_queue_pop(notification_msg_t* msg) {
+    if (!queue_has_notification()) {
+        return 0;
+    }
+
+    *msg = notification_queue[queue_head & QUEUE_MASK].msg;
+    __atomic_store_n(&notification_queue[queue_head & QUEUE_MASK].sequence,
+                     QUEUE_LAP(queue_head) + NOTIFICATION_QUEUE_CAPACITY, __ATOMIC_SEQ_CST);
+    queue_head++;
+
+    if (__atomic_load_n(&producers_waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&wake_mutex);
+        pthread_cond_broadcast(&space_cond);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+    return 1;
+}
+
+// Render thread: sleeps until a notification is queued
+void notification_queue_wait(void) {
+    __atomic_store_n(&render_sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&wake_mutex);
+    while (!queue_has_notification()) {
+        pthread_cond_wait(&wake_cond, &wake_mutex);
+    }
+    pthread_mutex_unlock(&wake_mutex);
+    __atomic_store_n(&render_sleeping, 0, __ATOMIC_SEQ_CST);
+}
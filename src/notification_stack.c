@@ -1,14 +1,30 @@
-#include "agenda.h"
+#include "notification_ui.h"
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <title> <message> <time>\n", argv[0]);
+    if (argc != 1 && argc != 4) {
+        fprintf(stderr, "Usage: %s [<title> <message> <time>]\n", argv[0]);
         return 1;
     }
     
-    // Add the notification to the stack
-    add_notification_to_stack(argv[1], argv[2], argv[3]);
+    // If an instance is already running, append to its stack and leave
+    if (argc == 4 && notification_ipc_send(argv[1], argv[2], argv[3]) == 0) {
+        return 0;
+    }
+    
+    int ipc_fd = notification_ipc_listen();
+    if (ipc_fd < 0) {
+        // Another instance won the race to own the socket
+        if (argc == 4) {
+            return notification_ipc_deliver(argv[1], argv[2], argv[3]) == 0 ? 0 : 1;
+        }
+        printf("algen-stack is already running\n");
+        return 0;
+    }
+    
+    if (argc == 4) {
+        add_notification_to_stack(argv[1], argv[2], argv[3]);
+    }
     
-    // Show the stacked notifications
-    return show_stacked_notifications();
+    // Stay alive and keep appending notifications received over the socket
+    return serve_stacked_notifications(ipc_fd);
 }
@@ -0,0 +1,629 @@
+#include "notification_ui.h"
+
+// Global notification stack: a fixed pool of slots threaded into an
+// index-based doubly linked list, newest at the head. Only the render
+// thread touches it; other threads hand notifications over through the
+// queue in src/notification_queue.c.
+static notification_window_t stack_slots[NOTIFICATION_STACK_CAPACITY];
+static int stack_head = -1;
+static int stack_tail = -1;
+static int stack_free = -1;    // Free list of released slots, linked through next
+static int stack_unused = 0;   // Slots never handed out yet
+static int stack_count = 0;
+
+static void unlink_stack_slot(int slot) {
+    notification_window_t* node = &stack_slots[slot];
+    
+    if (node->prev >= 0) stack_slots[node->prev].next = node->next;
+    else stack_head = node->next;
+    
+    if (node->next >= 0) stack_slots[node->next].prev = node->prev;
+    else stack_tail = node->prev;
+    
+    node->next = stack_free;
+    stack_free = slot;
+    stack_count--;
+}
+
+static int acquire_stack_slot(void) {
+    if (stack_free >= 0) {
+        int slot = stack_free;
+        stack_free = stack_slots[slot].next;
+        return slot;
+    }
+    
+    if (stack_unused < NOTIFICATION_STACK_CAPACITY) {
+        return stack_unused++;
+    }
+    
+    // Overflow policy: the oldest card makes room for the newest one
+    printf("Notification stack full, dropping oldest notification\n");
+    unlink_stack_slot(stack_tail);
+    return acquire_stack_slot();
+}
+
+static void clear_notification_stack(void) {
+    stack_head = stack_tail = stack_free = -1;
+    stack_unused = 0;
+    stack_count = 0;
+}
+
+static void push_stack_notification(const notification_msg_t* msg) {
+    int slot = acquire_stack_slot();
+    notification_window_t* new_notification = &stack_slots[slot];
+    
+    strncpy(new_notification->title, msg->title, sizeof(new_notification->title) - 1);
+    strncpy(new_notification->message, msg->message, sizeof(new_notification->message) - 1);
+    strncpy(new_notification->time_str, msg->time_str, sizeof(new_notification->time_str) - 1);
+    new_notification->title[sizeof(new_notification->title) - 1] = '\0';
+    new_notification->message[sizeof(new_notification->message) - 1] = '\0';
+    new_notification->time_str[sizeof(new_notification->time_str) - 1] = '\0';
+    
+    new_notification->slideOffset = -130; // Start off-screen (above)
+    new_notification->autoCloseTimer = 30.0f;
+    new_notification->card_ready = false; // Laid out by the render thread
+    
+    // Push at the head; positions are derived while drawing
+    new_notification->prev = -1;
+    new_notification->next = stack_head;
+    if (stack_head >= 0) stack_slots[stack_head].prev = slot;
+    else stack_tail = slot;
+    stack_head = slot;
+    stack_count++;
+}
+
+// Safe from any thread; waits only while the queue is full
+void add_notification_to_stack(const char* title, const char* message, const char* time_str) {
+    notification_queue_push(title, message, time_str);
+}
+
+// Render thread: moves everything queued onto the stack, oldest first
+static void drain_notification_queue(void) {
+    notification_msg_t msg;
+    while (notification_queue_pop(&msg)) {
+        push_stack_notification(&msg);
+    }
+}
+
+// Colors shared by the stacked and single popups
+static const Color backgroundColor = {45, 45, 55, 255};
+static const Color titleColor = {255, 255, 255, 255};
+static const Color messageColor = {200, 200, 200, 255};
+static const Color timeColor = {100, 200, 255, 255};
+static const Color buttonColor = {70, 130, 180, 255};
+static const Color buttonHoverColor = {100, 149, 237, 255};
+static const Color accentColor = {255, 165, 0, 255};
+static const Color borderColor = {70, 70, 80, 255};
+
+#define NOTIFICATION_LINE_LEN 160
+
+static int prefix_width(char* text, size_t length, int fontSize) {
+    char saved = text[length];
+    text[length] = '\0';
+    int width = MeasureText(text, fontSize);
+    text[length] = saved;
+    return width;
+}
+
+// Copies as much of text as fits in maxWidth pixels, ending in "..." when
+// cut. Cuts only fall on UTF-8 sequence boundaries.
+static void fit_text_to_width(const char* text, int fontSize, int maxWidth, char* out, size_t outSize) {
+    snprintf(out, outSize, "%s", text);
+    if (MeasureText(out, fontSize) <= maxWidth) return;
+    
+    int ellipsisWidth = MeasureText("...", fontSize);
+    int fullWidth = MeasureText(out, fontSize);
+    size_t length = strlen(out);
+    
+    // Start from a proportional estimate, then settle on the exact cut one
+    // code point at a time
+    size_t cut = (maxWidth > ellipsisWidth) ? length * (size_t)(maxWidth - ellipsisWidth) / (size_t)fullWidth : 0;
+    while (cut > 0 && ((unsigned char)out[cut] & 0xC0) == 0x80) cut--;
+    
+    while (cut > 0 && prefix_width(out, cut, fontSize) + ellipsisWidth > maxWidth) {
+        do { cut--; } while (cut > 0 && ((unsigned char)out[cut] & 0xC0) == 0x80);
+    }
+    while (cut < length) {
+        size_t next = cut + 1;
+        while (next < length && ((unsigned char)out[next] & 0xC0) == 0x80) next++;
+        if (prefix_width(out, next, fontSize) + ellipsisWidth > maxWidth) break;
+        cut = next;
+    }
+    
+    while (cut > 0 && (cut + 4 > outSize || ((unsigned char)out[cut] & 0xC0) == 0x80)) cut--;
+    strcpy(out + cut, "...");
+}
+
+// Greedy word wrap by measured pixel width. Explicit newlines start a new
+// line and the last available line is truncated by width.
+static int wrap_text_to_width(const char* text, int fontSize, int maxWidth,
+                              char lines[][NOTIFICATION_LINE_LEN], int maxLines) {
+    int lineCount = 0;
+    const char* p = text;
+    
+    while (lineCount < maxLines) {
+        while (*p == ' ') p++;
+        if (!*p) break;
+        
+        if (lineCount == maxLines - 1) {
+            char rest[512];
+            snprintf(rest, sizeof(rest), "%s", p);
+            for (char* c = rest; *c; c++) {
+                if (*c == '\n') *c = ' ';
+            }
+            fit_text_to_width(rest, fontSize, maxWidth, lines[lineCount++], NOTIFICATION_LINE_LEN);
+            break;
+        }
+        
+        char* out = lines[lineCount];
+        out[0] = '\0';
+        while (*p && *p != '\n') {
+            int wordLength = (int)strcspn(p, " \n");
+            char candidate[NOTIFICATION_LINE_LEN];
+            snprintf(candidate, sizeof(candidate), "%s%s%.*s", out, out[0] ? " " : "", wordLength, p);
+            
+            if (MeasureText(candidate, fontSize) > maxWidth) {
+                if (out[0]) break;
+                // A single word wider than the line
+                fit_text_to_width(candidate, fontSize, maxWidth, out, NOTIFICATION_LINE_LEN);
+                p += wordLength;
+                break;
+            }
+            
+            strcpy(out, candidate);
+            p += wordLength;
+            while (*p == ' ') p++;
+        }
+        if (*p == '\n') p++;
+        lineCount++;
+    }
+    
+    return lineCount;
+}
+
+// Renders the parts of a card that never change into its cached texture,
+// so each frame only blits it and draws the timer bar and button
+static void render_stack_card(notification_window_t* card, int width, int height) {
+    if (!card->card_loaded) {
+        card->card = LoadRenderTexture(width, height);
+        card->card_loaded = true;
+    }
+    
+    char titleLine[NOTIFICATION_LINE_LEN];
+    char timeDisplay[64];
+    char messageLine[NOTIFICATION_LINE_LEN];
+    fit_text_to_width(card->title, 18, width - 65, titleLine, sizeof(titleLine));
+    snprintf(timeDisplay, sizeof(timeDisplay), "Time: %s", card->time_str);
+    fit_text_to_width(card->message, 14, width - 20, messageLine, sizeof(messageLine));
+    
+    BeginTextureMode(card->card);
+    ClearBackground(BLANK);
+    
+    // Draw notification background with border
+    DrawRectangle(0, 0, width, height, backgroundColor);
+    DrawRectangleLinesEx((Rectangle){0, 0, width, height}, 2, borderColor);
+    
+    // Draw notification icon (bell shape using raylib primitives)
+    DrawCircle(30, 25, 15, accentColor);
+    // Draw bell shape
+    DrawCircle(30, 22, 8, backgroundColor);
+    DrawRectangle(26, 22, 8, 6, backgroundColor);
+    DrawCircle(30, 30, 2, WHITE); // Bell clapper
+    
+    // Draw title (smaller)
+    DrawText(titleLine, 55, 10, 18, titleColor);
+    
+    // Draw simple clock icon and time
+    DrawCircle(60, 37, 6, timeColor);
+    DrawLine(60, 37, 60, 32, WHITE); // Hour hand
+    DrawLine(60, 37, 64, 37, WHITE); // Minute hand
+    DrawText(timeDisplay, 75, 30, 14, timeColor);
+    
+    // Draw separator line
+    DrawLine(10, 50, width - 10, 50, accentColor);
+    
+    DrawText(messageLine, 10, 60, 14, messageColor);
+    
+    EndTextureMode();
+    card->card_ready = true;
+}
+
+static RenderTexture2D render_button(const char* label, int width, int height, Color color) {
+    RenderTexture2D button = LoadRenderTexture(width, height);
+    BeginTextureMode(button);
+    ClearBackground(color);
+    DrawText(label, 8, 6, 14, WHITE);
+    EndTextureMode();
+    return button;
+}
+
+// Render textures are stored upside down; a negative source height flips them
+static void draw_cached_texture(RenderTexture2D target, float x, float y) {
+    Rectangle source = {0, 0, (float)target.texture.width, -(float)target.texture.height};
+    DrawTextureRec(target.texture, source, (Vector2){x, y}, WHITE);
+}
+
+static void unload_stack_cards(void) {
+    for (int slot = 0; slot < NOTIFICATION_STACK_CAPACITY; slot++) {
+        if (stack_slots[slot].card_loaded) {
+            UnloadRenderTexture(stack_slots[slot].card);
+            stack_slots[slot].card_loaded = false;
+            stack_slots[slot].card_ready = false;
+        }
+    }
+}
+
+// Frame counts and CPU time go to stderr only when ALGEN_NOTIFY_STATS is set
+static bool stats_enabled(void) {
+    const char* stats = getenv("ALGEN_NOTIFY_STATS");
+    return stats && *stats;
+}
+
+// Runs the stack window. A one-shot loop exits once the stack is empty; a
+// persistent loop hides the window and sleeps until the next notification.
+static int run_stack_loop(int persistent) {
+    drain_notification_queue();
+    int notification_count = stack_count;
+    if (notification_count == 0 && !persistent) return 0;
+    
+    // Initialize raylib window with dynamic sizing
+    const int windowWidth = 420;
+    const int notificationHeight = 120; // Smaller individual notification height
+    const int stackSpacing = 10;
+    int windowHeight = (notificationHeight + stackSpacing) * (notification_count > 0 ? notification_count : 1) + 20;
+    
+    InitWindow(windowWidth, windowHeight, "Agenda Notifications");
+    if (persistent) {
+        // ESC dismisses the stack but must not terminate the instance
+        SetExitKey(KEY_NULL);
+    }
+    
+    // Position window at top-right of screen
+    int screenWidth = GetMonitorWidth(0);
+    SetWindowPosition(screenWidth - windowWidth - 20, 20);
+    int targetFps = NOTIFICATION_ACTIVE_FPS;
+    SetTargetFPS(targetFps);
+    
+    float animationSpeed = 8.0f;
+    int shownCount = notification_count;
+    
+    // Dismiss button in both states, rendered once
+    RenderTexture2D dismissButtons[2] = {
+        render_button("Dismiss", 70, 25, buttonColor),
+        render_button("Dismiss", 70, 25, buttonHoverColor)
+    };
+    
+    // Frame timing is tracked here rather than with GetFrameTime(), which
+    // would report the whole hidden period as one frame after a wake-up
+    double lastFrameTime = GetTime();
+    long framesDrawn = 0;
+    clock_t cpuStart = clock();
+    double wallStart = lastFrameTime;
+    
+    // Main loop
+    while (!WindowShouldClose()) {
+        drain_notification_queue();
+        
+        if (persistent && stack_count == 0) {
+            if (stats_enabled()) {
+                fprintf(stderr, "Notification stack idle: %ld frames in %.1fs, %.2fs CPU\n",
+                        framesDrawn, GetTime() - wallStart,
+                        (double)(clock() - cpuStart) / CLOCKS_PER_SEC);
+            }
+            
+            // Nothing to show: hide the window and sleep until a notification arrives
+            SetWindowState(FLAG_WINDOW_HIDDEN);
+            notification_queue_wait();
+            drain_notification_queue();
+            ClearWindowState(FLAG_WINDOW_HIDDEN);
+            
+            lastFrameTime = wallStart = GetTime();
+            cpuStart = clock();
+            framesDrawn = 0;
+        } else if (stack_count == 0) {
+            break;
+        }
+        
+        // Grow or shrink the window as notifications come and go
+        bool layoutChanged = false;
+        notification_count = stack_count;
+        if (notification_count > 0 && notification_count != shownCount) {
+            windowHeight = (notificationHeight + stackSpacing) * notification_count + 20;
+            SetWindowSize(windowWidth, windowHeight);
+            shownCount = notification_count;
+            layoutChanged = true;
+        }
+        
+        double frameTime = GetTime();
+        float deltaTime = (float)(frameTime - lastFrameTime);
+        lastFrameTime = frameTime;
+        if (deltaTime > 0.5f) deltaTime = 0.5f;
+        
+        bool animating = false;
+        
+        // Update all notifications
+        int slot = stack_head;
+        int position = 0;
+        
+        while (slot >= 0) {
+            notification_window_t* current = &stack_slots[slot];
+            int next = current->next;
+            
+            // Calculate target position - stack from top to bottom
+            float targetY = 10 + (position * (notificationHeight + stackSpacing));
+            
+            // Smooth animation to target position, snapping once converged
+            float distance = targetY - current->slideOffset;
+            if (distance > 0.5f || distance < -0.5f) {
+                current->slideOffset += distance * animationSpeed * deltaTime;
+                animating = true;
+            } else {
+                current->slideOffset = targetY;
+            }
+            
+            // Auto-close countdown
+            current->autoCloseTimer -= deltaTime;
+            
+            if (current->autoCloseTimer <= 0) {
+                // Remove expired notification
+                unlink_stack_slot(slot);
+            } else {
+                position++;
+            }
+            
+            slot = next;
+        }
+        
+        // Handle input
+        Vector2 mousePos = GetMousePosition();
+        Vector2 mouseDelta = GetMouseDelta();
+        bool clickHandled = false;
+        bool pointerActive = mouseDelta.x != 0 || mouseDelta.y != 0 ||
+                             IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
+        
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+            for (slot = stack_head; slot >= 0 && !clickHandled; slot = stack_slots[slot].next) {
+                notification_window_t* current = &stack_slots[slot];
+                Rectangle dismissButton = {windowWidth - 80, current->slideOffset + notificationHeight - 35, 70, 25};
+                
+                if (CheckCollisionPointRec(mousePos, dismissButton)) {
+                    unlink_stack_slot(slot);
+                    clickHandled = true;
+                    break;
+                }
+            }
+        }
+        
+        // Check for ESC key to close all
+        if (IsKeyPressed(KEY_ESCAPE)) {
+            clear_notification_stack();
+            if (!persistent) break;
+        }
+        
+        // Full frame rate only while something moves; otherwise the timer
+        // bars are the only change and a few frames per second suffice
+        int wantedFps = (animating || pointerActive || layoutChanged || clickHandled)
+                            ? NOTIFICATION_ACTIVE_FPS : NOTIFICATION_IDLE_FPS;
+        if (wantedFps != targetFps) {
+            targetFps = wantedFps;
+            SetTargetFPS(targetFps);
+        }
+        
+        // Lay out newly arrived cards once, before the frame starts
+        for (slot = stack_head; slot >= 0; slot = stack_slots[slot].next) {
+            if (!stack_slots[slot].card_ready) {
+                render_stack_card(&stack_slots[slot], windowWidth, notificationHeight);
+            }
+        }
+        
+        // Drawing
+        BeginDrawing();
+        ClearBackground((Color){0, 0, 0, 0}); // Transparent background
+        
+        for (slot = stack_head; slot >= 0; slot = stack_slots[slot].next) {
+            notification_window_t* current = &stack_slots[slot];
+            float yPos = current->slideOffset;
+            
+            draw_cached_texture(current->card, 0, yPos);
+            
+            // Draw timer bar
+            float timerWidth = (current->autoCloseTimer / 30.0f) * (windowWidth - 20);
+            DrawRectangle(10, yPos + notificationHeight - 40, timerWidth, 3, accentColor);
+            
+            // Draw dismiss button
+            Rectangle dismissButton = {windowWidth - 80, yPos + notificationHeight - 35, 70, 25};
+            bool isHovering = CheckCollisionPointRec(mousePos, dismissButton);
+            draw_cached_texture(dismissButtons[isHovering ? 1 : 0], dismissButton.x, dismissButton.y);
+        }
+        
+        EndDrawing();
+        framesDrawn++;
+    }
+    
+    unload_stack_cards();
+    UnloadRenderTexture(dismissButtons[0]);
+    UnloadRenderTexture(dismissButtons[1]);
+    CloseWindow();
+    return 0;
+}
+
+int show_stacked_notifications(void) {
+    return run_stack_loop(0);
+}
+
+static void* stack_listener_thread(void* arg) {
+    int ipc_fd = *(int*)arg;
+    notification_msg_t msg;
+    
+    while (1) {
+        if (notification_ipc_receive(ipc_fd, &msg) == 0) {
+            add_notification_to_stack(msg.title, msg.message, msg.time_str);
+        }
+    }
+    
+    return NULL;
+}
+
+int serve_stacked_notifications(int ipc_fd) {
+    static int listener_fd;
+    pthread_t listener;
+    
+    listener_fd = ipc_fd;
+    if (pthread_create(&listener, NULL, stack_listener_thread, &listener_fd) != 0) {
+        fprintf(stderr, "Failed to start notification listener\n");
+        return -1;
+    }
+    pthread_detach(listener);
+    
+    int result = run_stack_loop(1);
+    notification_ipc_close(ipc_fd);
+    return result;
+}
+
+int show_visual_notification(const char* title, const char* message, const char* time_str) {
+    // Initialize raylib window
+    const int windowWidth = 400;
+    const int windowHeight = 250;
+    
+    InitWindow(windowWidth, windowHeight, "Agenda Notification");
+    SetWindowPosition(100, 100);
+    int targetFps = NOTIFICATION_ACTIVE_FPS;
+    SetTargetFPS(targetFps);
+    
+    // Animation variables
+    float slideOffset = windowHeight;
+    float targetOffset = 0;
+    float animationSpeed = 8.0f;
+    
+    // Button properties
+    Rectangle dismissButton = {windowWidth - 80, windowHeight - 40, 70, 30};
+    bool isHovering = false;
+    
+    // Auto-dismiss timer (30 seconds)
+    float autoCloseTimer = 30.0f;
+    
+    // Lay the text out once and render everything that only slides into a
+    // cached texture; a frame then blits it and draws the button
+    char titleLine[NOTIFICATION_LINE_LEN];
+    char timeDisplay[64];
+    char messageLines[4][NOTIFICATION_LINE_LEN];
+    fit_text_to_width(title, 24, windowWidth - 110, titleLine, sizeof(titleLine));
+    snprintf(timeDisplay, sizeof(timeDisplay), "⏰ %s", time_str);
+    int lineCount = wrap_text_to_width(message, 18, windowWidth - 60, messageLines, 4);
+    
+    RenderTexture2D content = LoadRenderTexture(windowWidth, windowHeight);
+    BeginTextureMode(content);
+    ClearBackground(BLANK);
+    
+    // Draw notification icon (bell)
+    DrawCircle(50, 50, 20, accentColor);
+    DrawText("🔔", 42, 35, 20, WHITE);
+    
+    // Draw title and time
+    DrawText(titleLine, 90, 30, 24, titleColor);
+    DrawText(timeDisplay, 90, 60, 16, timeColor);
+    
+    // Draw separator line
+    DrawLine(20, 90, windowWidth - 20, 90, accentColor);
+    
+    // Draw message (word wrapped by pixel width)
+    for (int i = 0; i < lineCount; i++) {
+        DrawText(messageLines[i], 30, 110 + (i * 25), 18, messageColor);
+    }
+    
+    // Draw subtle glow effect around the window
+    for (int i = 0; i < 3; i++) {
+        DrawRectangleLinesEx((Rectangle){i, i, windowWidth - 2*i, windowHeight - 2*i}, 
+                           1, (Color){accentColor.r, accentColor.g, accentColor.b, 50 - i*15});
+    }
+    EndTextureMode();
+    
+    const char* buttonText = "OK";
+    int buttonTextWidth = MeasureText(buttonText, 16);
+    
+    long framesDrawn = 0;
+    clock_t cpuStart = clock();
+    double wallStart = GetTime();
+    
+    // Main loop
+    while (!WindowShouldClose()) {
+        float deltaTime = GetFrameTime();
+        
+        // Smooth slide-in animation, snapping once converged
+        bool animating = false;
+        if (slideOffset - targetOffset > 0.5f) {
+            slideOffset += (targetOffset - slideOffset) * animationSpeed * deltaTime;
+            animating = true;
+        } else {
+            slideOffset = targetOffset;
+        }
+        
+        // Auto-close countdown
+        autoCloseTimer -= deltaTime;
+        if (autoCloseTimer <= 0) {
+            break;
+        }
+        
+        // Check for button hover
+        Vector2 mousePos = GetMousePosition();
+        isHovering = CheckCollisionPointRec(mousePos, dismissButton);
+        
+        // Check for button click
+        if (isHovering && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+            break;
+        }
+        
+        // Check for ESC key
+        if (IsKeyPressed(KEY_ESCAPE)) {
+            break;
+        }
+        
+        // Only the slide-in and pointer movement need full frame rate; the
+        // countdown text changes once per second
+        Vector2 mouseDelta = GetMouseDelta();
+        bool pointerActive = mouseDelta.x != 0 || mouseDelta.y != 0;
+        int wantedFps = (animating || pointerActive) ? NOTIFICATION_ACTIVE_FPS : NOTIFICATION_IDLE_FPS;
+        if (wantedFps != targetFps) {
+            targetFps = wantedFps;
+            SetTargetFPS(targetFps);
+        }
+        
+        // Drawing
+        BeginDrawing();
+        ClearBackground(backgroundColor);
+        
+        // Apply slide animation offset
+        int yOffset = (int)slideOffset;
+        
+        draw_cached_texture(content, 0, -yOffset);
+        
+        // Draw dismiss button
+        Color currentButtonColor = isHovering ? buttonHoverColor : buttonColor;
+        DrawRectangleRec(dismissButton, currentButtonColor);
+        DrawRectangleLinesEx(dismissButton, 1, WHITE);
+        
+        DrawText(buttonText, 
+                dismissButton.x + (dismissButton.width - buttonTextWidth) / 2,
+                dismissButton.y + 8, 16, WHITE);
+        
+        // Draw auto-close countdown
+        if (autoCloseTimer < 10) {
+            char countdownText[32];
+            snprintf(countdownText, sizeof(countdownText), "Auto-close: %.0fs", autoCloseTimer);
+            DrawText(countdownText, 20, windowHeight - 20, 12, (Color){150, 150, 150, 255});
+        }
+        
+        EndDrawing();
+        framesDrawn++;
+    }
+    
+    if (stats_enabled()) {
+        fprintf(stderr, "Notification closed: %ld frames in %.1fs, %.2fs CPU\n",
+                framesDrawn, GetTime() - wallStart,
+                (double)(clock() - cpuStart) / CLOCKS_PER_SEC);
+    }
+    
+    UnloadRenderTexture(content);
+    CloseWindow();
+    return 0;
+}
@@ -1,472 +1,335 @@
+#define _DEFAULT_SOURCE
 #include "agenda.h"
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/wait.h>
 
-// Global notification stack
-static notification_window_t* notification_stack = NULL;
-static pthread_mutex_t notification_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Runs a helper program without a shell, detached so it never becomes a
+// zombie of the server
+static int spawn_detached(char* const argv[]) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    
+    if (pid == 0) {
+        if (fork() != 0) {
+            _exit(0);
+        }
+        // The server blocks its signals for the event loop; the helper
+        // should not inherit that
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    
+    waitpid(pid, NULL, 0);
+    return 0;
+}
 
 int send_notification(const char* title, const char* message) {
-    // Use macOS osascript to display notification
-    char command[512];
-    snprintf(command, sizeof(command), 
-        "osascript -e 'display notification \"%s\" with title \"%s\" sound name \"default\"'",
-        message, title);
-    
-    int result = system(command);
-    return (result == 0) ? 0 : -1;
+#ifdef __APPLE__
+    // Title and message reach osascript as argv items, so no quoting is needed
+    char* const argv[] = {
+        "osascript",
+        "-e", "on run argv",
+        "-e", "display notification (item 2 of argv) with title (item 1 of argv) sound name \"default\"",
+        "-e", "end run",
+        (char*)title, (char*)message, NULL
+    };
+#else
+    char* const argv[] = { "notify-send", "--app-name=Algendado", (char*)title, (char*)message, NULL };
+#endif
+    return spawn_detached(argv);
 }
 
-void add_notification_to_stack(const char* title, const char* message, const char* time_str) {
-    pthread_mutex_lock(&notification_mutex);
-    
-    notification_window_t* new_notification = malloc(sizeof(notification_window_t));
-    if (!new_notification) {
-        pthread_mutex_unlock(&notification_mutex);
-        return;
-    }
-    
-    strncpy(new_notification->title, title, sizeof(new_notification->title) - 1);
-    strncpy(new_notification->message, message, sizeof(new_notification->message) - 1);
-    strncpy(new_notification->time_str, time_str, sizeof(new_notification->time_str) - 1);
-    new_notification->title[sizeof(new_notification->title) - 1] = '\0';
-    new_notification->message[sizeof(new_notification->message) - 1] = '\0';
-    new_notification->time_str[sizeof(new_notification->time_str) - 1] = '\0';
-    
-    new_notification->slideOffset = -130; // Start off-screen (above)
-    new_notification->autoCloseTimer = 30.0f;
-    new_notification->position_index = 0;
-    new_notification->next = notification_stack;
-    
-    // Update position indices
-    notification_window_t* current = notification_stack;
-    int index = 1;
-    while (current) {
-        current->position_index = index++;
-        current = current->next;
+// Popup backend: the single algen-stack instance
+
+static int popup_deliver(const char* title, const char* message, const char* time_str) {
+    return notification_ipc_deliver(title, message, time_str);
+}
+
+// Desktop backend: osascript on macOS, notify-send elsewhere
+
+static int desktop_deliver(const char* title, const char* message, const char* time_str) {
+    (void)time_str;
+    return send_notification(title, message);
+}
+
+// File backend: appends one line per notification. Works with a FIFO too;
+// each line goes out in a single write so readers never see it torn.
+
+static char file_backend_path[256];
+static int file_backend_fd = -1;
+
+static int file_open(void) {
+    file_backend_fd = open(file_backend_path, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0600);
+    return (file_backend_fd >= 0) ? 0 : -1;
+}
+
+static int file_init(const char* arg) {
+    if (!arg || !*arg) {
+        fprintf(stderr, "Notification backend 'file' needs a path (file:<path>)\n");
+        return -1;
     }
+    snprintf(file_backend_path, sizeof(file_backend_path), "%s", arg);
     
-    notification_stack = new_notification;
-    pthread_mutex_unlock(&notification_mutex);
+    // A FIFO without a reader cannot be opened yet; retry on delivery
+    signal(SIGPIPE, SIG_IGN);
+    file_open();
+    return 0;
 }
 
-static void remove_notification_from_stack(notification_window_t* to_remove) {
-    if (!to_remove) return;
-    
-    if (notification_stack == to_remove) {
-        notification_stack = to_remove->next;
-    } else {
-        notification_window_t* current = notification_stack;
-        while (current && current->next != to_remove) {
-            current = current->next;
-        }
-        if (current) {
-            current->next = to_remove->next;
-        }
+static int file_deliver(const char* title, const char* message, const char* time_str) {
+    if (file_backend_fd < 0 && file_open() != 0) {
+        return -1;
     }
     
-    // Update position indices
-    notification_window_t* current = notification_stack;
-    int index = 0;
-    while (current) {
-        current->position_index = index++;
-        current = current->next;
+    char line[640];
+    int length = snprintf(line, sizeof(line), "[%s] %s: %s\n", time_str, title, message);
+    if (length >= (int)sizeof(line)) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
     }
     
-    free(to_remove);
+    if (write(file_backend_fd, line, length) != length) {
+        // The reader of a FIFO went away; reopen next time
+        close(file_backend_fd);
+        file_backend_fd = -1;
+        return -1;
+    }
+    return 0;
 }
 
-int show_stacked_notifications(void) {
-    if (!notification_stack) return 0;
-    
-    // Count notifications to calculate window size
-    pthread_mutex_lock(&notification_mutex);
-    int notification_count = 0;
-    notification_window_t* counter = notification_stack;
-    while (counter) {
-        notification_count++;
-        counter = counter->next;
+static void file_shutdown(void) {
+    if (file_backend_fd >= 0) {
+        close(file_backend_fd);
+        file_backend_fd = -1;
     }
-    pthread_mutex_unlock(&notification_mutex);
-    
-    // Initialize raylib window with dynamic sizing
-    const int windowWidth = 420;
-    const int notificationHeight = 120; // Smaller individual notification height
-    const int stackSpacing = 10;
-    const int windowHeight = (notificationHeight + stackSpacing) * notification_count + 20;
-    
-    InitWindow(windowWidth, windowHeight, "Agenda Notifications");
-    
-    // Position window at top-right of screen
-    int screenWidth = GetMonitorWidth(0);
-    SetWindowPosition(screenWidth - windowWidth - 20, 20);
-    SetTargetFPS(60);
-    
-    // Colors
-    Color backgroundColor = (Color){45, 45, 55, 255};
-    Color titleColor = (Color){255, 255, 255, 255};
-    Color messageColor = (Color){200, 200, 200, 255};
-    Color timeColor = (Color){100, 200, 255, 255};
-    Color buttonColor = (Color){70, 130, 180, 255};
-    Color buttonHoverColor = (Color){100, 149, 237, 255};
-    Color accentColor = (Color){255, 165, 0, 255};
-    Color borderColor = (Color){70, 70, 80, 255};
+}
+
+// Stdout backend: for headless deployments logging to a journal
+
+static int stdout_deliver(const char* title, const char* message, const char* time_str) {
+    printf("NOTIFY [%s] %s: %s\n", time_str, title, message);
+    fflush(stdout);
+    return 0;
+}
+
+static const notification_backend_t notification_backends[] = {
+    { "popup",   NULL,      popup_deliver,   NULL },
+    { "desktop", NULL,      desktop_deliver, NULL },
+    { "file",    file_init, file_deliver,    file_shutdown },
+    { "stdout",  NULL,      stdout_deliver,  NULL },
+};
+
+#define MAX_ACTIVE_BACKENDS 8
+
+// Held while delivering, so a reload (SIGHUP) never swaps backends out
+// from under a delivery
+static pthread_mutex_t backends_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const notification_backend_t* active_backends[MAX_ACTIVE_BACKENDS];
+static int active_backend_count = 0;
+static char active_spec[512];
+
+static void shutdown_backends(void) {
+    for (int i = 0; i < active_backend_count; i++) {
+        if (active_backends[i]->shutdown) {
+            active_backends[i]->shutdown();
+        }
+    }
+    active_backend_count = 0;
+}
+
+static int configure_backends(const char* spec) {
+    shutdown_backends();
     
-    float animationSpeed = 8.0f;
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
     
-    // Main loop
-    while (!WindowShouldClose() && notification_stack) {
-        float deltaTime = GetFrameTime();
-        
-        pthread_mutex_lock(&notification_mutex);
-        
-        // Update all notifications
-        notification_window_t* current = notification_stack;
-        
-        while (current) {
-            // Calculate target position - stack from top to bottom
-            float targetY = 10 + (current->position_index * (notificationHeight + stackSpacing));
-            
-            // Smooth animation to target position
-            current->slideOffset += (targetY - current->slideOffset) * animationSpeed * deltaTime;
-            
-            // Auto-close countdown
-            current->autoCloseTimer -= deltaTime;
-            
-            if (current->autoCloseTimer <= 0) {
-                // Remove expired notification
-                notification_window_t* to_remove = current;
-                current = current->next;
-                remove_notification_from_stack(to_remove);
-                continue;
+    char* save = NULL;
+    for (char* entry = strtok_r(buffer, ",", &save); entry; entry = strtok_r(NULL, ",", &save)) {
+        char* arg = strchr(entry, ':');
+        if (arg) *arg++ = '\0';
+        
+        const notification_backend_t* backend = NULL;
+        for (size_t i = 0; i < sizeof(notification_backends) / sizeof(notification_backends[0]); i++) {
+            if (strcmp(entry, notification_backends[i].name) == 0) {
+                backend = &notification_backends[i];
+                break;
             }
-            
-            current = current->next;
         }
         
-        pthread_mutex_unlock(&notification_mutex);
-        
-        // Handle input
-        Vector2 mousePos = GetMousePosition();
-        bool clickHandled = false;
-        
-        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-            pthread_mutex_lock(&notification_mutex);
-            current = notification_stack;
-            while (current && !clickHandled) {
-                Rectangle dismissButton = {windowWidth - 80, current->slideOffset + notificationHeight - 35, 70, 25};
-                
-                if (CheckCollisionPointRec(mousePos, dismissButton)) {
-                    remove_notification_from_stack(current);
-                    clickHandled = true;
-                    break;
-                }
-                current = current->next;
-            }
-            pthread_mutex_unlock(&notification_mutex);
+        if (!backend) {
+            fprintf(stderr, "Unknown notification backend '%s'\n", entry);
+            return -1;
         }
-        
-        // Check for ESC key to close all
-        if (IsKeyPressed(KEY_ESCAPE)) {
-            pthread_mutex_lock(&notification_mutex);
-            while (notification_stack) {
-                notification_window_t* to_remove = notification_stack;
-                notification_stack = notification_stack->next;
-                free(to_remove);
-            }
-            pthread_mutex_unlock(&notification_mutex);
-            break;
+        if (active_backend_count == MAX_ACTIVE_BACKENDS) {
+            fprintf(stderr, "Too many notification backends\n");
+            return -1;
         }
-        
-        // Drawing
-        BeginDrawing();
-        ClearBackground((Color){0, 0, 0, 0}); // Transparent background
-        
-        pthread_mutex_lock(&notification_mutex);
-        current = notification_stack;
-        while (current) {
-            float yPos = current->slideOffset;
-            
-            // Draw notification background with border
-            DrawRectangle(0, yPos, windowWidth, notificationHeight, backgroundColor);
-            DrawRectangleLinesEx((Rectangle){0, yPos, windowWidth, notificationHeight}, 2, borderColor);
-            
-            // Draw notification icon (bell shape using raylib primitives)
-            DrawCircle(30, yPos + 25, 15, accentColor);
-            // Draw bell shape
-            DrawCircle(30, yPos + 22, 8, backgroundColor);
-            DrawRectangle(26, yPos + 22, 8, 6, backgroundColor);
-            DrawCircle(30, yPos + 30, 2, WHITE); // Bell clapper
-            
-            // Draw title (smaller)
-            DrawText(current->title, 55, yPos + 10, 18, titleColor);
-            
-            // Draw time with clock icon
-            char timeDisplay[64];
-            snprintf(timeDisplay, sizeof(timeDisplay), "Time: %s", current->time_str);
-            // Draw simple clock icon
-            DrawCircle(60, yPos + 37, 6, timeColor);
-            DrawLine(60, yPos + 37, 60, yPos + 32, WHITE); // Hour hand
-            DrawLine(60, yPos + 37, 64, yPos + 37, WHITE); // Minute hand
-            DrawText(timeDisplay, 75, yPos + 30, 14, timeColor);
-            
-            // Draw separator line
-            DrawLine(10, yPos + 50, windowWidth - 10, yPos + 50, accentColor);
-            
-            // Draw message (truncated if too long)
-            char displayMessage[80];
-            strncpy(displayMessage, current->message, sizeof(displayMessage) - 1);
-            displayMessage[sizeof(displayMessage) - 1] = '\0';
-            if (strlen(current->message) > 75) {
-                strcpy(displayMessage + 72, "...");
-            }
-            
-            DrawText(displayMessage, 10, yPos + 60, 14, messageColor);
-            
-            // Draw timer bar
-            float timerWidth = (current->autoCloseTimer / 30.0f) * (windowWidth - 20);
-            DrawRectangle(10, yPos + notificationHeight - 40, timerWidth, 3, accentColor);
-            
-            // Draw dismiss button
-            Rectangle dismissButton = {windowWidth - 80, yPos + notificationHeight - 35, 70, 25};
-            bool isHovering = CheckCollisionPointRec(GetMousePosition(), dismissButton);
-            Color btnColor = isHovering ? buttonHoverColor : buttonColor;
-            
-            DrawRectangleRec(dismissButton, btnColor);
-            DrawText("Dismiss", dismissButton.x + 8, dismissButton.y + 6, 14, WHITE);
-            
-            current = current->next;
+        if (backend->init && backend->init(arg) != 0) {
+            return -1;
         }
-        pthread_mutex_unlock(&notification_mutex);
         
-        EndDrawing();
+        active_backends[active_backend_count++] = backend;
     }
     
-    CloseWindow();
     return 0;
 }
 
-int show_visual_notification(const char* title, const char* message, const char* time_str) {
-    // Initialize raylib window
-    const int windowWidth = 400;
-    const int windowHeight = 250;
+// Selects backends from a comma separated list such as
+// "popup,desktop" or "stdout,file:/var/run/algen.fifo". An invalid list
+// leaves the backends that were active before.
+int notifications_configure(const char* spec) {
+    pthread_mutex_lock(&backends_mutex);
     
-    InitWindow(windowWidth, windowHeight, "Agenda Notification");
-    SetWindowPosition(100, 100);
-    SetTargetFPS(60);
+    int result = configure_backends(spec);
+    if (result == 0) {
+        snprintf(active_spec, sizeof(active_spec), "%s", spec);
+    } else if (active_spec[0]) {
+        configure_backends(active_spec);
+    } else {
+        shutdown_backends();
+    }
     
-    // Colors
-    Color backgroundColor = (Color){45, 45, 55, 255};
-    Color titleColor = (Color){255, 255, 255, 255};
-    Color messageColor = (Color){200, 200, 200, 255};
-    Color timeColor = (Color){100, 200, 255, 255};
-    Color buttonColor = (Color){70, 130, 180, 255};
-    Color buttonHoverColor = (Color){100, 149, 237, 255};
-    Color accentColor = (Color){255, 165, 0, 255};
+    pthread_mutex_unlock(&backends_mutex);
+    return result;
+}
+
+int deliver_notification(const char* title, const char* message, const char* time_str) {
+    int delivered = 0;
     
-    // Animation variables
-    float slideOffset = windowHeight;
-    float targetOffset = 0;
-    float animationSpeed = 8.0f;
+    pthread_mutex_lock(&backends_mutex);
+    for (int i = 0; i < active_backend_count; i++) {
+        if (active_backends[i]->deliver(title, message, time_str) == 0) {
+            delivered++;
+        } else {
+            printf("Notification backend '%s' failed\n", active_backends[i]->name);
+        }
+    }
+    pthread_mutex_unlock(&backends_mutex);
     
-    // Button properties
-    Rectangle dismissButton = {windowWidth - 80, windowHeight - 40, 70, 30};
-    bool isHovering = false;
+    return (delivered > 0) ? 0 : -1;
+}
+
+void notifications_shutdown(void) {
+    pthread_mutex_lock(&backends_mutex);
+    shutdown_backends();
+    active_spec[0] = '\0';
+    pthread_mutex_unlock(&backends_mutex);
+}
+
+// Reminders claimed on the event loop thread wait here for the delivery
+// thread, which may block on a helper program or a slow FIFO. The thread
+// sleeps on the condition variable until there is something to deliver.
+static pthread_mutex_t delivery_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delivery_queued = PTHREAD_COND_INITIALIZER;
+static reminder_t* pending_reminders = NULL;
+static int pending_count = 0;
+static int notification_thread_running = 1;
+
+// Claims every reminder due at now and queues it for delivery. Sets
+// *next_fire_at to when the next one is due (0 if none), for the caller
+// to sleep until. Returns the number claimed, or -1 on error.
+int notifications_dispatch(time_t now, time_t* next_fire_at) {
+    reminder_t* reminders;
+    int count;
     
-    // Auto-dismiss timer (30 seconds)
-    float autoCloseTimer = 30.0f;
+    // Claim the whole batch in one transaction before delivering, so
+    // a second server instance can never deliver the same reminder.
+    // Reminders go to the server owner, so only the default calendar
+    // is watched; named calendars are shared views.
+    if (db_claim_due_reminders(NULL, now, &reminders, &count) != 0) {
+        return -1;
+    }
     
-    // Main loop
-    while (!WindowShouldClose()) {
-        float deltaTime = GetFrameTime();
-        
-        // Smooth slide-in animation
-        slideOffset += (targetOffset - slideOffset) * animationSpeed * deltaTime;
-        
-        // Auto-close countdown
-        autoCloseTimer -= deltaTime;
-        if (autoCloseTimer <= 0) {
-            break;
-        }
-        
-        // Check for button hover
-        Vector2 mousePos = GetMousePosition();
-        isHovering = CheckCollisionPointRec(mousePos, dismissButton);
-        
-        // Check for button click
-        if (isHovering && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-            break;
-        }
-        
-        // Check for ESC key
-        if (IsKeyPressed(KEY_ESCAPE)) {
-            break;
-        }
-        
-        // Drawing
-        BeginDrawing();
-        ClearBackground(backgroundColor);
-        
-        // Apply slide animation offset
-        int yOffset = (int)slideOffset;
-        
-        // Draw notification icon (bell)
-        DrawCircle(50, 50 - yOffset, 20, accentColor);
-        DrawText("🔔", 42, 35 - yOffset, 20, WHITE);
-        
-        // Draw title
-        DrawText(title, 90, 30 - yOffset, 24, titleColor);
-        
-        // Draw time
-        char timeDisplay[64];
-        snprintf(timeDisplay, sizeof(timeDisplay), "⏰ %s", time_str);
-        DrawText(timeDisplay, 90, 60 - yOffset, 16, timeColor);
-        
-        // Draw separator line
-        DrawLine(20, 90 - yOffset, windowWidth - 20, 90 - yOffset, accentColor);
-        
-        // Draw message (word wrapped)
-        const char* messageLines[5];
-        int lineCount = 0;
-        char messageCopy[512];
-        strncpy(messageCopy, message, sizeof(messageCopy) - 1);
-        messageCopy[sizeof(messageCopy) - 1] = '\0';
-        
-        // Simple word wrapping
-        char* line = strtok(messageCopy, "\n");
-        while (line && lineCount < 5) {
-            messageLines[lineCount++] = line;
-            line = strtok(NULL, "\n");
-        }
-        
-        // If no newlines, try to wrap long text
-        if (lineCount == 1 && strlen(messageLines[0]) > 45) {
-            // Simple character-based wrapping for demo
-            static char line1[46], line2[46];
-            strncpy(line1, messageLines[0], 45);
-            line1[45] = '\0';
-            strcpy(line2, messageLines[0] + 45);
-            messageLines[0] = line1;
-            messageLines[1] = line2;
-            lineCount = 2;
-        }
-        
-        for (int i = 0; i < lineCount && i < 4; i++) {
-            DrawText(messageLines[i], 30, 110 + (i * 25) - yOffset, 18, messageColor);
-        }
-        
-        // Draw dismiss button
-        Color currentButtonColor = isHovering ? buttonHoverColor : buttonColor;
-        DrawRectangleRec(dismissButton, currentButtonColor);
-        DrawRectangleLinesEx(dismissButton, 1, WHITE);
-        
-        const char* buttonText = "OK";
-        int textWidth = MeasureText(buttonText, 16);
-        DrawText(buttonText, 
-                dismissButton.x + (dismissButton.width - textWidth) / 2,
-                dismissButton.y + 8, 16, WHITE);
-        
-        // Draw auto-close countdown
-        if (autoCloseTimer < 10) {
-            char countdownText[32];
-            snprintf(countdownText, sizeof(countdownText), "Auto-close: %.0fs", autoCloseTimer);
-            DrawText(countdownText, 20, windowHeight - 20, 12, (Color){150, 150, 150, 255});
-        }
-        
-        // Draw subtle glow effect around the window
-        for (int i = 0; i < 3; i++) {
-            DrawRectangleLinesEx((Rectangle){i, i - yOffset, windowWidth - 2*i, windowHeight - 2*i}, 
-                               1, (Color){accentColor.r, accentColor.g, accentColor.b, 50 - i*15});
+    if (count > 0) {
+        printf("Claimed %d due reminders\n", count);
+        
+        pthread_mutex_lock(&delivery_mutex);
+        reminder_t* grown = realloc(pending_reminders, (pending_count + count) * sizeof(reminder_t));
+        if (grown) {
+            memcpy(grown + pending_count, reminders, count * sizeof(reminder_t));
+            pending_reminders = grown;
+            pending_count += count;
+            pthread_cond_signal(&delivery_queued);
+        } else {
+            printf("Out of memory; dropped %d reminders\n", count);
         }
-        
-        EndDrawing();
+        pthread_mutex_unlock(&delivery_mutex);
+        free(reminders);
     }
     
-    CloseWindow();
-    return 0;
+    if (db_next_reminder_time(NULL, next_fire_at) != 0) {
+        return -1;
+    }
+    return count;
 }
 
-static volatile int notification_thread_running = 1;
+static void deliver_reminder(const reminder_t* reminder) {
+    const agenda_item_t* item = &reminder->item;
+    char title[64];
+    char message[512];
+    char formatted_time[32];
+    char offset_text[32];
+    
+    // Reminders for events that already started are retired silently
+    if (item->datetime < clock_now()) {
+        return;
+    }
+    
+    format_time_for_display(item->time, formatted_time);
+    format_reminder_offset(reminder->offset_minutes, offset_text, sizeof(offset_text));
+    snprintf(title, sizeof(title), "Agenda Reminder (%s)", offset_text);
+    snprintf(message, sizeof(message), "%s", item->description);
+    
+    printf("Delivering notification: %s at %s (ID: %d, %s)\n", 
+           item->description, formatted_time, item->id, offset_text);
+    
+    if (deliver_notification(title, message, formatted_time) != 0) {
+        printf("No notification backend delivered item %d\n", item->id);
+    }
+}
 
 void* notification_thread(void* arg) {
     (void)arg; // Suppress unused parameter warning
     
     printf("Notification thread started\n");
     
-    while (notification_thread_running) {
-        agenda_item_t* items;
-        int count;
+    // Reminders are claimed before they are queued, so the queue is
+    // drained even when stopping; they would not be claimed again
+    pthread_mutex_lock(&delivery_mutex);
+    while (notification_thread_running || pending_count > 0) {
+        if (pending_count == 0) {
+            pthread_cond_wait(&delivery_queued, &delivery_mutex);
+            continue;
+        }
         
-        if (db_get_pending_notifications(&items, &count) == 0) {
-            if (count > 0) {
-                printf("Found %d pending notifications\n", count);
-                
-                bool has_new_notifications = false;
-                char last_title[64] = "";
-                char last_message[512] = "";
-                char last_formatted_time[32] = "";
-                
-                for (int i = 0; i < count; i++) {
-                    char title[64];
-                    char message[512];
-                    char formatted_time[32];
-                    
-                    format_time_for_display(items[i].time, formatted_time);
-                    snprintf(title, sizeof(title), "Agenda Reminder");
-                    snprintf(message, sizeof(message), "%s", items[i].description);
-                    
-                    printf("Adding notification to stack: %s at %s (ID: %d)\n", 
-                           items[i].description, formatted_time, items[i].id);
-                    
-                    // Add to notification stack
-                    add_notification_to_stack(title, message, formatted_time);
-                    has_new_notifications = true;
-                    
-                    // Keep track of last notification for external command
-                    strncpy(last_title, title, sizeof(last_title) - 1);
-                    strncpy(last_message, message, sizeof(last_message) - 1);
-                    strncpy(last_formatted_time, formatted_time, sizeof(last_formatted_time) - 1);
-                    last_title[sizeof(last_title) - 1] = '\0';
-                    last_message[sizeof(last_message) - 1] = '\0';
-                    last_formatted_time[sizeof(last_formatted_time) - 1] = '\0';
-                    
-                    // Always send system notification as backup
-                    send_notification(title, items[i].description);
-                    db_mark_notified(items[i].id);
-                    printf("Marked item %d as notified\n", items[i].id);
-                }
-                
-                // If we have new notifications, start stacked display
-                if (has_new_notifications) {
-                    printf("Starting stacked notification display\n");
-                    // Use external executable for better display compatibility
-                    char command[1024];
-                    snprintf(command, sizeof(command), "./algen-stack \"%s\" \"%s\" \"%s\" &", 
-                            last_title, last_message, last_formatted_time);
-                    
-                    int result = system(command);
-                    if (result != 0) {
-                        printf("Stacked notification executable failed, trying fork method...\n");
-                        pid_t pid = fork();
-                        if (pid == 0) {
-                            // Child process - show stacked notifications
-                            show_stacked_notifications();
-                            exit(0);
-                        }
-                    }
-                }
-                
-                free(items);
-            }
+        reminder_t* reminders = pending_reminders;
+        int count = pending_count;
+        pending_reminders = NULL;
+        pending_count = 0;
+        pthread_mutex_unlock(&delivery_mutex);
+        
+        for (int i = 0; i < count; i++) {
+            deliver_reminder(&reminders[i]);
         }
+        free(reminders);
         
-        // Check every 30 seconds
-        sleep(30);
+        pthread_mutex_lock(&delivery_mutex);
     }
+    pthread_mutex_unlock(&delivery_mutex);
     
     printf("Notification thread stopped\n");
     return NULL;
 }
 
 void stop_notification_thread(void) {
+    pthread_mutex_lock(&delivery_mutex);
     notification_thread_running = 0;
+    pthread_cond_signal(&delivery_queued);
+    pthread_mutex_unlock(&delivery_mutex);
 }
@@ -0,0 +1,623 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// A primary ships its change log to read replicas over a Unix stream
+// socket. The replica opens with "SINCE <seq>" and the primary answers with
+// batches, each applied by the replica in one transaction:
+//
+//   RESET                        drop everything; a full snapshot follows
+//   I <id> <datetime> <notified> <date_len> <time_len> <desc_len> <end>
+//   <date><time><description>    raw bytes, no separator; end is 0 for
+//                                items without one, and may be missing
+//   D <id>
+//   U <id> <notified>
+//   T <id> <tag>                 tag added to an item
+//   COMMIT <seq>                 end of batch; the replica is now at seq
+//   PING                         heartbeat while nothing changes
+//
+// A replica that is new, or further behind than the retained log, gets a
+// snapshot. Only the default calendar is replicated. Replicas from before
+// tags reject T and keep reconnecting; upgrade them first.
+
+#define REPLICATION_MAX_REPLICAS 16
+#define REPLICATION_RECONNECT_SECONDS 1
+
+static volatile int replication_running = 0;
+static int listen_fd = -1;
+static char listen_path[108];
+static pthread_t accept_thread_id;
+static pthread_t replica_thread_id;
+static int accept_thread_started = 0;
+static int replica_thread_started = 0;
+
+// Session sockets are kept so stop can wake threads blocked in I/O
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sessions_done = PTHREAD_COND_INITIALIZER;
+static int session_fds[REPLICATION_MAX_REPLICAS];
+static int session_count = 0;
+static int replica_fd = -1;
+
+static int socket_address(const char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Replication socket path too long: %s\n", path);
+        return -1;
+    }
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    return 0;
+}
+
+static long long query_int64(sqlite3* conn, const char* sql) {
+    sqlite3_stmt* stmt;
+    long long value = -1;
+    if (sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return value;
+}
+
+// Primary side
+
+static int send_insert(FILE* out, sqlite3_stmt* stmt, int first_column) {
+    const char* date = (const char*)sqlite3_column_text(stmt, first_column + 1);
+    const char* time_str = (const char*)sqlite3_column_text(stmt, first_column + 2);
+    const char* description = (const char*)sqlite3_column_text(stmt, first_column + 3);
+    int date_length = sqlite3_column_bytes(stmt, first_column + 1);
+    int time_length = sqlite3_column_bytes(stmt, first_column + 2);
+    int description_length = sqlite3_column_bytes(stmt, first_column + 3);
+
+    fprintf(out, "I %d %lld %d %d %d %d %lld\n",
+            sqlite3_column_int(stmt, first_column),
+            (long long)sqlite3_column_int64(stmt, first_column + 4),
+            sqlite3_column_int(stmt, first_column + 5),
+            date_length, time_length, description_length,
+            (long long)sqlite3_column_int64(stmt, first_column + 6));
+    fwrite(date ? date : "", 1, date_length, out);
+    fwrite(time_str ? time_str : "", 1, time_length, out);
+    fwrite(description ? description : "", 1, description_length, out);
+    return ferror(out) ? -1 : 0;
+}
+
+// Sends every item and tag as of one read snapshot; returns the log
+// position the snapshot corresponds to
+static long long send_snapshot(sqlite3* conn, FILE* out) {
+    if (sqlite3_exec(conn, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+
+    // The first read pins the snapshot, so items and position agree
+    long long seq = query_int64(conn,
+        "SELECT COALESCE((SELECT seq FROM main.sqlite_sequence WHERE name = 'changelog'), 0);");
+
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(conn,
+        "SELECT id, date, time, description, datetime, COALESCE(notified, 0), end_datetime FROM all_items;",
+        -1, &stmt, NULL);
+
+    if (seq >= 0 && rc == SQLITE_OK) {
+        fputs("RESET\n", out);
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            if (send_insert(out, stmt, 0) != 0) {
+                break;
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    // Tags follow their items
+    if (seq >= 0 && rc == SQLITE_DONE) {
+        rc = sqlite3_prepare_v2(conn, "SELECT item_id, tag FROM item_tags;", -1, &stmt, NULL);
+        if (rc == SQLITE_OK) {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                if (fprintf(out, "T %d %s\n", sqlite3_column_int(stmt, 0),
+                            (const char*)sqlite3_column_text(stmt, 1)) < 0) {
+                    break;
+                }
+            }
+            sqlite3_finalize(stmt);
+        }
+        if (rc == SQLITE_DONE) {
+            fprintf(out, "COMMIT %lld\n", seq);
+        }
+    }
+
+    sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL);
+
+    if (rc != SQLITE_DONE || fflush(out) != 0) {
+        return -1;
+    }
+    return seq;
+}
+
+// Sends up to one batch of changes after *since and advances it; returns
+// how many changes went out
+static int send_changes(sqlite3* conn, FILE* out, long long* since) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn,
+            "SELECT seq, op, item_id, date, time, description, datetime, COALESCE(notified, 0), end_datetime "
+            "FROM changelog WHERE seq > ? ORDER BY seq LIMIT ?;",
+            -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, *since);
+    sqlite3_bind_int(stmt, 2, REPLICATION_BATCH_SIZE);
+
+    long long seq = *since;
+    int sent = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* op = (const char*)sqlite3_column_text(stmt, 1);
+        int failed = 0;
+
+        if (op[0] == 'I') {
+            failed = send_insert(out, stmt, 2);
+        } else if (op[0] == 'D') {
+            fprintf(out, "D %d\n", sqlite3_column_int(stmt, 2));
+        } else if (op[0] == 'T') {
+            fprintf(out, "T %d %s\n", sqlite3_column_int(stmt, 2), (const char*)sqlite3_column_text(stmt, 5));
+        } else {
+            fprintf(out, "U %d %d\n", sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 7));
+        }
+
+        if (failed || ferror(out)) {
+            break;
+        }
+        seq = sqlite3_column_int64(stmt, 0);
+        sent++;
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE) {
+        return -1;
+    }
+    if (sent > 0) {
+        fprintf(out, "COMMIT %lld\n", seq);
+    }
+    if (fflush(out) != 0) {
+        return -1;
+    }
+    *since = seq;
+    return sent;
+}
+
+static void session_register(int fd) {
+    pthread_mutex_lock(&sessions_mutex);
+    session_fds[session_count++] = fd;
+    pthread_mutex_unlock(&sessions_mutex);
+}
+
+static void session_unregister(int fd) {
+    pthread_mutex_lock(&sessions_mutex);
+    for (int i = 0; i < session_count; i++) {
+        if (session_fds[i] == fd) {
+            session_fds[i] = session_fds[--session_count];
+            break;
+        }
+    }
+    pthread_cond_broadcast(&sessions_done);
+    pthread_mutex_unlock(&sessions_mutex);
+}
+
+static void* replication_session(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    FILE* in = fdopen(fd, "r");
+    FILE* out = fdopen(dup(fd), "w");
+    sqlite3* conn = NULL;
+    char line[64];
+    long long since;
+
+    if (!in || !out || !fgets(line, sizeof(line), in) || sscanf(line, "SINCE %lld", &since) != 1 ||
+            db_open_calendar(DB_PATH, ARCHIVE_DB_PATH, 1, &conn) != 0) {
+        goto done;
+    }
+
+    printf("Replica connected at change %lld\n", since);
+
+    long long last_version = -1;
+    time_t last_sent = time(NULL);
+
+    while (replication_running) {
+        // data_version changes whenever another connection commits, so an
+        // idle primary costs one pragma per poll
+        long long version = query_int64(conn, "PRAGMA data_version;");
+        if (version != last_version) {
+            long long oldest = query_int64(conn, "SELECT COALESCE(min(seq), 0) FROM changelog;");
+            long long current = query_int64(conn,
+                "SELECT COALESCE((SELECT seq FROM main.sqlite_sequence WHERE name = 'changelog'), 0);");
+
+            // New replicas, replicas of an older incarnation of this
+            // database and replicas behind the pruned log start over
+            int sent;
+            if (since == 0 || since > current ||
+                (since < current && (oldest == 0 || since < oldest - 1))) {
+                since = send_snapshot(conn, out);
+                sent = (since < 0) ? -1 : 1;
+            } else {
+                sent = send_changes(conn, out, &since);
+            }
+            if (sent < 0) {
+                break;
+            }
+
+            // A full batch may have more behind it; look again right away
+            if (sent < REPLICATION_BATCH_SIZE) {
+                last_version = version;
+            }
+            if (sent > 0) {
+                last_sent = time(NULL);
+            }
+            continue;
+        }
+
+        if (time(NULL) - last_sent >= REPLICATION_HEARTBEAT_SECONDS) {
+            if (fputs("PING\n", out) < 0 || fflush(out) != 0) {
+                break;
+            }
+            last_sent = time(NULL);
+        }
+
+        usleep(REPLICATION_POLL_MS * 1000);
+    }
+
+    printf("Replica disconnected at change %lld\n", since);
+
+done:
+    sqlite3_close(conn);
+    if (out) fclose(out);
+    session_unregister(fd);
+    if (in) fclose(in);
+    else close(fd);
+    return NULL;
+}
+
+static void* replication_accept_thread(void* arg) {
+    (void)arg;
+
+    while (replication_running) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        pthread_mutex_lock(&sessions_mutex);
+        int full = (session_count == REPLICATION_MAX_REPLICAS);
+        pthread_mutex_unlock(&sessions_mutex);
+
+        pthread_t session;
+        if (full) {
+            fprintf(stderr, "Too many replicas; refusing connection\n");
+            close(fd);
+            continue;
+        }
+
+        session_register(fd);
+        if (pthread_create(&session, NULL, replication_session, (void*)(intptr_t)fd) != 0) {
+            session_unregister(fd);
+            close(fd);
+            continue;
+        }
+        pthread_detach(session);
+    }
+
+    return NULL;
+}
+
+int replication_primary_start(const char* socket_path) {
+    struct sockaddr_un addr;
+    if (socket_address(socket_path, &addr) != 0) {
+        return -1;
+    }
+
+    // A write to a replica that went away must fail, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Another primary on this path would still accept connections
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        close(probe);
+        fprintf(stderr, "Replication socket %s is in use\n", socket_path);
+        return -1;
+    }
+    if (probe >= 0) close(probe);
+    unlink(socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, REPLICATION_MAX_REPLICAS) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        if (listen_fd >= 0) close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    snprintf(listen_path, sizeof(listen_path), "%s", socket_path);
+
+    replication_running = 1;
+    if (pthread_create(&accept_thread_id, NULL, replication_accept_thread, NULL) != 0) {
+        replication_running = 0;
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    accept_thread_started = 1;
+
+    printf("Shipping changes to replicas on %s\n", socket_path);
+    return 0;
+}
+
+// Replica side
+
+static int read_exact(FILE* in, char* buffer, int length) {
+    return (int)fread(buffer, 1, length, in) == length ? 0 : -1;
+}
+
+// Runs sql with ?1 bound to an item id and ?2, if used, to value
+static int apply_by_id(sqlite3* conn, const char* sql, int id, int value) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, id);
+    if (sqlite3_bind_parameter_count(stmt) > 1) {
+        sqlite3_bind_int(stmt, 2, value);
+    }
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+static int apply_insert(sqlite3* conn, FILE* in, const char* line) {
+    int id, notified, date_length, time_length, description_length;
+    long long datetime;
+    long long end_datetime = 0;
+    // Primaries from before end times send six fields
+    if (sscanf(line, "I %d %lld %d %d %d %d %lld", &id, &datetime, &notified,
+               &date_length, &time_length, &description_length, &end_datetime) < 6 ||
+        date_length < 0 || time_length < 0 || description_length < 0) {
+        return -1;
+    }
+
+    char* data = malloc((size_t)date_length + time_length + description_length + 1);
+    if (!data || read_exact(in, data, date_length + time_length + description_length) != 0) {
+        free(data);
+        return -1;
+    }
+
+    // The primary decides where items live, so a replica keeps everything
+    // in its hot table; a stale copy of the same id goes first
+    sqlite3_stmt* stmt;
+    int rc = (apply_by_id(conn, "DELETE FROM main.agenda_items WHERE id = ?1;", id, 0) == 0 &&
+              apply_by_id(conn, "DELETE FROM archive.agenda_items WHERE id = ?1;", id, 0) == 0)
+             ? SQLITE_OK : SQLITE_ERROR;
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(conn,
+            "INSERT INTO main.agenda_items (id, date, time, description, datetime, notified, end_datetime) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?);", -1, &stmt, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_text(stmt, 2, data, date_length, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, data + date_length, time_length, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, data + date_length + time_length, description_length, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 5, datetime);
+        sqlite3_bind_int(stmt, 6, notified);
+        if (end_datetime > 0) {
+            sqlite3_bind_int64(stmt, 7, end_datetime);
+        } else {
+            sqlite3_bind_null(stmt, 7);
+        }
+        rc = (sqlite3_step(stmt) == SQLITE_DONE) ? SQLITE_OK : SQLITE_ERROR;
+        sqlite3_finalize(stmt);
+    }
+
+    free(data);
+    return (rc == SQLITE_OK) ? 0 : -1;
+}
+
+static int apply_tag(sqlite3* conn, int id, const char* tag) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn, "INSERT OR IGNORE INTO item_tags (tag, item_id) VALUES (?, ?);",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, id);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+static int apply_commit(sqlite3* conn, long long seq) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(conn,
+            "INSERT OR REPLACE INTO db_state (key, value) VALUES ('replica_seq', ?);",
+            -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, seq);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE) {
+        return -1;
+    }
+    return (sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK) ? 0 : -1;
+}
+
+// Applies batches until the primary goes away
+static void replica_stream(sqlite3* conn, FILE* in) {
+    char line[160];
+    int in_batch = 0;
+
+    while (replication_running && fgets(line, sizeof(line), in)) {
+        int id, value;
+        long long seq;
+        char tag[MAX_TAG_LEN];
+        int failed = 0;
+
+        if (strcmp(line, "PING\n") == 0) {
+            continue;
+        }
+
+        if (!in_batch) {
+            if (sqlite3_exec(conn, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+                break;
+            }
+            in_batch = 1;
+        }
+
+        if (strcmp(line, "RESET\n") == 0) {
+            failed = sqlite3_exec(conn,
+                "DELETE FROM main.agenda_items; DELETE FROM archive.agenda_items;",
+                NULL, NULL, NULL) != SQLITE_OK;
+        } else if (line[0] == 'I') {
+            failed = apply_insert(conn, in, line);
+        } else if (sscanf(line, "D %d", &id) == 1) {
+            failed = apply_by_id(conn, "DELETE FROM main.agenda_items WHERE id = ?1;", id, 0) != 0 ||
+                     apply_by_id(conn, "DELETE FROM archive.agenda_items WHERE id = ?1;", id, 0) != 0;
+        } else if (sscanf(line, "U %d %d", &id, &value) == 2) {
+            failed = apply_by_id(conn, "UPDATE main.agenda_items SET notified = ?2 WHERE id = ?1;", id, value) != 0 ||
+                     apply_by_id(conn, "UPDATE archive.agenda_items SET notified = ?2 WHERE id = ?1;", id, value) != 0;
+        } else if (sscanf(line, "T %d %31s", &id, tag) == 2) {
+            failed = apply_tag(conn, id, tag);
+        } else if (sscanf(line, "COMMIT %lld", &seq) == 1) {
+            failed = apply_commit(conn, seq);
+            in_batch = 0;
+        } else {
+            fprintf(stderr, "Unexpected replication message: %s", line);
+            failed = 1;
+        }
+
+        if (failed) {
+            fprintf(stderr, "Applying replicated changes failed: %s\n", sqlite3_errmsg(conn));
+            break;
+        }
+    }
+
+    // A batch cut off by a lost connection is sent again on reconnect
+    if (in_batch) {
+        sqlite3_exec(conn, "ROLLBACK;", NULL, NULL, NULL);
+    }
+}
+
+static void* replica_thread(void* arg) {
+    const char* socket_path = arg;
+    sqlite3* conn;
+
+    if (db_open_calendar(DB_PATH, ARCHIVE_DB_PATH, 1, &conn) != 0) {
+        fprintf(stderr, "Replica cannot open %s\n", DB_PATH);
+        return NULL;
+    }
+
+    struct sockaddr_un addr;
+    socket_address(socket_path, &addr);
+    int connected_before = 1;
+
+    while (replication_running) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            // Missing heartbeats mean the primary hung; reconnect
+            struct timeval timeout = { REPLICATION_HEARTBEAT_SECONDS * 3, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            pthread_mutex_lock(&sessions_mutex);
+            replica_fd = fd;
+            pthread_mutex_unlock(&sessions_mutex);
+
+            long long since = query_int64(conn,
+                "SELECT COALESCE((SELECT value FROM db_state WHERE key = 'replica_seq'), 0);");
+
+            FILE* in = fdopen(fd, "r");
+            if (in && dprintf(fd, "SINCE %lld\n", since) > 0) {
+                printf("Replicating from %s at change %lld\n", socket_path, since);
+                connected_before = 1;
+                replica_stream(conn, in);
+            }
+
+            pthread_mutex_lock(&sessions_mutex);
+            replica_fd = -1;
+            pthread_mutex_unlock(&sessions_mutex);
+
+            if (in) fclose(in);
+            else close(fd);
+        } else {
+            if (connected_before) {
+                printf("Primary at %s unavailable; retrying\n", socket_path);
+                connected_before = 0;
+            }
+            if (fd >= 0) close(fd);
+        }
+
+        for (int i = 0; i < REPLICATION_RECONNECT_SECONDS && replication_running; i++) {
+            sleep(1);
+        }
+    }
+
+    sqlite3_close(conn);
+    return NULL;
+}
+
+int replication_replica_start(const char* socket_path) {
+    struct sockaddr_un addr;
+    if (socket_address(socket_path, &addr) != 0) {
+        return -1;
+    }
+
+    replication_running = 1;
+    if (pthread_create(&replica_thread_id, NULL, replica_thread, (void*)socket_path) != 0) {
+        replication_running = 0;
+        return -1;
+    }
+    replica_thread_started = 1;
+    return 0;
+}
+
+void replication_stop(void) {
+    if (!replication_running) {
+        return;
+    }
+    replication_running = 0;
+
+    // Wake every thread blocked in accept or a socket read
+    pthread_mutex_lock(&sessions_mutex);
+    if (listen_fd >= 0) shutdown(listen_fd, SHUT_RDWR);
+    if (replica_fd >= 0) shutdown(replica_fd, SHUT_RDWR);
+    for (int i = 0; i < session_count; i++) {
+        shutdown(session_fds[i], SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+
+    if (accept_thread_started) {
+        pthread_join(accept_thread_id, NULL);
+        accept_thread_started = 0;
+    }
+    if (replica_thread_started) {
+        pthread_join(replica_thread_id, NULL);
+        replica_thread_started = 0;
+    }
+
+    // Sessions are detached; wait until each has closed its connection
+    pthread_mutex_lock(&sessions_mutex);
+    while (session_count > 0) {
+        pthread_cond_wait(&sessions_done, &sessions_mutex);
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(listen_path);
+    }
+}
@@ -1,14 +1,33 @@
+#define _DEFAULT_SOURCE
 #include "agenda.h"
 #include <microhttpd.h>
-#include <signal.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
 
 // Global variables
 static struct MHD_Daemon* web_daemon = NULL;
 static pthread_t notification_thread_id;
-static volatile int server_running = 0;
+static pthread_t maintenance_thread_id;
+static maintenance_config_t maintenance_config;
+static int server_port = SERVER_PORT;
+static const char* replication_socket = NULL;   // Primary: where replicas connect
+static const char* replica_of = NULL;           // Replica: the primary's socket
+static int server_started = 0;                  // Threads are up and need stopping
+static int ready_fd = -1;                        // Daemon: the parent waits on this
+static int lock_fd = -1;
+
+// Settings that can change on SIGHUP. Each source overrides the one
+// before: defaults, the config file, the environment, the command line.
+typedef struct {
+    char notify[512];
+    maintenance_config_t maintenance;
+} server_config_t;
+
+static const char* config_path = SERVER_CONFIG_PATH;
+static const char* notify_override = NULL;
+static const char* archive_days_override = NULL;
+static const char* backup_override = NULL;
 
 // External function declarations
 extern void* notification_thread(void* arg);
@@ -18,16 +37,216 @@ extern enum MHD_Result handle_web_request(void* cls, struct MHD_Connection* conn
                                          const char* version, const char* upload_data,
                                          size_t* upload_data_size, void** con_cls);
 
-static void signal_handler(int sig) {
-    (void)sig;
-    printf("\nShutting down server...\n");
-    server_running = 0;
+// Reads "key = value" lines; blank lines and lines starting with # are
+// skipped. A missing file is not an error.
+static int read_config_file(const char* path, server_config_t* config) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    
+    char line[640];
+    int line_number = 0;
+    int result = 0;
+    
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        
+        char* key = line;
+        while (isspace((unsigned char)*key)) key++;
+        if (*key == '\0' || *key == '#') {
+            continue;
+        }
+        
+        char* value = strchr(key, '=');
+        if (!value) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+            result = -1;
+            continue;
+        }
+        
+        // Trim around the key and the value
+        char* end = value;
+        *value++ = '\0';
+        while (end > key && isspace((unsigned char)end[-1])) *--end = '\0';
+        while (isspace((unsigned char)*value)) value++;
+        end = value + strlen(value);
+        while (end > value && isspace((unsigned char)end[-1])) *--end = '\0';
+        
+        if (strcmp(key, "notify") == 0) {
+            snprintf(config->notify, sizeof(config->notify), "%s", value);
+        } else if (strcmp(key, "archive_days") == 0) {
+            config->maintenance.retention_days = atoi(value);
+        } else if (strcmp(key, "backup") == 0) {
+            snprintf(config->maintenance.backup_path, sizeof(config->maintenance.backup_path), "%s", value);
+        } else {
+            fprintf(stderr, "%s:%d: unknown setting '%s'\n", path, line_number, key);
+            result = -1;
+        }
+    }
+    
+    fclose(file);
+    return result;
+}
+
+static int load_server_config(server_config_t* config) {
+    memset(config, 0, sizeof(*config));
+    snprintf(config->notify, sizeof(config->notify), "%s", NOTIFY_DEFAULT_BACKENDS);
+    config->maintenance.retention_days = ARCHIVE_RETENTION_DAYS;
+    
+    if (read_config_file(config_path, config) != 0) {
+        return -1;
+    }
+    
+    const char* notify = notify_override ? notify_override : getenv("ALGEN_NOTIFY");
+    if (notify) {
+        snprintf(config->notify, sizeof(config->notify), "%s", notify);
+    }
+    if (archive_days_override) {
+        config->maintenance.retention_days = atoi(archive_days_override);
+    }
+    if (backup_override) {
+        snprintf(config->maintenance.backup_path, sizeof(config->maintenance.backup_path), "%s", backup_override);
+    }
+    
+    // Replicas hold exactly what the primary has; archiving is the primary's job
+    if (replica_of) {
+        config->maintenance.retention_days = 0;
+    }
+    return 0;
+}
+
+// Applies the config file again without dropping connections or threads.
+// The port and replication role only change with a restart.
+static void server_reload(void) {
+    server_config_t config;
+    
+    if (load_server_config(&config) != 0) {
+        printf("Reload failed; keeping the current configuration\n");
+        return;
+    }
+    if (notifications_configure(config.notify) != 0) {
+        printf("Invalid notification backends '%s'; keeping the current ones\n", config.notify);
+        return;
+    }
+    maintenance_configure(&config.maintenance);
+    
+    printf("Configuration reloaded (notify: %s, retention: %d days, backup: %s)\n",
+           config.notify, config.maintenance.retention_days,
+           config.maintenance.backup_path[0] ? config.maintenance.backup_path : "off");
+}
+
+// Detaches from the terminal. The foreground process waits until the
+// server reports it is serving, or gives up, and exits with that status,
+// so whoever started it knows when it is ready.
+static void daemonize(void) {
+    int ready[2];
+    if (pipe(ready) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    
+    if (pid > 0) {
+        close(ready[1]);
+        
+        struct pollfd waiting = { ready[0], POLLIN, 0 };
+        char status = 0;
+        if (poll(&waiting, 1, SERVER_START_TIMEOUT_SECONDS * 1000) == 1 &&
+            read(ready[0], &status, 1) == 1 && status == 'R') {
+            _exit(0);
+        }
+        fprintf(stderr, "Server failed to start; see %s\n", SERVER_LOG_PATH);
+        _exit(1);
+    }
+    
+    close(ready[0]);
+    fcntl(ready[1], F_SETFD, FD_CLOEXEC);
+    ready_fd = ready[1];
+    setsid();
+    
+    int null_fd = open("/dev/null", O_RDWR);
+    int log_fd = open(SERVER_LOG_PATH, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (null_fd >= 0) dup2(null_fd, STDIN_FILENO);
+    if (log_fd >= 0) {
+        dup2(log_fd, STDOUT_FILENO);
+        dup2(log_fd, STDERR_FILENO);
+    }
+    if (null_fd > STDERR_FILENO) close(null_fd);
+    if (log_fd > STDERR_FILENO) close(log_fd);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+// Hands due reminders to the notification thread and sleeps the event
+// loop until the next one. Runs at start, when the timer fires and
+// whenever the reminders may have changed.
+static void schedule_reminders(void) {
+    time_t next_fire_at = 0;
+    
+    if (notifications_dispatch(clock_now(), &next_fire_at) < 0) {
+        printf("Checking reminders failed; retrying in %d seconds\n", REMINDER_RETRY_SECONDS);
+        next_fire_at = clock_now() + REMINDER_RETRY_SECONDS;
+    }
+    event_loop_set_deadline(next_fire_at);
+}
+
+// Everything the main thread does after startup happens here
+static int handle_server_event(event_t event) {
+    switch (event) {
+        case EVENT_SHUTDOWN:
+            return 1;
+        case EVENT_RELOAD:
+            server_reload();
+            return 0;
+        case EVENT_DEADLINE:
+        case EVENT_WAKE:
+            // The primary delivers reminders, not replicas
+            if (!replica_of) {
+                schedule_reminders();
+            }
+            return 0;
+    }
+    return 0;
+}
+
+// Stops taking client writes, then commits what the writer still has
+// queued; every path out of server_start after the writer started ends here
+static void stop_writes(void) {
+    write_channel_stop();
+    db_writer_stop();
+}
+
+// Releases a parent waiting in daemonize
+static void server_ready(void) {
+    if (ready_fd >= 0) {
+        if (write(ready_fd, "R", 1) != 1) {
+            perror("readiness pipe");
+        }
+        close(ready_fd);
+        ready_fd = -1;
+    }
 }
 
 int server_start(void) {
-    // Check if server is already running
-    if (server_is_running()) {
-        printf("Server is already running on port %d\n", SERVER_PORT);
+    // Signals are blocked from here on and arrive through the event loop;
+    // every thread started below inherits that
+    if (event_loop_init() != 0) {
+        fprintf(stderr, "Failed to set up the event loop\n");
+        return -1;
+    }
+    
+    // One server per directory; it holds the pid file lock while it runs
+    lock_fd = server_acquire_lock();
+    if (lock_fd < 0) {
+        printf("Server is already running (pid %d)\n", (int)server_running_pid());
+        server_ready();
+        event_loop_close();
         return 0;
     }
     
@@ -37,41 +256,105 @@ int server_start(void) {
         return -1;
     }
     
-    // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    // Writes to the default calendar go through the group-commit writer:
+    // reminder claims, and clients' adds and removes over the write
+    // channel. A commit that added items may have added a reminder, so
+    // the loop reschedules. A replica's channel refuses every write.
+    db_set_commit_hook(event_loop_wake);
+    if (db_writer_start() != 0) {
+        fprintf(stderr, "Failed to start database writer\n");
+        return -1;
+    }
+    if (write_channel_start(replica_of != NULL) != 0) {
+        fprintf(stderr, "Failed to start the write channel\n");
+        db_writer_stop();
+        return -1;
+    }
+    
+    // Pages render on a pool of workers while their connection is suspended
+    if (web_workers_start() != 0) {
+        fprintf(stderr, "Failed to start web workers\n");
+        stop_writes();
+        return -1;
+    }
     
-    // Start web daemon
+    // Start web daemon; the event loop drives it, there is no web thread
     web_daemon = MHD_start_daemon(
-        MHD_USE_INTERNAL_POLLING_THREAD,
-        SERVER_PORT,
+        event_loop_web_flags() | MHD_ALLOW_SUSPEND_RESUME,
+        server_port,
         NULL, NULL,
         &handle_web_request, NULL,
+        MHD_OPTION_NOTIFY_COMPLETED, &web_request_completed, NULL,
         MHD_OPTION_END
     );
     
     if (!web_daemon) {
-        fprintf(stderr, "Failed to start web server on port %d\n", SERVER_PORT);
+        fprintf(stderr, "Failed to start web server on port %d\n", server_port);
+        web_workers_stop();
+        stop_writes();
         return -1;
     }
     
-    printf("Agenda server started on port %d\n", SERVER_PORT);
-    printf("Web interface: http://localhost:%d\n", SERVER_PORT);
-    printf("ICS calendar: http://localhost:%d/calendar.ics\n", SERVER_PORT);
+    printf("Agenda server started on port %d\n", server_port);
+    printf("Web interface: http://localhost:%d\n", server_port);
+    printf("ICS calendar: http://localhost:%d/calendar.ics\n", server_port);
     
-    // Start notification thread
-    if (pthread_create(&notification_thread_id, NULL, notification_thread, NULL) != 0) {
+    // Start replication: ship changes, or follow a primary
+    int replication_failed = 0;
+    if (replication_socket) {
+        replication_failed = replication_primary_start(replication_socket);
+    } else if (replica_of) {
+        printf("Read replica of %s\n", replica_of);
+        replication_failed = replication_replica_start(replica_of);
+    }
+    if (replication_failed) {
+        fprintf(stderr, "Failed to start replication\n");
+        web_workers_stop();
+        MHD_stop_daemon(web_daemon);
+        web_daemon = NULL;
+        stop_writes();
+        return -1;
+    }
+    
+    // Start notification thread; the primary delivers reminders, not replicas
+    if (!replica_of && pthread_create(&notification_thread_id, NULL, notification_thread, NULL) != 0) {
         fprintf(stderr, "Failed to start notification thread\n");
+        replication_stop();
+        web_workers_stop();
         MHD_stop_daemon(web_daemon);
+        web_daemon = NULL;
+        stop_writes();
         return -1;
     }
     
-    server_running = 1;
+    // Start maintenance thread
+    if (pthread_create(&maintenance_thread_id, NULL, maintenance_thread, &maintenance_config) != 0) {
+        fprintf(stderr, "Failed to start maintenance thread\n");
+        if (!replica_of) {
+            stop_notification_thread();
+            pthread_join(notification_thread_id, NULL);
+        }
+        replication_stop();
+        web_workers_stop();
+        MHD_stop_daemon(web_daemon);
+        web_daemon = NULL;
+        stop_writes();
+        return -1;
+    }
     
-    // Main server loop
-    while (server_running) {
-        sleep(1);
+    server_started = 1;
+    printf("Server ready (pid %d)\n", (int)getpid());
+    server_ready();
+    
+    // Main server loop: sleeps until a signal, a request, a wakeup or the
+    // next reminder
+    if (!replica_of) {
+        schedule_reminders();
+    }
+    if (event_loop_run(web_daemon, handle_server_event) != 0) {
+        fprintf(stderr, "Event loop failed\n");
     }
+    printf("Shutting down server...\n");
     
     // Cleanup
     server_stop();
@@ -79,29 +362,100 @@ int server_start(void) {
 }
 
 void server_stop(void) {
-    if (server_running) {
-        server_running = 0;
+    if (server_started) {
+        server_started = 0;
         
         // Stop notification thread
-        stop_notification_thread();
-        pthread_join(notification_thread_id, NULL);
+        if (!replica_of) {
+            stop_notification_thread();
+            pthread_join(notification_thread_id, NULL);
+        }
         
-        // Stop web daemon
+        // Stop replication before the databases close
+        replication_stop();
+        
+        // Stop maintenance thread
+        stop_maintenance_thread();
+        pthread_join(maintenance_thread_id, NULL);
+        
+        // Stop web daemon, once no connection waits for a worker
+        web_workers_stop();
         if (web_daemon) {
             MHD_stop_daemon(web_daemon);
             web_daemon = NULL;
         }
         
-        // Close database
+        // Close databases; the writer commits what is still queued first
+        stop_writes();
+        calendar_cache_close_all();
+        tag_index_close_all();
         db_close();
+        notifications_shutdown();
         
+        db_set_commit_hook(NULL);
+        event_loop_close();
+        close(lock_fd);
+        lock_fd = -1;
         printf("Server stopped\n");
     }
 }
 
-int main(void) {
+int main(int argc, char* argv[]) {
+    int daemon_mode = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--notify=", 9) == 0) {
+            notify_override = argv[i] + 9;
+        } else if (strncmp(argv[i], "--archive-days=", 15) == 0) {
+            archive_days_override = argv[i] + 15;
+        } else if (strncmp(argv[i], "--backup=", 9) == 0) {
+            backup_override = argv[i] + 9;
+        } else if (strncmp(argv[i], "--config=", 9) == 0) {
+            config_path = argv[i] + 9;
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strncmp(argv[i], "--port=", 7) == 0) {
+            server_port = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--replication-socket=", 21) == 0) {
+            replication_socket = argv[i] + 21;
+        } else if (strncmp(argv[i], "--replica-of=", 13) == 0) {
+            replica_of = argv[i] + 13;
+        } else {
+            fprintf(stderr, "Usage: %s [--daemon] [--config=<path>] [--notify=popup,desktop,file:<path>,stdout]\n"
+                            "       [--archive-days=N] [--backup=<path>] [--port=N]\n"
+                            "       [--replication-socket=<path> | --replica-of=<path>]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (server_port <= 0 || server_port > 65535) {
+        fprintf(stderr, "Invalid port %d\n", server_port);
+        return 1;
+    }
+    if (replication_socket && replica_of) {
+        fprintf(stderr, "A server is either a primary or a replica, not both\n");
+        return 1;
+    }
+    
+    server_config_t config;
+    if (load_server_config(&config) != 0) {
+        fprintf(stderr, "Invalid configuration in %s\n", config_path);
+        return 1;
+    }
+    
+    // From here on output goes to the log file
+    if (daemon_mode) {
+        daemonize();
+    }
+    
     printf("Starting Algendado Server...\n");
     
+    if (notifications_configure(config.notify) != 0) {
+        fprintf(stderr, "Invalid notification backends '%s'\n", config.notify);
+        return 1;
+    }
+    printf("Notification backends: %s\n", config.notify);
+    maintenance_config = config.maintenance;
+    
     int result = server_start();
     if (result != 0) {
         fprintf(stderr, "Server failed to start\n");
@@ -0,0 +1,304 @@
+#include "agenda.h"
+
+// Tag indexes: for each tag of a calendar, the ids of the items carrying
+// it as a compressed bitmap (src/bitmap.c), so filters combine sets
+// instead of scanning item_tags or descriptions. There is one index per
+// database file, shared by every connection to it, the web workers'
+// included. It is rebuilt from item_tags when the tags version kept in
+// db_state has moved since it was built; triggers bump it whenever a tag
+// is added or removed, items and their tags alike.
+
+typedef struct {
+    char tag[MAX_TAG_LEN];
+    bitmap_t* items;
+} tag_entry_t;
+
+typedef struct tag_index {
+    char path[CALENDAR_NAME_LEN + 32];
+    long long version;           // Tags version it was built at; -1 before the first build
+    tag_entry_t* entries;        // By tag
+    int count;
+    int capacity;
+    pthread_mutex_t mutex;       // Held while the entries are read or rebuilt
+    struct tag_index* next;
+} tag_index_t;
+
+static pthread_mutex_t indexes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static tag_index_t* indexes = NULL;
+
+static void free_entries(tag_entry_t* entries, int count) {
+    for (int i = 0; i < count; i++) {
+        bitmap_free(entries[i].items);
+    }
+    free(entries);
+}
+
+// Rows arrive by tag and then id, so every add is an append
+static int add_tagged_item(const char* tag, int item_id, void* context) {
+    tag_index_t* index = context;
+
+    if (index->count == 0 || strcmp(index->entries[index->count - 1].tag, tag) != 0) {
+        if (index->count == index->capacity) {
+            int capacity = index->capacity ? index->capacity * 2 : 16;
+            tag_entry_t* grown = realloc(index->entries, capacity * sizeof(tag_entry_t));
+            if (!grown) {
+                return -1;
+            }
+            index->entries = grown;
+            index->capacity = capacity;
+        }
+        tag_entry_t* entry = &index->entries[index->count];
+        snprintf(entry->tag, sizeof(entry->tag), "%s", tag);
+        entry->items = bitmap_create();
+        if (!entry->items) {
+            return -1;
+        }
+        index->count++;
+    }
+
+    return bitmap_add(index->entries[index->count - 1].items, (uint32_t)item_id);
+}
+
+// Replaces the entries with a fresh read of item_tags; on failure the
+// old ones stay
+static int rebuild(calendar_t* cal, tag_index_t* index) {
+    tag_index_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+
+    if (db_each_item_tag(cal, add_tagged_item, &fresh) != 0) {
+        fprintf(stderr, "Cannot build the tag index of %s\n", index->path);
+        free_entries(fresh.entries, fresh.count);
+        return -1;
+    }
+
+    free_entries(index->entries, index->count);
+    index->entries = fresh.entries;
+    index->count = fresh.count;
+    index->capacity = fresh.capacity;
+    return 0;
+}
+
+// The index of cal, current and locked; NULL on error
+static tag_index_t* lock_index(calendar_t* cal) {
+    const char* path = cal ? cal->path : DB_PATH;
+
+    // Read before the tags: changes made in between only cost a rebuild
+    // on the next filter
+    long long version;
+    if (db_get_tags_version(cal, &version) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&indexes_mutex);
+    tag_index_t* index = indexes;
+    while (index && strcmp(index->path, path) != 0) {
+        index = index->next;
+    }
+    if (!index) {
+        index = calloc(1, sizeof(tag_index_t));
+        if (index) {
+            snprintf(index->path, sizeof(index->path), "%s", path);
+            index->version = -1;
+            pthread_mutex_init(&index->mutex, NULL);
+            index->next = indexes;
+            indexes = index;
+        }
+    }
+    pthread_mutex_unlock(&indexes_mutex);
+
+    if (!index) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&index->mutex);
+    if (index->version != version) {
+        if (rebuild(cal, index) != 0) {
+            pthread_mutex_unlock(&index->mutex);
+            return NULL;
+        }
+        index->version = version;
+    }
+    return index;
+}
+
+static const bitmap_t* find_tag(const tag_index_t* index, const char* tag) {
+    int lo = 0, hi = index->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int order = strcmp(index->entries[mid].tag, tag);
+        if (order == 0) {
+            return index->entries[mid].items;
+        }
+        if (order < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// The items carrying every tag of one term such as "work+urgent", smallest
+// set first so the intersection shrinks fastest. Sets error on a
+// malformed term or when out of memory.
+static bitmap_t* evaluate_term(const tag_index_t* index, const char* term, size_t length, int* error) {
+    const bitmap_t* sets[MAX_TAGS];
+    int set_count = 0;
+    int missing = 0;
+
+    size_t position = 0;
+    for (;;) {
+        size_t tag_length = 0;
+        while (position + tag_length < length && term[position + tag_length] != '+' &&
+               term[position + tag_length] != ' ') {
+            tag_length++;
+        }
+
+        char tag[MAX_TAG_LEN];
+        if (set_count == MAX_TAGS || parse_tag(term + position, tag_length, tag) != 0) {
+            *error = 1;
+            return NULL;
+        }
+        // An unknown tag matches nothing; keep going to check the syntax
+        const bitmap_t* set = find_tag(index, tag);
+        if (set) {
+            sets[set_count++] = set;
+        } else {
+            missing = 1;
+        }
+
+        position += tag_length;
+        if (position == length) {
+            break;
+        }
+        position++;
+    }
+
+    if (missing) {
+        bitmap_t* empty = bitmap_create();
+        *error = !empty;
+        return empty;
+    }
+
+    for (int i = 1; i < set_count; i++) {
+        for (int j = i; j > 0 && bitmap_cardinality(sets[j]) < bitmap_cardinality(sets[j - 1]); j--) {
+            const bitmap_t* swap = sets[j];
+            sets[j] = sets[j - 1];
+            sets[j - 1] = swap;
+        }
+    }
+
+    bitmap_t* result = bitmap_copy(sets[0]);
+    for (int i = 1; i < set_count && result && bitmap_cardinality(result) > 0; i++) {
+        bitmap_t* narrowed = bitmap_and(result, sets[i]);
+        bitmap_free(result);
+        result = narrowed;
+    }
+    *error = !result;
+    return result;
+}
+
+// The items matching expression: terms separated by ',' match items in
+// any of them (OR), tags within a term joined by '+' or ' ' must all be
+// present (AND). "work+urgent,home" is urgent work items and every home
+// item. Unknown tags match nothing. Returns -1 for a malformed expression
+// or on error; otherwise *items is the caller's to bitmap_free.
+int tag_filter(calendar_t* cal, const char* expression, bitmap_t** items) {
+    *items = NULL;
+
+    tag_index_t* index = lock_index(cal);
+    if (!index) {
+        return -1;
+    }
+
+    bitmap_t* result = NULL;
+    int error = 0;
+    const char* p = expression;
+    for (;;) {
+        size_t length = strcspn(p, ",");
+        bitmap_t* term = evaluate_term(index, p, length, &error);
+        if (error) {
+            bitmap_free(term);
+            break;
+        }
+
+        if (!result) {
+            result = term;
+        } else {
+            bitmap_t* merged = bitmap_or(result, term);
+            bitmap_free(result);
+            bitmap_free(term);
+            result = merged;
+            if (!result) {
+                error = 1;
+                break;
+            }
+        }
+
+        if (p[length] == '\0') {
+            break;
+        }
+        p += length + 1;
+    }
+    pthread_mutex_unlock(&index->mutex);
+
+    if (error) {
+        bitmap_free(result);
+        return -1;
+    }
+    *items = result;
+    return 0;
+}
+
+// Every tag of cal with its item count, by tag. The caller frees counts.
+int tag_counts(calendar_t* cal, tag_count_t** counts, int* count) {
+    tag_index_t* index = lock_index(cal);
+    if (!index) {
+        return -1;
+    }
+
+    *counts = calloc(index->count ? index->count : 1, sizeof(tag_count_t));
+    if (!*counts) {
+        pthread_mutex_unlock(&index->mutex);
+        return -1;
+    }
+    for (int i = 0; i < index->count; i++) {
+        snprintf((*counts)[i].tag, sizeof((*counts)[i].tag), "%s", index->entries[i].tag);
+        (*counts)[i].item_count = (int)bitmap_cardinality(index->entries[i].items);
+    }
+    *count = index->count;
+    pthread_mutex_unlock(&index->mutex);
+    return 0;
+}
+
+static void free_index(tag_index_t* index) {
+    free_entries(index->entries, index->count);
+    pthread_mutex_destroy(&index->mutex);
+    free(index);
+}
+
+// Frees the index of the database at path, when its calendar is closed.
+// Nobody may be filtering on it.
+void tag_index_drop(const char* path) {
+    pthread_mutex_lock(&indexes_mutex);
+    tag_index_t** link = &indexes;
+    while (*link && strcmp((*link)->path, path) != 0) {
+        link = &(*link)->next;
+    }
+    tag_index_t* index = *link;
+    if (index) {
+        *link = index->next;
+    }
+    pthread_mutex_unlock(&indexes_mutex);
+
+    if (index) {
+        free_index(index);
+    }
+}
+
+void tag_index_close_all(void) {
+    pthread_mutex_lock(&indexes_mutex);
+    while (indexes) {
+        tag_index_t* index = indexes;
+        indexes = index->next;
+        free_index(index);
+    }
+    pthread_mutex_unlock(&indexes_mutex);
+}
@@ -0,0 +1,123 @@
+#include "agenda.h"
+
+// Rendering a compiled template only appends pointers: static fragments
+// point into the template tables and plain values into the caller's
+// memory. Values that need escaping or formatting are written to the
+// output's arena, as are the piece list and the joined page; nothing is
+// freed until the arena is.
+
+void template_output_init(template_output_t* out, arena_t* arena) {
+    memset(out, 0, sizeof(template_output_t));
+    out->arena = arena;
+}
+
+static void append_piece(template_output_t* out, const char* base, size_t length) {
+    if (length == 0 || out->failed) {
+        return;
+    }
+
+    if (out->piece_count == out->piece_capacity) {
+        int capacity = out->piece_capacity ? out->piece_capacity * 2 : 64;
+        template_iovec_t* pieces = arena_grow(out->arena, out->pieces,
+                                              out->piece_capacity * sizeof(template_iovec_t),
+                                              capacity * sizeof(template_iovec_t));
+        if (!pieces) {
+            out->failed = 1;
+            return;
+        }
+        out->pieces = pieces;
+        out->piece_capacity = capacity;
+    }
+
+    out->pieces[out->piece_count].iov_base = base;
+    out->pieces[out->piece_count].iov_len = length;
+    out->piece_count++;
+    out->length += length;
+}
+
+// Returns size bytes from the output's arena, for values formatted by the
+// caller. NULL when out of memory.
+char* template_output_alloc(template_output_t* out, size_t size) {
+    char* memory = arena_alloc(out->arena, size);
+    if (!memory) {
+        out->failed = 1;
+    }
+    return memory;
+}
+
+static void emit_text(template_output_t* out, const char* text) {
+    size_t length = strlen(text);
+    if (html_escape_find(text, length) == length) {
+        append_piece(out, text, length);
+        return;
+    }
+
+    // The longest entity is six bytes
+    size_t size = length * 6 + 1;
+    char* escaped = template_output_alloc(out, size);
+    if (!escaped) {
+        return;
+    }
+    size_t escaped_length = html_escape(text, escaped, size);
+    arena_shrink(out->arena, escaped, escaped_length);
+    append_piece(out, escaped, escaped_length);
+}
+
+static void emit_int(template_output_t* out, long number) {
+    char* digits = template_output_alloc(out, 24);
+    if (!digits) {
+        return;
+    }
+    int length = snprintf(digits, 24, "%ld", number);
+    arena_shrink(out->arena, digits, length);
+    append_piece(out, digits, length);
+}
+
+// Appends one rendering of tmpl; values is indexed by the template's slot
+// enum and may be NULL for templates without slots
+void template_emit(template_output_t* out, const template_t* tmpl, const template_value_t* values) {
+    for (int i = 0; i < tmpl->part_count; i++) {
+        const template_part_t* part = &tmpl->parts[i];
+        const template_value_t* value = values ? &values[part->slot] : NULL;
+
+        switch (part->type) {
+            case SLOT_NONE:
+                append_piece(out, part->fragment, part->length);
+                break;
+            case SLOT_TEXT:
+                if (value && value->text) emit_text(out, value->text);
+                break;
+            case SLOT_RAW:
+                if (value && value->text) append_piece(out, value->text, strlen(value->text));
+                break;
+            case SLOT_INT:
+                emit_int(out, value ? value->number : 0);
+                break;
+        }
+    }
+}
+
+// Gathers the pieces into one NUL-terminated buffer of exactly the output's
+// size, in the arena. NULL when rendering ran out of memory.
+char* template_output_join(template_output_t* out, size_t* length) {
+    if (out->failed) {
+        return NULL;
+    }
+
+    char* joined = arena_alloc(out->arena, out->length + 1);
+    if (!joined) {
+        return NULL;
+    }
+
+    char* p = joined;
+    for (int i = 0; i < out->piece_count; i++) {
+        memcpy(p, out->pieces[i].iov_base, out->pieces[i].iov_len);
+        p += out->pieces[i].iov_len;
+    }
+    *p = '\0';
+
+    if (length) {
+        *length = out->length;
+    }
+    return joined;
+}
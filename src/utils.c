@@ -1,12 +1,12 @@
+#define _DEFAULT_SOURCE
 #include "agenda.h"
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
 
 int parse_date_input(const char* input, char* output_date) {
-    time_t now = time(NULL);
-    struct tm* tm_now = localtime(&now);
-    struct tm tm_target = *tm_now;
+    time_t now = clock_now();
+    struct tm tm_target;
+    localtime_r(&now, &tm_target);
 
     if (strcmp(input, "today") == 0) {
         // Use current date
@@ -71,6 +71,230 @@ time_t combine_datetime(const char* date, const char* time) {
     return mktime(&tm_datetime);
 }
 
+// Parses a comma separated list of offsets such as "1d,1h,5m"; a bare
+// number means minutes. Returns the number of offsets, at least one, or
+// -1 on error; empty lists and empty entries are errors.
+int parse_reminder_offsets(const char* input, int* offsets, int max_offsets) {
+    int count = 0;
+    const char* p = input;
+    
+    while (*p) {
+        char* end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < 0) {
+            return -1;
+        }
+        
+        int multiplier = 1;
+        switch (*end) {
+            case 'm': multiplier = 1; end++; break;
+            case 'h': multiplier = 60; end++; break;
+            case 'd': multiplier = 24 * 60; end++; break;
+            case 'w': multiplier = 7 * 24 * 60; end++; break;
+            default: break;
+        }
+        
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+        if (count == max_offsets || value > MAX_REMINDER_OFFSET_MINUTES / multiplier) {
+            return -1;
+        }
+        
+        offsets[count++] = (int)value * multiplier;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end == ',' && *p == '\0') {
+            return -1;
+        }
+    }
+    
+    return count > 0 ? count : -1;
+}
+
+// Parses a duration such as "45m", "2h" or "1h30m" into minutes; a bare
+// number means minutes. Returns -1 on error or a zero duration.
+int parse_duration(const char* input) {
+    long minutes = 0;
+    const char* p = input;
+    
+    while (*p) {
+        char* end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < 0 || value > MAX_DURATION_MINUTES) {
+            return -1;
+        }
+        
+        int multiplier = 1;
+        switch (*end) {
+            case 'm': multiplier = 1; end++; break;
+            case 'h': multiplier = 60; end++; break;
+            case 'd': multiplier = 24 * 60; end++; break;
+            default:
+                if (*end != '\0') return -1;
+                break;
+        }
+        
+        minutes += value * multiplier;
+        if (minutes > MAX_DURATION_MINUTES) {
+            return -1;
+        }
+        p = end;
+    }
+    
+    return (minutes > 0) ? (int)minutes : -1;
+}
+
+// Copies the tag in the first length bytes of input to output, lowercased.
+// Tags are letters, digits, '-' and '_', so they never need quoting in a
+// filter, a URL or the replication stream.
+int parse_tag(const char* input, size_t length, char* output) {
+    if (length == 0 || length >= MAX_TAG_LEN) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        char c = input[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = (char)(c - 'A' + 'a');
+        }
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_')) {
+            return -1;
+        }
+        output[i] = c;
+    }
+    output[length] = '\0';
+    return 0;
+}
+
+// Parses a comma-separated list of tags such as "work,Project-X". Repeats
+// are dropped. Returns the number of tags, or -1 on error.
+int parse_tags(const char* input, char (*tags)[MAX_TAG_LEN], int max_tags) {
+    int count = 0;
+    const char* p = input;
+
+    for (;;) {
+        size_t length = strcspn(p, ",");
+        char tag[MAX_TAG_LEN];
+        if (parse_tag(p, length, tag) != 0) {
+            return -1;
+        }
+
+        int seen = 0;
+        for (int i = 0; i < count && !seen; i++) {
+            seen = (strcmp(tags[i], tag) == 0);
+        }
+        if (!seen) {
+            if (count == max_tags) {
+                return -1;
+            }
+            strcpy(tags[count++], tag);
+        }
+
+        if (p[length] == '\0') {
+            break;
+        }
+        p += length + 1;
+    }
+
+    return count;
+}
+
+void format_reminder_offset(int offset_minutes, char* output, size_t output_size) {
+    int value = offset_minutes;
+    const char* unit = "minute";
+    
+    if (offset_minutes > 0 && offset_minutes % (7 * 24 * 60) == 0) {
+        value = offset_minutes / (7 * 24 * 60);
+        unit = "week";
+    } else if (offset_minutes > 0 && offset_minutes % (24 * 60) == 0) {
+        value = offset_minutes / (24 * 60);
+        unit = "day";
+    } else if (offset_minutes > 0 && offset_minutes % 60 == 0) {
+        value = offset_minutes / 60;
+        unit = "hour";
+    }
+    
+    if (value == 0) {
+        snprintf(output, output_size, "now");
+    } else {
+        snprintf(output, output_size, "in %d %s%s", value, unit, value == 1 ? "" : "s");
+    }
+}
+
+// Accepts the client date formats as well as YYYY-MM-DD (HTML date inputs)
+static int parse_any_date(const char* input, char* output_date) {
+    int year, month, day;
+    if (sscanf(input, "%d-%d-%d", &year, &month, &day) == 3) {
+        snprintf(output_date, MAX_DATE_LEN, "%04d-%02d-%02d", year, month, day);
+        return 0;
+    }
+    return parse_date_input(input, output_date);
+}
+
+// Turns optional from/to dates (both inclusive) into a [start, end) range;
+// a missing bound leaves that side open
+int parse_search_range(const char* from, const char* to, time_t* start, time_t* end) {
+    char date[MAX_DATE_LEN];
+    
+    *start = 0;
+    *end = (time_t)1 << 62;
+    
+    if (from && *from) {
+        if (parse_any_date(from, date) != 0) return -1;
+        *start = combine_datetime(date, "00:00:00");
+        if (*start == -1) return -1;
+    }
+    
+    if (to && *to) {
+        if (parse_any_date(to, date) != 0) return -1;
+        struct tm tm_end = {0};
+        if (sscanf(date, "%d-%d-%d", &tm_end.tm_year, &tm_end.tm_mon, &tm_end.tm_mday) != 3) return -1;
+        tm_end.tm_year -= 1900;
+        tm_end.tm_mon -= 1;
+        tm_end.tm_mday += 1; // Through the end of that day
+        tm_end.tm_isdst = -1;
+        *end = mktime(&tm_end);
+        if (*end == -1) return -1;
+    }
+    
+    return 0;
+}
+
+// The span of a view around now: today, this week from Sunday, or this
+// calendar month
+int view_time_range(view_type_t view, time_t now, time_t* start, time_t* end) {
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    tm_now.tm_hour = 0;
+    tm_now.tm_min = 0;
+    tm_now.tm_sec = 0;
+
+    switch (view) {
+        case VIEW_TODAY:
+            *start = mktime(&tm_now);
+            *end = *start + 24 * 60 * 60;
+            break;
+        case VIEW_WEEK:
+            tm_now.tm_mday -= tm_now.tm_wday; // Start of week
+            *start = mktime(&tm_now);
+            *end = *start + 7 * 24 * 60 * 60;
+            break;
+        case VIEW_MONTH:
+            tm_now.tm_mday = 1; // First day of month
+            *start = mktime(&tm_now);
+            tm_now.tm_mon++;
+            if (tm_now.tm_mon > 11) {
+                tm_now.tm_mon = 0;
+                tm_now.tm_year++;
+            }
+            *end = mktime(&tm_now);
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
 void format_date_for_display(const char* date, char* output) {
     struct tm tm_date = {0};
     if (sscanf(date, "%d-%d-%d", &tm_date.tm_year, &tm_date.tm_mon, &tm_date.tm_mday) == 3) {
@@ -91,47 +315,112 @@ void format_time_for_display(const char* time, char* output) {
     }
 }
 
+// "10:00 AM", or "10:00 AM - 11:30 AM" for an item with an end
+void format_time_range_for_display(const agenda_item_t* item, char* output, size_t output_size) {
+    char start[MAX_TIME_LEN];
+    format_time_for_display(item->time, start);
+    
+    if (item->end_datetime <= 0) {
+        snprintf(output, output_size, "%s", start);
+        return;
+    }
+    
+    struct tm tm_end;
+    char end[MAX_TIME_LEN];
+    localtime_r(&item->end_datetime, &tm_end);
+    strftime(end, sizeof(end), "%I:%M %p", &tm_end);
+    snprintf(output, output_size, "%s - %s", start, end);
+}
+
 int is_same_day(time_t t1, time_t t2) {
-    struct tm* tm1 = localtime(&t1);
-    struct tm* tm2 = localtime(&t2);
+    struct tm tm1, tm2;
+    localtime_r(&t1, &tm1);
+    localtime_r(&t2, &tm2);
     
-    return (tm1->tm_year == tm2->tm_year &&
-            tm1->tm_mon == tm2->tm_mon &&
-            tm1->tm_mday == tm2->tm_mday);
+    return (tm1.tm_year == tm2.tm_year &&
+            tm1.tm_mon == tm2.tm_mon &&
+            tm1.tm_mday == tm2.tm_mday);
 }
 
 int is_same_week(time_t t1, time_t t2) {
-    struct tm* tm1 = localtime(&t1);
-    struct tm* tm2 = localtime(&t2);
+    struct tm tm1, tm2;
+    localtime_r(&t1, &tm1);
+    localtime_r(&t2, &tm2);
     
     // Calculate week number
-    int week1 = tm1->tm_yday / 7;
-    int week2 = tm2->tm_yday / 7;
+    int week1 = tm1.tm_yday / 7;
+    int week2 = tm2.tm_yday / 7;
     
-    return (tm1->tm_year == tm2->tm_year && week1 == week2);
+    return (tm1.tm_year == tm2.tm_year && week1 == week2);
 }
 
 int is_same_month(time_t t1, time_t t2) {
-    struct tm* tm1 = localtime(&t1);
-    struct tm* tm2 = localtime(&t2);
+    struct tm tm1, tm2;
+    localtime_r(&t1, &tm1);
+    localtime_r(&t2, &tm2);
     
-    return (tm1->tm_year == tm2->tm_year && tm1->tm_mon == tm2->tm_mon);
+    return (tm1.tm_year == tm2.tm_year && tm1.tm_mon == tm2.tm_mon);
 }
 
 int server_is_running(void) {
-    // Try to connect to the server port to check if it's running
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
+    return server_running_pid() > 0;
+}
+
+// The pid of the server running in this directory, or 0. Only the lock
+// counts: a stale pid file or another program on the port doesn't.
+pid_t server_running_pid(void) {
+    int fd = open(SERVER_PID_PATH, O_RDONLY);
+    if (fd < 0) {
         return 0;
     }
     
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
     
-    int result = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
-    close(sock);
+    pid_t pid = 0;
+    if (fcntl(fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK) {
+        pid = lock.l_pid;
+    }
+    close(fd);
+    return pid;
+}
+
+// Locks the pid file for as long as the process lives, so a crashed server
+// never leaves a stale owner behind. Returns the descriptor, or -1 when
+// another server holds it.
+int server_acquire_lock(void) {
+    int fd = open(SERVER_PID_PATH, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    
+    if (fcntl(fd, F_SETLK, &lock) != 0) {
+        close(fd);
+        return -1;
+    }
     
-    return (result == 0) ? 1 : 0;
+    char pid[32];
+    int length = snprintf(pid, sizeof(pid), "%d\n", (int)getpid());
+    if (ftruncate(fd, 0) != 0 || write(fd, pid, length) != length) {
+        fprintf(stderr, "Cannot write %s\n", SERVER_PID_PATH);
+    }
+    
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// Tells the server in this directory that the reminders changed under it,
+// so it can reschedule; it otherwise sleeps until the next one it knows of
+void server_notify_changed(void) {
+    pid_t pid = server_running_pid();
+    if (pid > 0) {
+        kill(pid, SIGUSR1);
+    }
 }
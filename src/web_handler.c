@@ -1,9 +1,11 @@
+#define _DEFAULT_SOURCE
 #include "agenda.h"
 #include <microhttpd.h>
 
+// Fixed text such as errors and redirects, sent straight from the string
 static struct MHD_Response* create_response(const char* content, const char* content_type) {
     struct MHD_Response* response = MHD_create_response_from_buffer(
-        strlen(content), (void*)content, MHD_RESPMEM_MUST_COPY);
+        strlen(content), (void*)content, MHD_RESPMEM_PERSISTENT);
     
     if (response) {
         MHD_add_response_header(response, "Content-Type", content_type);
@@ -13,45 +15,215 @@ static struct MHD_Response* create_response(const char* content, const char* con
     return response;
 }
 
-static enum MHD_Result handle_calendar_request(struct MHD_Connection* connection) {
-    char* ics_content = generate_ics_calendar();
+// Pages that query the database and render run on a worker thread while
+// their connection is suspended, so a slow export never holds up the
+// event loop. Redirects, 404s and 503s are answered on the spot.
+typedef enum {
+    PAGE_MONTH,
+    PAGE_ICS,
+    PAGE_SEARCH,
+    PAGE_YEAR,
+    PAGE_WEEK,
+    PAGE_FREEBUSY
+} page_t;
+
+typedef struct {
+    struct MHD_Connection* connection;
+    page_t page;
+    char calendar_name[CALENDAR_NAME_LEN];  // Empty for the default calendar
+    char* terms;                            // Search arguments; NULL when absent
+    char* from;                             // Also the free/busy and export range
+    char* to;
+    int full_history;                       // /calendar.ics?all
+    char* tags;                             // /calendar.ics?tag= filter; NULL when absent
+    int year;
+    arena_t* arena;                         // The page's memory until its response takes it
+    struct MHD_Response* response;          // Set by the worker before resuming
+    unsigned int status;
+} web_job_t;
+
+static worker_pool_t* web_pool = NULL;
+static volatile int web_stopping = 0;
+
+// Each worker reads the default calendar on its own connection, so renders
+// run in parallel against the WAL snapshot. Named calendars share the
+// cached connection.
+static calendar_t worker_calendars[WEB_WORKER_THREADS];
+
+static struct MHD_Response* error_response(const char* message, unsigned int* status) {
+    *status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+    return create_response(message, "text/plain");
+}
+
+static void release_arena(void* cls) {
+    arena_destroy(cls);
+}
+
+// Hands a page built in the job's arena to libmicrohttpd without copying.
+// The response takes the arena and frees it once the page is sent.
+static struct MHD_Response* page_response(web_job_t* job, const char* content, size_t length,
+                                          const char* content_type) {
+    struct MHD_Response* response = MHD_create_response_from_buffer_with_free_callback_cls(
+        length, content, release_arena, job->arena);
+    
+    if (response) {
+        job->arena = NULL;
+        MHD_add_response_header(response, "Content-Type", content_type);
+        MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    }
+    
+    return response;
+}
+
+// The current month by default. from/to export an inclusive range of
+// dates, open-ended on a side left out, and ?all exports everything.
+// ?tag= keeps the items matching a tag filter, e.g. work+urgent,home.
+static struct MHD_Response* render_calendar(calendar_t* cal, web_job_t* job, unsigned int* status) {
+    time_t start, end;
+    if (job->full_history || job->from || job->to) {
+        if (parse_search_range(job->full_history ? NULL : job->from, job->full_history ? NULL : job->to,
+                               &start, &end) != 0 || end <= start) {
+            *status = MHD_HTTP_BAD_REQUEST;
+            return create_response("Invalid date range", "text/plain");
+        }
+    } else {
+        view_time_range(VIEW_MONTH, clock_now(), &start, &end);
+    }
+    
+    bitmap_t* filter = NULL;
+    if (job->tags && tag_filter(cal, job->tags, &filter) != 0) {
+        *status = MHD_HTTP_BAD_REQUEST;
+        return create_response("Invalid tag filter", "text/plain");
+    }
+    
+    size_t length;
+    char* ics_content = generate_ics_calendar(cal, job->arena, start, end, filter, &length);
+    bitmap_free(filter);
     if (!ics_content) {
-        const char* error_msg = "Error generating calendar";
-        struct MHD_Response* response = create_response(error_msg, "text/plain");
-        enum MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-        MHD_destroy_response(response);
-        return ret;
+        return error_response("Error generating calendar", status);
     }
     
-    struct MHD_Response* response = create_response(ics_content, "text/calendar");
+    struct MHD_Response* response = page_response(job, ics_content, length, "text/calendar");
+    if (!response) {
+        return error_response("Error creating response", status);
+    }
     MHD_add_response_header(response, "Content-Disposition", "attachment; filename=\"agenda.ics\"");
     
-    enum MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-    MHD_destroy_response(response);
-    free(ics_content);
+    *status = MHD_HTTP_OK;
+    return response;
+}
+
+static struct MHD_Response* render_web_interface(calendar_t* cal, web_job_t* job, unsigned int* status) {
+    size_t length;
+    char* html_content = generate_html_calendar(cal, job->arena, &length);
+    if (!html_content) {
+        return error_response("Error generating web interface", status);
+    }
     
-    return ret;
+    struct MHD_Response* response = page_response(job, html_content, length, "text/html");
+    if (!response) {
+        return error_response("Error creating response", status);
+    }
+    
+    *status = MHD_HTTP_OK;
+    return response;
 }
 
-static enum MHD_Result handle_web_interface(struct MHD_Connection* connection) {
-    char* html_content = generate_html_calendar();
+static struct MHD_Response* render_search(calendar_t* cal, web_job_t* job, unsigned int* status) {
+    size_t length;
+    char* html_content = generate_html_search(cal, job->arena, job->terms, job->from, job->to, &length);
     if (!html_content) {
-        const char* error_msg = "Error generating web interface";
-        struct MHD_Response* response = create_response(error_msg, "text/plain");
-        enum MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-        MHD_destroy_response(response);
-        return ret;
+        return error_response("Error generating search results", status);
     }
     
-    struct MHD_Response* response = create_response(html_content, "text/html");
-    enum MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-    MHD_destroy_response(response);
-    free(html_content);
+    struct MHD_Response* response = page_response(job, html_content, length, "text/html");
+    if (!response) {
+        return error_response("Error creating response", status);
+    }
     
-    return ret;
+    *status = MHD_HTTP_OK;
+    return response;
 }
 
-static enum MHD_Result handle_not_found(struct MHD_Connection* connection) {
+static struct MHD_Response* render_year(calendar_t* cal, web_job_t* job, unsigned int* status) {
+    size_t length;
+    char* html_content = generate_html_year(cal, job->arena, job->year, &length);
+    if (!html_content) {
+        return error_response("Error generating year view", status);
+    }
+    
+    struct MHD_Response* response = page_response(job, html_content, length, "text/html");
+    if (!response) {
+        return error_response("Error creating response", status);
+    }
+    
+    *status = MHD_HTTP_OK;
+    return response;
+}
+
+static struct MHD_Response* render_week(calendar_t* cal, web_job_t* job, unsigned int* status) {
+    size_t length;
+    char* html_content = generate_html_week(cal, job->arena, &length);
+    if (!html_content) {
+        return error_response("Error generating week view", status);
+    }
+    
+    struct MHD_Response* response = page_response(job, html_content, length, "text/html");
+    if (!response) {
+        return error_response("Error creating response", status);
+    }
+    
+    *status = MHD_HTTP_OK;
+    return response;
+}
+
+// The from/to dates are inclusive like in search; without them the range
+// starts today and runs FREEBUSY_DEFAULT_DAYS days
+static struct MHD_Response* render_freebusy(calendar_t* cal, web_job_t* job, unsigned int* status) {
+    time_t start, end;
+    if (parse_search_range(job->from, job->to, &start, &end) != 0) {
+        *status = MHD_HTTP_BAD_REQUEST;
+        return create_response("Invalid date range", "text/plain");
+    }
+    
+    if (!job->from || !*job->from) {
+        time_t now = clock_now();
+        struct tm today;
+        localtime_r(&now, &today);
+        today.tm_hour = 0;
+        today.tm_min = 0;
+        today.tm_sec = 0;
+        today.tm_isdst = -1;
+        start = mktime(&today);
+    }
+    if (!job->to || !*job->to) {
+        struct tm last;
+        localtime_r(&start, &last);
+        last.tm_mday += FREEBUSY_DEFAULT_DAYS;
+        last.tm_isdst = -1;
+        end = mktime(&last);
+    }
+    if (end <= start) {
+        *status = MHD_HTTP_BAD_REQUEST;
+        return create_response("Invalid date range", "text/plain");
+    }
+    
+    size_t length;
+    char* ics_content = generate_ics_freebusy(cal, job->arena, start, end, &length);
+    if (!ics_content) {
+        return error_response("Error generating free/busy time", status);
+    }
+    
+    struct MHD_Response* response = page_response(job, ics_content, length, "text/calendar");
+    if (!response) {
+        return error_response("Error creating response", status);
+    }
+    
+    *status = MHD_HTTP_OK;
+    return response;
+}
+
+static struct MHD_Response* not_found_response(unsigned int* status) {
     const char* not_found_html = 
         "<!DOCTYPE html>\n"
         "<html><head><title>404 - Not Found</title></head>\n"
@@ -59,13 +231,214 @@ static enum MHD_Result handle_not_found(struct MHD_Connection* connection) {
         "<p>The requested page was not found.</p>\n"
         "<p><a href=\"/\">Return to Calendar</a></p></body></html>";
     
-    struct MHD_Response* response = create_response(not_found_html, "text/html");
-    enum MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-    MHD_destroy_response(response);
+    *status = MHD_HTTP_NOT_FOUND;
+    return create_response(not_found_html, "text/html");
+}
+
+static struct MHD_Response* unavailable_response(unsigned int* status) {
+    struct MHD_Response* response = create_response("Server busy, try again shortly", "text/plain");
+    MHD_add_response_header(response, "Retry-After", "1");
     
+    *status = MHD_HTTP_SERVICE_UNAVAILABLE;
+    return response;
+}
+
+static enum MHD_Result queue_and_destroy(struct MHD_Connection* connection, unsigned int status,
+                                         struct MHD_Response* response) {
+    enum MHD_Result ret = MHD_queue_response(connection, status, response);
+    MHD_destroy_response(response);
     return ret;
 }
 
+static enum MHD_Result handle_not_found(struct MHD_Connection* connection) {
+    unsigned int status;
+    struct MHD_Response* response = not_found_response(&status);
+    return queue_and_destroy(connection, status, response);
+}
+
+static enum MHD_Result handle_redirect(struct MHD_Connection* connection, const char* url) {
+    char location[CALENDAR_NAME_LEN + 8];
+    snprintf(location, sizeof(location), "%s/", url);
+    
+    struct MHD_Response* response = create_response("", "text/plain");
+    MHD_add_response_header(response, "Location", location);
+    return queue_and_destroy(connection, MHD_HTTP_MOVED_PERMANENTLY, response);
+}
+
+// Runs on a worker thread. Everything the render allocates comes from one
+// arena, which the response takes over; a page that failed frees it here.
+// The job belongs to the connection again as soon as it is resumed, so
+// resuming is the last thing done with it.
+static void render_page(void* arg, int worker) {
+    web_job_t* job = arg;
+    calendar_t* cal = &worker_calendars[worker];
+    
+    if (job->calendar_name[0]) {
+        cal = calendar_acquire(job->calendar_name, 0);
+    }
+    
+    if (web_stopping) {
+        job->response = unavailable_response(&job->status);
+    } else if (!cal) {
+        job->response = not_found_response(&job->status);
+    } else if (!(job->arena = arena_create())) {
+        job->response = error_response("Out of memory", &job->status);
+    } else {
+        switch (job->page) {
+            case PAGE_MONTH:
+                job->response = render_web_interface(cal, job, &job->status);
+                break;
+            case PAGE_ICS:
+                job->response = render_calendar(cal, job, &job->status);
+                break;
+            case PAGE_SEARCH:
+                job->response = render_search(cal, job, &job->status);
+                break;
+            case PAGE_YEAR:
+                job->response = render_year(cal, job, &job->status);
+                break;
+            case PAGE_WEEK:
+                job->response = render_week(cal, job, &job->status);
+                break;
+            case PAGE_FREEBUSY:
+                job->response = render_freebusy(cal, job, &job->status);
+                break;
+        }
+    }
+    
+    // Not taken by a response: the page failed or was never built
+    arena_destroy(job->arena);
+    job->arena = NULL;
+    
+    if (job->calendar_name[0]) {
+        calendar_release(cal);
+    }
+    MHD_resume_connection(job->connection);
+}
+
+static char* copy_argument(struct MHD_Connection* connection, const char* key) {
+    const char* value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, key);
+    return value ? strdup(value) : NULL;
+}
+
+static int requested_year(struct MHD_Connection* connection) {
+    const char* year_arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "y");
+    
+    time_t now = clock_now();
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    int year = tm_now.tm_year + 1900;
+    if (year_arg) {
+        int requested = atoi(year_arg);
+        if (requested >= 1970 && requested <= 9999) {
+            year = requested;
+        }
+    }
+    return year;
+}
+
+// Suspends the connection and queues its page for a worker. The request
+// arguments are copied now; they are not looked up again on the worker.
+static enum MHD_Result submit_page(struct MHD_Connection* connection, page_t page,
+                                   const char* calendar_name, void** con_cls) {
+    web_job_t* job = calloc(1, sizeof(web_job_t));
+    if (!job) {
+        return MHD_NO;
+    }
+    job->connection = connection;
+    job->page = page;
+    snprintf(job->calendar_name, sizeof(job->calendar_name), "%s", calendar_name);
+    if (page == PAGE_SEARCH) {
+        job->terms = copy_argument(connection, "q");
+        job->from = copy_argument(connection, "from");
+        job->to = copy_argument(connection, "to");
+    } else if (page == PAGE_FREEBUSY || page == PAGE_ICS) {
+        job->from = copy_argument(connection, "from");
+        job->to = copy_argument(connection, "to");
+        job->full_history = (page == PAGE_ICS &&
+                             MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "all") != NULL);
+        if (page == PAGE_ICS) {
+            job->tags = copy_argument(connection, "tag");
+        }
+    } else if (page == PAGE_YEAR) {
+        job->year = requested_year(connection);
+    }
+    *con_cls = job;
+    
+    // Suspend first: a worker may finish and resume before submit returns
+    MHD_suspend_connection(connection);
+    if (!web_pool || worker_pool_submit(web_pool, job) != 0) {
+        job->response = unavailable_response(&job->status);
+        MHD_resume_connection(connection);
+    }
+    return MHD_YES;
+}
+
+// Frees the job of a request once libmicrohttpd is done with it, whether
+// the response went out or the client went away
+void web_request_completed(void* cls, struct MHD_Connection* connection,
+                           void** con_cls, enum MHD_RequestTerminationCode toe) {
+    (void)cls;
+    (void)connection;
+    (void)toe;
+    
+    web_job_t* job = *con_cls;
+    if (!job) {
+        return;
+    }
+    if (job->response) {
+        MHD_destroy_response(job->response);
+    }
+    free(job->terms);
+    free(job->from);
+    free(job->to);
+    free(job->tags);
+    free(job);
+    *con_cls = NULL;
+}
+
+int web_workers_start(void) {
+    for (int i = 0; i < WEB_WORKER_THREADS; i++) {
+        calendar_t* cal = &worker_calendars[i];
+        snprintf(cal->path, sizeof(cal->path), "%s", DB_PATH);
+        snprintf(cal->archive_path, sizeof(cal->archive_path), "%s", ARCHIVE_DB_PATH);
+        if (db_open_calendar(cal->path, cal->archive_path, 1, &cal->conn) != 0) {
+            web_workers_stop();
+            return -1;
+        }
+    }
+    
+    // Without the export pool, large exports render on the web worker alone
+    if (ics_export_start() != 0) {
+        fprintf(stderr, "Warning: could not start the export threads; large exports use one thread\n");
+    }
+    
+    web_stopping = 0;
+    web_pool = worker_pool_create(WEB_WORKER_THREADS, WEB_QUEUE_DEPTH, render_page);
+    if (!web_pool) {
+        web_workers_stop();
+        return -1;
+    }
+    return 0;
+}
+
+// Answers the renders still queued with a 503, waits for those in
+// progress and resumes their connections. Must run before the web daemon
+// stops, which expects no suspended connections.
+void web_workers_stop(void) {
+    web_stopping = 1;
+    worker_pool_destroy(web_pool);
+    web_pool = NULL;
+    ics_export_stop();
+    
+    for (int i = 0; i < WEB_WORKER_THREADS; i++) {
+        if (worker_calendars[i].conn) {
+            sqlite3_close(worker_calendars[i].conn);
+            worker_calendars[i].conn = NULL;
+        }
+    }
+}
+
 enum MHD_Result handle_web_request(void* cls, struct MHD_Connection* connection,
                                   const char* url, const char* method,
                                   const char* version, const char* upload_data,
@@ -74,19 +447,59 @@ enum MHD_Result handle_web_request(void* cls, struct MHD_Connection* connection,
     (void)version;
     (void)upload_data;
     (void)upload_data_size;
-    (void)con_cls;
+    
+    // Called again once a worker resumed the connection
+    web_job_t* job = *con_cls;
+    if (job) {
+        enum MHD_Result ret = MHD_queue_response(connection, job->status, job->response);
+        MHD_destroy_response(job->response);
+        job->response = NULL;
+        return ret;
+    }
     
     // Only handle GET requests
     if (strcmp(method, "GET") != 0) {
         return MHD_NO;
     }
     
+    // Named calendars live under /c/<name>/ with the same pages
+    char calendar_name[CALENDAR_NAME_LEN] = "";
+    if (strncmp(url, "/c/", 3) == 0) {
+        const char* name = url + 3;
+        const char* slash = strchr(name, '/');
+        size_t name_length = slash ? (size_t)(slash - name) : strlen(name);
+        
+        if (name_length == 0 || name_length >= sizeof(calendar_name)) {
+            return handle_not_found(connection);
+        }
+        memcpy(calendar_name, name, name_length);
+        calendar_name[name_length] = '\0';
+        
+        // Pages link relative to the calendar's directory
+        if (!slash) {
+            return handle_redirect(connection, url);
+        }
+        
+        // Unknown calendars are turned away without a worker
+        if (!calendar_exists(calendar_name)) {
+            return handle_not_found(connection);
+        }
+        url = slash;
+    }
+    
     // Route requests
     if (strcmp(url, "/") == 0 || strcmp(url, "/index.html") == 0) {
-        return handle_web_interface(connection);
+        return submit_page(connection, PAGE_MONTH, calendar_name, con_cls);
     } else if (strcmp(url, "/calendar.ics") == 0) {
-        return handle_calendar_request(connection);
-    } else {
-        return handle_not_found(connection);
+        return submit_page(connection, PAGE_ICS, calendar_name, con_cls);
+    } else if (strcmp(url, "/search") == 0) {
+        return submit_page(connection, PAGE_SEARCH, calendar_name, con_cls);
+    } else if (strcmp(url, "/year") == 0) {
+        return submit_page(connection, PAGE_YEAR, calendar_name, con_cls);
+    } else if (strcmp(url, "/week") == 0) {
+        return submit_page(connection, PAGE_WEEK, calendar_name, con_cls);
+    } else if (strcmp(url, "/freebusy") == 0) {
+        return submit_page(connection, PAGE_FREEBUSY, calendar_name, con_cls);
     }
+    return handle_not_found(connection);
 }
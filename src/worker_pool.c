@@ -0,0 +1,131 @@
+#include "agenda.h"
+
+// A fixed set of threads taking jobs from a bounded queue. Submitting to a
+// full queue fails at once instead of blocking, so the caller can turn the
+// request away while the pool is saturated.
+
+struct worker_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;
+    worker_job_fn run;
+    pthread_t* threads;
+    int thread_count;
+    void** jobs;                 // Ring buffer of max_queued entries
+    int max_queued;
+    int head;
+    int queued_count;
+    int stopping;
+};
+
+typedef struct {
+    worker_pool_t* pool;
+    int index;
+} worker_start_t;
+
+static void* worker_main(void* arg) {
+    worker_start_t start = *(worker_start_t*)arg;
+    worker_pool_t* pool = start.pool;
+    free(arg);
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->queued_count == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+        }
+        // Jobs already accepted still run when stopping
+        if (pool->queued_count == 0) {
+            break;
+        }
+
+        void* job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % pool->max_queued;
+        pool->queued_count--;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->run(job, start.index);
+
+        pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+// Starts thread_count threads calling run(job, worker) for each submitted
+// job, where worker is the thread's index
+worker_pool_t* worker_pool_create(int thread_count, int max_queued, worker_job_fn run) {
+    worker_pool_t* pool = calloc(1, sizeof(worker_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->threads = calloc(thread_count, sizeof(pthread_t));
+    pool->jobs = calloc(max_queued, sizeof(void*));
+    if (!pool->threads || !pool->jobs) {
+        free(pool->threads);
+        free(pool->jobs);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pool->run = run;
+    pool->max_queued = max_queued;
+
+    for (int i = 0; i < thread_count; i++) {
+        worker_start_t* start = malloc(sizeof(worker_start_t));
+        if (!start) {
+            break;
+        }
+        start->pool = pool;
+        start->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, start) != 0) {
+            free(start);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count < thread_count) {
+        worker_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// Queues job for the next free worker. Returns -1 when the queue is full
+// or the pool is stopping.
+int worker_pool_submit(worker_pool_t* pool, void* job) {
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->stopping || pool->queued_count == pool->max_queued) {
+        pthread_mutex_unlock(&pool->mutex);
+        return -1;
+    }
+
+    pool->jobs[(pool->head + pool->queued_count) % pool->max_queued] = job;
+    pool->queued_count++;
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+// Runs the jobs still queued, then joins the threads
+void worker_pool_destroy(worker_pool_t* pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool);
+}
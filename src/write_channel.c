@@ -0,0 +1,309 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Clients hand their writes to the default calendar to the server in the
+// same directory, over a Unix stream socket next to its pid file, so they
+// join the server's group commits instead of each taking the write lock
+// and committing on their own. One request per connection: the client
+// sends a write_msg_t and reads back the outcome as an int. Without a
+// server listening the client writes directly, as before.
+
+typedef enum {
+    WRITE_MSG_ADD,
+    WRITE_MSG_REMOVE
+} write_msg_op_t;
+
+// Answer of a read replica to every write; the primary's changes would
+// overwrite anything written to it
+#define WRITE_REFUSED_REPLICA (-2)
+
+// Wire format of a write; client and server are built from the same tree
+typedef struct {
+    int op;
+    int id;                      // Item to remove
+    char date[MAX_DATE_LEN];
+    char time[MAX_TIME_LEN];
+    int duration_minutes;
+    char description[MAX_DESCRIPTION_LEN];
+    int offsets[MAX_REMINDERS];
+    int offset_count;
+    char tags[MAX_TAGS][MAX_TAG_LEN];
+    int tag_count;
+} write_msg_t;
+
+static volatile int channel_running = 0;
+static int channel_read_only = 0;
+static int listen_fd = -1;
+static pthread_t accept_thread_id;
+
+// Handlers are detached; stop shuts their sockets down and waits for
+// them to finish their write
+static pthread_mutex_t handlers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handlers_done = PTHREAD_COND_INITIALIZER;
+static int handler_fds[WRITE_CHANNEL_MAX_CLIENTS];
+static int handler_count = 0;
+
+static void socket_address(struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", SERVER_SOCKET_PATH);
+}
+
+static int transfer(int fd, void* buffer, size_t length, int sending) {
+    char* p = buffer;
+    while (length > 0) {
+        ssize_t n = sending ? send(fd, p, length, 0) : recv(fd, p, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        length -= (size_t)n;
+    }
+    return 0;
+}
+
+// Server side
+
+static int apply_message(write_msg_t* msg) {
+    if (channel_read_only) {
+        fprintf(stderr, "Refused a client write: this server is a read replica\n");
+        return WRITE_REFUSED_REPLICA;
+    }
+
+    // Never trust the lengths or the terminators of what arrived
+    msg->date[sizeof(msg->date) - 1] = '\0';
+    msg->time[sizeof(msg->time) - 1] = '\0';
+    msg->description[sizeof(msg->description) - 1] = '\0';
+    for (int i = 0; i < MAX_TAGS; i++) {
+        msg->tags[i][MAX_TAG_LEN - 1] = '\0';
+    }
+
+    switch (msg->op) {
+    case WRITE_MSG_ADD:
+        // Offsets and duration are checked by db_add_item_with_reminders
+        if (msg->offset_count < 0 || msg->offset_count > MAX_REMINDERS ||
+            msg->tag_count < 0 || msg->tag_count > MAX_TAGS) {
+            return -1;
+        }
+        return db_add_item_with_reminders(NULL, msg->date, msg->time, msg->duration_minutes,
+                                          msg->description, msg->offsets, msg->offset_count,
+                                          msg->tags, msg->tag_count);
+    case WRITE_MSG_REMOVE:
+        return db_remove_item(NULL, msg->id);
+    }
+    return -1;
+}
+
+static void handle_connection(int fd) {
+    write_msg_t msg;
+    if (transfer(fd, &msg, sizeof(msg), 0) == 0) {
+        int result = apply_message(&msg);
+        transfer(fd, &result, sizeof(result), 1);
+    }
+    close(fd);
+}
+
+static void handler_unregister(int fd) {
+    pthread_mutex_lock(&handlers_mutex);
+    for (int i = 0; i < handler_count; i++) {
+        if (handler_fds[i] == fd) {
+            handler_fds[i] = handler_fds[--handler_count];
+            break;
+        }
+    }
+    pthread_cond_broadcast(&handlers_done);
+    pthread_mutex_unlock(&handlers_mutex);
+}
+
+static void* write_channel_handler(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    handle_connection(fd);
+    handler_unregister(fd);
+    return NULL;
+}
+
+// Each connection gets its own thread, so concurrent clients queue on the
+// writer together and share commits
+static void* write_channel_accept_thread(void* arg) {
+    (void)arg;
+
+    while (channel_running) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        // A client that stalls mid-message must not hold a handler for good
+        struct timeval timeout = { WRITE_CHANNEL_TIMEOUT_SECONDS, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // Past the limit, wait for a handler to finish; clients wait in the
+        // listen backlog meanwhile
+        pthread_mutex_lock(&handlers_mutex);
+        while (channel_running && handler_count == WRITE_CHANNEL_MAX_CLIENTS) {
+            pthread_cond_wait(&handlers_done, &handlers_mutex);
+        }
+        if (!channel_running) {
+            pthread_mutex_unlock(&handlers_mutex);
+            close(fd);
+            break;
+        }
+        handler_fds[handler_count++] = fd;
+        pthread_mutex_unlock(&handlers_mutex);
+
+        pthread_t handler;
+        if (pthread_create(&handler, NULL, write_channel_handler, (void*)(intptr_t)fd) != 0) {
+            handle_connection(fd);
+            handler_unregister(fd);
+            continue;
+        }
+        pthread_detach(handler);
+    }
+
+    return NULL;
+}
+
+// Called while the server holds its pid file lock, so any socket file
+// left behind belongs to a server that is gone. A read replica listens
+// too, so that clients in its directory are refused rather than falling
+// back to writing its database directly.
+int write_channel_start(int read_only) {
+    struct sockaddr_un addr;
+    socket_address(&addr);
+    unlink(SERVER_SOCKET_PATH);
+
+    // A client that went away before its answer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Only the owner of the database may write through the server. Set
+    // before any other thread runs, as umask is per process.
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(077);
+    int bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(mask);
+    if (!bound || listen(listen_fd, WRITE_CHANNEL_MAX_CLIENTS) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", SERVER_SOCKET_PATH, strerror(errno));
+        if (listen_fd >= 0) close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+    channel_read_only = read_only;
+    channel_running = 1;
+    if (pthread_create(&accept_thread_id, NULL, write_channel_accept_thread, NULL) != 0) {
+        channel_running = 0;
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(SERVER_SOCKET_PATH);
+        return -1;
+    }
+    return 0;
+}
+
+// Stops taking writes and waits for those in progress; the writer must
+// still be running
+void write_channel_stop(void) {
+    if (!channel_running) {
+        return;
+    }
+
+    // Removed first, so clients from now on write directly
+    unlink(SERVER_SOCKET_PATH);
+    shutdown(listen_fd, SHUT_RDWR);
+
+    // Handlers still waiting for a client's message give up; one already
+    // writing finishes, only its answer is lost
+    pthread_mutex_lock(&handlers_mutex);
+    channel_running = 0;
+    for (int i = 0; i < handler_count; i++) {
+        shutdown(handler_fds[i], SHUT_RDWR);
+    }
+    pthread_cond_broadcast(&handlers_done);
+    pthread_mutex_unlock(&handlers_mutex);
+
+    pthread_join(accept_thread_id, NULL);
+
+    pthread_mutex_lock(&handlers_mutex);
+    while (handler_count > 0) {
+        pthread_cond_wait(&handlers_done, &handlers_mutex);
+    }
+    pthread_mutex_unlock(&handlers_mutex);
+
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+// Client side
+
+// Sends msg to the server in this directory. Returns -1 when no server
+// took it, so the caller should write directly; otherwise 0, with the
+// server's outcome in *result.
+static int send_message(const write_msg_t* msg, int* result) {
+    struct sockaddr_un addr;
+    socket_address(&addr);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Once connected the server may have applied the write, so a lost
+    // answer is a failure rather than a reason to write it again
+    signal(SIGPIPE, SIG_IGN);
+    if (transfer(fd, (void*)msg, sizeof(*msg), 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (transfer(fd, result, sizeof(*result), 0) != 0) {
+        fprintf(stderr, "The server did not answer; the write may not have happened\n");
+        *result = -1;
+    } else if (*result == WRITE_REFUSED_REPLICA) {
+        fprintf(stderr, "The server in this directory is a read replica; write to its primary\n");
+        *result = -1;
+    }
+    close(fd);
+    return 0;
+}
+
+int write_channel_add(const char* date, const char* time, int duration_minutes, const char* description,
+                      const int* offsets, int offset_count, char (*tags)[MAX_TAG_LEN], int tag_count,
+                      int* result) {
+    write_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.op = WRITE_MSG_ADD;
+    snprintf(msg.date, sizeof(msg.date), "%s", date);
+    snprintf(msg.time, sizeof(msg.time), "%s", time);
+    msg.duration_minutes = duration_minutes;
+    snprintf(msg.description, sizeof(msg.description), "%s", description);
+    for (int i = 0; i < offset_count && i < MAX_REMINDERS; i++) {
+        msg.offsets[i] = offsets[i];
+    }
+    msg.offset_count = offset_count < MAX_REMINDERS ? offset_count : MAX_REMINDERS;
+    for (int i = 0; i < tag_count && i < MAX_TAGS; i++) {
+        snprintf(msg.tags[i], sizeof(msg.tags[i]), "%s", tags[i]);
+    }
+    msg.tag_count = tag_count < MAX_TAGS ? tag_count : MAX_TAGS;
+
+    return send_message(&msg, result);
+}
+
+int write_channel_remove(int id, int* result) {
+    write_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.op = WRITE_MSG_REMOVE;
+    msg.id = id;
+
+    return send_message(&msg, result);
+}
@@ -21,10 +21,35 @@ echo "Testing add functionality..."
 ./algen add tomorrow 09:00:00 "Morning standup"
 ./algen add 01/07/2025 16:00:00 "Project deadline"
 
+if ./algen add tomorrow 10:00:00 "No reminders" --remind "" 2>/dev/null; then
+    echo "❌ Empty reminder list was accepted"
+else
+    echo "✅ Empty reminder list is rejected"
+fi
+
 echo ""
 echo "Testing get functionality..."
 ./algen get today
 
+echo ""
+echo "Testing tags..."
+./algen add today 23:50:00 "Tagged A $$" --tag test-a
+./algen add today 23:51:00 "Tagged A and B $$" --tag test-a,test-b
+./algen add today 23:52:00 "Tagged B $$" --tag test-b
+
+if [ "$(./algen get today --tag test-a,test-b | grep -c "Tagged .* $$")" = "3" ]; then
+    echo "✅ Tag filter with ',' matches either tag"
+else
+    echo "❌ Tag filter with ',' does not match either tag"
+fi
+
+ANY_BOTH=$(./algen get today --tag test-a+test-b)
+if echo "$ANY_BOTH" | grep -q "Tagged A and B $$" && [ "$(echo "$ANY_BOTH" | grep -c "Tagged .* $$")" = "1" ]; then
+    echo "✅ Tag filter with '+' requires both tags"
+else
+    echo "❌ Tag filter with '+' does not require both tags"
+fi
+
 echo ""
 echo "Testing server startup..."
 echo "Starting server in background..."
@@ -47,6 +72,14 @@ else
     echo "❌ ICS calendar is not accessible"
 fi
 
+echo "Testing tag-filtered ICS calendar..."
+TAGGED_ICS=$(curl -s "http://localhost:8080/calendar.ics?tag=test-b")
+if echo "$TAGGED_ICS" | grep -q "Tagged B $$" && ! echo "$TAGGED_ICS" | grep -q "Tagged A $$"; then
+    echo "✅ ICS calendar is filtered by tag"
+else
+    echo "❌ ICS calendar is not filtered by tag"
+fi
+
 echo ""
 echo "Stopping server..."
 kill $SERVER_PID 2>/dev/null
@@ -1,4 +1,4 @@
-#include "agenda.h"
+#include "notification_ui.h"
 
 int main() {
     // Add multiple notifications to the stack to test stacking
@@ -0,0 +1,86 @@
+#!/bin/bash
+
+# Test script for read replicas: a primary and a replica on one machine,
+# each in its own directory with its own agenda.db
+
+echo "Testing read replication..."
+
+if ! make headless; then
+    echo "Build failed!"
+    exit 1
+fi
+
+ROOT=$(pwd)
+WORK=$(mktemp -d)
+SOCKET="$WORK/replication.sock"
+mkdir -p "$WORK/primary" "$WORK/replica"
+
+cd "$WORK/primary"
+"$ROOT/algen" add tomorrow 09:00 "Written before the replica existed"
+"$ROOT/algen-server" --notify=stdout --replication-socket="$SOCKET" > "$WORK/primary.log" 2>&1 &
+PRIMARY_PID=$!
+
+cd "$WORK/replica"
+"$ROOT/algen-server" --notify=stdout --port=8081 --replica-of="$SOCKET" > "$WORK/replica.log" 2>&1 &
+REPLICA_PID=$!
+
+sleep 3
+
+check_replica() {
+    if curl -s http://localhost:8081/calendar.ics | grep -q "$1"; then
+        echo "✅ Replica $2"
+    else
+        echo "❌ Replica $2"
+    fi
+}
+
+check_replica "Written before the replica existed" "received the snapshot"
+
+cd "$WORK/primary"
+"$ROOT/algen" add tomorrow 10:00 "Written while replicating" --tag work
+ID=$("$ROOT/algen" get week | grep -B1 "Written before" | sed -n 's/.*\[ID: \([0-9]*\)\].*/\1/p')
+"$ROOT/algen" remove "$ID"
+sleep 1
+
+check_replica "Written while replicating" "received a new item"
+
+if curl -s "http://localhost:8081/calendar.ics?tag=work" | grep -q "Written while replicating"; then
+    echo "✅ Replica received tags"
+else
+    echo "❌ Replica received tags"
+fi
+
+if curl -s http://localhost:8081/calendar.ics | grep -q "Written before the replica existed"; then
+    echo "❌ Replica kept a removed item"
+else
+    echo "✅ Replica dropped a removed item"
+fi
+
+# A restarted replica resumes from its last applied change
+kill $REPLICA_PID
+wait $REPLICA_PID 2>/dev/null
+"$ROOT/algen" add tomorrow 11:00 "Written while the replica was down"
+cd "$WORK/replica"
+"$ROOT/algen-server" --notify=stdout --port=8081 --replica-of="$SOCKET" >> "$WORK/replica.log" 2>&1 &
+REPLICA_PID=$!
+sleep 3
+
+check_replica "Written while the replica was down" "caught up after a restart"
+
+# Writes in a replica's directory are refused, not applied to its copy
+if "$ROOT/algen" add tomorrow 12:00 "Written to the replica" 2>/dev/null; then
+    echo "❌ Replica refused a client write"
+else
+    echo "✅ Replica refused a client write"
+fi
+if curl -s http://localhost:8081/calendar.ics | grep -q "Written to the replica"; then
+    echo "❌ Replica kept a client write"
+else
+    echo "✅ Replica kept no client write"
+fi
+
+kill $PRIMARY_PID $REPLICA_PID
+wait 2>/dev/null
+rm -rf "$WORK"
+
+echo "Replication test completed!"
@@ -1,4 +1,4 @@
-#include "agenda.h"
+#include "notification_ui.h"
 
 int main() {
     printf("Testing raylib visual notification directly...\n");
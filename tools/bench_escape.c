@@ -0,0 +1,216 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+
+// HTML and iCalendar escaping throughput for each scan kernel the CPU
+// supports, against a byte-at-a-time baseline. Every kernel's output is
+// checked against the scalar kernel's, and folded ICS lines are checked
+// for length and UTF-8 boundaries.
+//
+//   build/bench_escape [descriptions] [rounds]
+
+static const char* const kernel_names[] = { "scalar", "sse2", "avx2", "neon" };
+
+static const char* const words[] = {
+    "meeting", "with", "the", "team", "review", "dentist", "café", "☕", "project",
+    "Q3", "planning", "lunch", "call", "über", "日本語", "deadline", "retro", "1:1",
+    "appointment", "pick", "up", "kids", "from", "school", "budget", "draft"
+};
+
+// Mixed in now and then
+static const char* const special_words[] = {
+    "&", "<b>", "\"quoted\"", "it's", "a,b", "x;y", "C:\\tmp"
+};
+
+// The escaping before the scan kernels, one branch per byte
+static size_t html_escape_baseline(const char* input, char* output, size_t output_size) {
+    size_t length = 0;
+    for (const char* p = input; *p; p++) {
+        const char* entity = NULL;
+        switch (*p) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            case '\'': entity = "&#39;"; break;
+            default: break;
+        }
+        size_t needed = entity ? strlen(entity) : 1;
+        if (length + needed >= output_size) break;
+        if (entity) {
+            memcpy(output + length, entity, needed);
+        } else {
+            output[length] = *p;
+        }
+        length += needed;
+    }
+    output[length] = '\0';
+    return length;
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Descriptions of realistic length, mostly plain words; one in eight has
+// a newline
+static char (*make_descriptions(int count, size_t* total))[MAX_DESCRIPTION_LEN] {
+    char (*descriptions)[MAX_DESCRIPTION_LEN] = calloc(count, MAX_DESCRIPTION_LEN);
+    if (!descriptions) {
+        return NULL;
+    }
+
+    unsigned int seed = 42;
+    *total = 0;
+    for (int i = 0; i < count; i++) {
+        size_t target = 20 + rand_r(&seed) % 200;
+        size_t length = 0;
+        while (length < target) {
+            const char* word = (rand_r(&seed) % 16 == 0)
+                ? special_words[rand_r(&seed) % (sizeof(special_words) / sizeof(special_words[0]))]
+                : words[rand_r(&seed) % (sizeof(words) / sizeof(words[0]))];
+            size_t word_length = strlen(word);
+            if (length + word_length + 2 >= MAX_DESCRIPTION_LEN) break;
+            memcpy(descriptions[i] + length, word, word_length);
+            length += word_length;
+            char separator = (i % 8 == 0 && length > 60 && length < 70) ? '\n' : ' ';
+            descriptions[i][length++] = separator;
+        }
+        descriptions[i][length] = '\0';
+        *total += length;
+    }
+    return descriptions;
+}
+
+// Every line at most ICS_LINE_OCTETS and never starting inside a UTF-8
+// sequence; unfolding gives back "NAME:" and the escaped value
+static int check_folding(const char* property, const char* name, const char* value) {
+    char unfolded[ICS_TEXT_SIZE(16, MAX_DESCRIPTION_LEN)];
+    size_t length = 0;
+    const char* line = property;
+    for (;;) {
+        const char* end = strstr(line, "\r\n");
+        if (!end || end - line > ICS_LINE_OCTETS) return -1;
+        if (line != property) {
+            if (line[0] != ' ' || ((unsigned char)line[1] & 0xC0) == 0x80) return -1;
+            line++;
+        }
+        memcpy(unfolded + length, line, end - line);
+        length += end - line;
+        if (end[2] == '\0') break;
+        line = end + 2;
+    }
+    unfolded[length] = '\0';
+
+    size_t name_length = strlen(name);
+    if (strncmp(unfolded, name, name_length) != 0 || unfolded[name_length] != ':') return -1;
+    const char* p = unfolded + name_length + 1;
+    for (const char* v = value; *v; v++) {
+        if (*v == '\r') continue;
+        if (*v == '\\' || *v == ';' || *v == ',' || *v == '\n') {
+            if (*p++ != '\\') return -1;
+            if (*p++ != (*v == '\n' ? 'n' : *v)) return -1;
+        } else if (*p++ != *v) {
+            return -1;
+        }
+    }
+    return *p == '\0' ? 0 : -1;
+}
+
+static double bench_html(char (*descriptions)[MAX_DESCRIPTION_LEN], int count, int rounds,
+                         size_t (*escape)(const char*, char*, size_t), unsigned long* checksum) {
+    char output[MAX_DESCRIPTION_LEN * 6];
+    *checksum = 0;
+    double start = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            size_t length = escape(descriptions[i], output, sizeof(output));
+            *checksum = *checksum * 31 + length + (unsigned char)output[length / 2];
+        }
+    }
+    return now_seconds() - start;
+}
+
+static double bench_ics(char (*descriptions)[MAX_DESCRIPTION_LEN], int count, int rounds,
+                        unsigned long* checksum) {
+    char output[ICS_TEXT_SIZE(sizeof("DESCRIPTION"), MAX_DESCRIPTION_LEN)];
+    *checksum = 0;
+    double start = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            size_t length = ics_append_text(output, sizeof(output), "DESCRIPTION", descriptions[i]);
+            *checksum = *checksum * 31 + length + (unsigned char)output[length / 2];
+        }
+    }
+    return now_seconds() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 50;
+    if (count <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [descriptions] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    size_t total = 0;
+    char (*descriptions)[MAX_DESCRIPTION_LEN] = make_descriptions(count, &total);
+    if (!descriptions) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    double megabytes = (double)total * rounds / 1e6;
+    printf("%d descriptions, %.1f MB per pass (default kernel: %s)\n",
+           count, megabytes, escape_kernel_name());
+
+    unsigned long expected_html, expected_ics, checksum;
+    double seconds = bench_html(descriptions, count, rounds, html_escape_baseline, &expected_html);
+    double baseline_html = seconds;
+    printf("  %-8s html %8.0f MB/s\n", "baseline", megabytes / seconds);
+
+    escape_use_kernel("scalar");
+    bench_ics(descriptions, count, 1, &expected_ics);
+    double baseline_ics = 0;
+
+    int failures = 0;
+    for (size_t k = 0; k < sizeof(kernel_names) / sizeof(kernel_names[0]); k++) {
+        if (escape_use_kernel(kernel_names[k]) != 0) {
+            continue;
+        }
+
+        double html_seconds = bench_html(descriptions, count, rounds, html_escape, &checksum);
+        if (checksum != expected_html) {
+            printf("  %s: HTML output differs from the baseline\n", kernel_names[k]);
+            failures++;
+        }
+
+        double ics_seconds = bench_ics(descriptions, count, rounds, &checksum);
+        unsigned long single_round;
+        bench_ics(descriptions, count, 1, &single_round);
+        if (single_round != expected_ics) {
+            printf("  %s: ICS output differs from the scalar kernel\n", kernel_names[k]);
+            failures++;
+        }
+        if (baseline_ics == 0) {
+            baseline_ics = ics_seconds;
+        }
+
+        printf("  %-8s html %8.0f MB/s (%.1fx)   ics %8.0f MB/s (%.1fx)\n", kernel_names[k],
+               megabytes / html_seconds, baseline_html / html_seconds,
+               megabytes / ics_seconds, baseline_ics / ics_seconds);
+    }
+
+    char property[ICS_TEXT_SIZE(sizeof("DESCRIPTION"), MAX_DESCRIPTION_LEN)];
+    for (int i = 0; i < count; i++) {
+        ics_append_text(property, sizeof(property), "DESCRIPTION", descriptions[i]);
+        if (check_folding(property, "DESCRIPTION", descriptions[i]) != 0) {
+            printf("  bad folding for description %d\n", i);
+            failures++;
+            break;
+        }
+    }
+
+    free(descriptions);
+    return failures ? 1 : 0;
+}
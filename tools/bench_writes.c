@@ -0,0 +1,130 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+
+// Insert throughput with concurrent writers, committing each write on its
+// own connection, through the group-commit writer, and through the write
+// channel the way client processes reach a running server. Runs in a fresh
+// temporary directory.
+//
+//   build/bench_writes [threads] [writes-per-thread]
+
+typedef enum {
+    BENCH_DIRECT,
+    BENCH_WRITER,
+    BENCH_CHANNEL
+} bench_mode_t;
+
+typedef struct {
+    bench_mode_t mode;
+    calendar_t* cal;    // NULL goes through the writer
+    int writes;
+    int failures;
+} bench_worker_t;
+
+static void* bench_worker(void* arg) {
+    bench_worker_t* worker = arg;
+    char description[64];
+    const int default_offset = NOTIFICATION_ADVANCE_MINUTES;
+
+    for (int i = 0; i < worker->writes; i++) {
+        snprintf(description, sizeof(description), "Benchmark item %d", i);
+        if (worker->mode == BENCH_CHANNEL) {
+            int result;
+            if (write_channel_add("2030-01-15", "10:00:00", 0, description, &default_offset, 1, NULL, 0, &result) != 0 ||
+                result != 0) {
+                worker->failures++;
+            }
+        } else if (db_add_item(worker->cal, "2030-01-15", "10:00:00", description) != 0) {
+            worker->failures++;
+        }
+    }
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double run(int threads, int writes, bench_mode_t mode) {
+    pthread_t ids[threads];
+    bench_worker_t workers[threads];
+    calendar_t calendars[threads];
+    int failures = 0;
+
+    memset(calendars, 0, sizeof(calendars));
+    for (int t = 0; t < threads; t++) {
+        workers[t].mode = mode;
+        workers[t].cal = NULL;
+        workers[t].writes = writes;
+        workers[t].failures = 0;
+        // Without the writer every thread needs a connection of its own
+        if (mode == BENCH_DIRECT) {
+            if (db_open_calendar(DB_PATH, ARCHIVE_DB_PATH, 1, &calendars[t].conn) != 0) {
+                return -1;
+            }
+            workers[t].cal = &calendars[t];
+        }
+    }
+
+    if (mode != BENCH_DIRECT && db_writer_start() != 0) {
+        return -1;
+    }
+    if (mode == BENCH_CHANNEL && write_channel_start(0) != 0) {
+        db_writer_stop();
+        return -1;
+    }
+
+    double start = now_seconds();
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&ids[t], NULL, bench_worker, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        failures += workers[t].failures;
+    }
+    double elapsed = now_seconds() - start;
+
+    if (mode == BENCH_CHANNEL) {
+        write_channel_stop();
+    }
+    if (mode != BENCH_DIRECT) {
+        db_writer_stop();
+    } else {
+        for (int t = 0; t < threads; t++) {
+            sqlite3_close(calendars[t].conn);
+        }
+    }
+
+    if (failures > 0) {
+        printf("  %d writes failed\n", failures);
+    }
+    return threads * writes / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    int threads = (argc > 1) ? atoi(argv[1]) : 16;
+    int writes = (argc > 2) ? atoi(argv[2]) : 500;
+    if (threads <= 0 || writes <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [writes-per-thread]\n", argv[0]);
+        return 1;
+    }
+
+    char directory[] = "/tmp/algen-bench-XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("%d threads x %d inserts in %s\n", threads, writes, directory);
+    double direct = run(threads, writes, BENCH_DIRECT);
+    printf("  commit per write: %10.0f inserts/s\n", direct);
+    double grouped = run(threads, writes, BENCH_WRITER);
+    printf("  group commit:     %10.0f inserts/s\n", grouped);
+    double channel = run(threads, writes, BENCH_CHANNEL);
+    printf("  write channel:    %10.0f inserts/s\n", channel);
+
+    db_close();
+    return (direct > 0 && grouped > 0 && channel > 0) ? 0 : 1;
+}
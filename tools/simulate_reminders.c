@@ -0,0 +1,241 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+
+// Replays the server's reminder scheduling over simulated days on a
+// virtual clock: claim what is due, then sleep until the next reminder,
+// as schedule_reminders does. Each "sleep" moves the clock instead of
+// waiting, so a year runs in seconds. Reports reminders delivered late or
+// missed (their item had already started, so the server retires them
+// unseen) and database statements per simulated day. Runs in a fresh
+// temporary directory.
+//
+//   build/simulate_reminders [days] [items-per-day] [offline-hours] [poll-seconds]
+//
+// offline-hours takes the machine down from midnight every day, like a
+// laptop asleep overnight. poll-seconds > 0 checks on a fixed interval
+// instead of sleeping until the next reminder, for comparison.
+
+#define LATE_SECONDS 60          // Delivered later than this counts as late
+#define SIMULATION_START_YEAR 2030
+
+// Reminder offsets an item gets, one set picked per item
+static const char* const offset_sets[] = { "15m", "5m", "1h,10m", "1d,1h,5m" };
+
+typedef struct {
+    int on_time;
+    int late;
+    int missed;
+    long long late_seconds;      // Summed over late reminders
+    long long worst_late_seconds;
+    int wakeups;
+} simulation_stats_t;
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static time_t day_start(int year, int day) {
+    struct tm tm_day = {0};
+    tm_day.tm_year = year - 1900;
+    tm_day.tm_mday = 1 + day;
+    tm_day.tm_isdst = -1;
+    return mktime(&tm_day);
+}
+
+// When the machine is next up, at or after t
+static time_t next_online(time_t t, int offline_hours) {
+    struct tm tm_now = *localtime(&t);
+    if (tm_now.tm_hour >= offline_hours) {
+        return t;
+    }
+    tm_now.tm_hour = offline_hours;
+    tm_now.tm_min = 0;
+    tm_now.tm_sec = 0;
+    tm_now.tm_isdst = -1;
+    return mktime(&tm_now);
+}
+
+static int add_items(int days, int items_per_day, int* reminder_count) {
+    unsigned int seed = 7;
+    *reminder_count = 0;
+
+    for (int day = 0; day < days; day++) {
+        time_t midnight = day_start(SIMULATION_START_YEAR, day);
+        char date[MAX_DATE_LEN];
+        strftime(date, sizeof(date), "%Y-%m-%d", localtime(&midnight));
+
+        for (int i = 0; i < items_per_day; i++) {
+            // Quarter hours from 08:00 to 21:45
+            int quarter = 32 + rand_r(&seed) % 56;
+            char time_str[MAX_TIME_LEN];
+            snprintf(time_str, sizeof(time_str), "%02d:%02d:00", quarter / 4, quarter % 4 * 15);
+
+            int offsets[MAX_REMINDERS];
+            const char* set = offset_sets[rand_r(&seed) % (sizeof(offset_sets) / sizeof(offset_sets[0]))];
+            int offset_count = parse_reminder_offsets(set, offsets, MAX_REMINDERS);
+
+            char description[64];
+            snprintf(description, sizeof(description), "Simulated item %d on day %d", i, day);
+            if (db_add_item_with_reminders(NULL, date, time_str, 0, description, offsets, offset_count,
+                                           NULL, 0) != 0) {
+                return -1;
+            }
+            *reminder_count += offset_count;
+        }
+    }
+    return 0;
+}
+
+// Sorts one claimed batch the way the delivery thread would see it
+static void classify(const reminder_t* reminders, int count, time_t now, simulation_stats_t* stats) {
+    for (int i = 0; i < count; i++) {
+        long long late_by = (long long)(now - reminders[i].fire_at);
+        if (reminders[i].item.datetime < now) {
+            stats->missed++;
+        } else if (late_by > LATE_SECONDS) {
+            stats->late++;
+            stats->late_seconds += late_by;
+            if (late_by > stats->worst_late_seconds) stats->worst_late_seconds = late_by;
+        } else {
+            stats->on_time++;
+        }
+    }
+}
+
+static int run(time_t start, time_t end, int offline_hours, int poll_seconds,
+               unsigned long* day_statements, simulation_stats_t* stats) {
+    int days = (int)((end - start + 86399) / 86400);
+    time_t now = start;
+    unsigned long statements_before = db_statement_count();
+    int day = 0;
+
+    while (now < end) {
+        now = next_online(now, offline_hours);
+        if (now >= end) break;
+        clock_advance_to(now);
+
+        // Statements are charged to the day they ran on
+        int today = (int)((now - start) / 86400);
+        if (today != day && today < days) {
+            unsigned long total = db_statement_count();
+            day_statements[day] += total - statements_before;
+            statements_before = total;
+            day = today;
+        }
+
+        reminder_t* reminders;
+        int count;
+        time_t next_fire_at = 0;
+        stats->wakeups++;
+        if (db_claim_due_reminders(NULL, now, &reminders, &count) != 0) {
+            next_fire_at = now + REMINDER_RETRY_SECONDS;
+        } else {
+            classify(reminders, count, now, stats);
+            free(reminders);
+            if (db_next_reminder_time(NULL, &next_fire_at) != 0) {
+                next_fire_at = now + REMINDER_RETRY_SECONDS;
+            }
+        }
+
+        if (poll_seconds > 0) {
+            now += poll_seconds;
+        } else {
+            now = (next_fire_at > now) ? next_fire_at : end;
+        }
+    }
+    day_statements[day] += db_statement_count() - statements_before;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int days = (argc > 1) ? atoi(argv[1]) : 365;
+    int items_per_day = (argc > 2) ? atoi(argv[2]) : 10;
+    int offline_hours = (argc > 3) ? atoi(argv[3]) : 0;
+    int poll_seconds = (argc > 4) ? atoi(argv[4]) : 0;
+    if (days <= 0 || items_per_day <= 0 || offline_hours < 0 || offline_hours > 23 || poll_seconds < 0) {
+        fprintf(stderr, "Usage: %s [days] [items-per-day] [offline-hours] [poll-seconds]\n", argv[0]);
+        return 1;
+    }
+
+    char directory[] = "/tmp/algen-simulate-XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    time_t start = day_start(SIMULATION_START_YEAR, 0);
+    time_t end = day_start(SIMULATION_START_YEAR, days);
+    clock_use_virtual(start);
+
+    double started = now_seconds();
+    int reminder_count;
+    if (db_init() != 0 || add_items(days, items_per_day, &reminder_count) != 0) {
+        fprintf(stderr, "Setting up the simulation failed\n");
+        return 1;
+    }
+
+    printf("%d days x %d items, %d reminders in %s (set up in %.1fs)\n",
+           days, items_per_day, reminder_count, directory, now_seconds() - started);
+    if (offline_hours > 0) {
+        printf("  offline 00:00-%02d:00 every day\n", offline_hours);
+    }
+    if (poll_seconds > 0) {
+        printf("  scheduler: polling every %d seconds\n", poll_seconds);
+    } else {
+        printf("  scheduler: sleeps until the next reminder\n");
+    }
+
+    // Count only the scheduler's statements, on a connection opened for it
+    db_close();
+    db_count_statements(1);
+    if (db_init() != 0) {
+        return 1;
+    }
+
+    unsigned long* day_statements = calloc(days, sizeof(unsigned long));
+    simulation_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    started = now_seconds();
+    if (!day_statements || run(start, end, offline_hours, poll_seconds, day_statements, &stats) != 0) {
+        fprintf(stderr, "Simulation failed\n");
+        return 1;
+    }
+    double elapsed = now_seconds() - started;
+
+    // Anything still undelivered was never claimed at all
+    reminder_t* unclaimed;
+    int unclaimed_count;
+    if (db_get_due_reminders(NULL, end - 1, &unclaimed, &unclaimed_count) != 0) {
+        return 1;
+    }
+    free(unclaimed);
+
+    unsigned long total_statements = 0, busiest_day = 0;
+    for (int day = 0; day < days; day++) {
+        total_statements += day_statements[day];
+        if (day_statements[day] > busiest_day) busiest_day = day_statements[day];
+    }
+
+    char late_label[32];
+    snprintf(late_label, sizeof(late_label), "late (> %ds)", LATE_SECONDS);
+    printf("  %-20s %8d\n", "on time", stats.on_time);
+    printf("  %-20s %8d", late_label, stats.late);
+    if (stats.late > 0) {
+        printf("   mean %lld min, worst %lld min",
+               stats.late_seconds / stats.late / 60, stats.worst_late_seconds / 60);
+    }
+    printf("\n  %-20s %8d   item started before the reminder went out\n", "missed", stats.missed);
+    printf("  %-20s %8d\n", "never claimed", unclaimed_count);
+    // Reminders due before the start were retired when their item was added
+    printf("  %-20s %8d\n", "retired when added",
+           reminder_count - stats.on_time - stats.late - stats.missed - unclaimed_count);
+    printf("  %.1f wakeups and %.1f DB statements per simulated day (busiest day %lu)\n",
+           (double)stats.wakeups / days, (double)total_statements / days, busiest_day);
+    printf("  simulated %d days in %.2fs\n", days, elapsed);
+
+    free(day_statements);
+    db_close();
+    return unclaimed_count == 0 ? 0 : 1;
+}
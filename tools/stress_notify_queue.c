@@ -0,0 +1,110 @@
+#define _DEFAULT_SOURCE
+#include "agenda.h"
+
+// Floods the algen-stack notification queue from several producer
+// threads while this thread drains it like the render loop does, pausing
+// for a "frame" now and then so the queue fills and producers have to
+// wait. Every message must arrive exactly once and in order per
+// producer; a full queue may slow producers down but never loses one.
+//
+//   build/stress_notify_queue [producers] [messages per producer]
+
+#define MAX_PRODUCERS 64
+
+static int producer_count;
+static int message_count;
+static pthread_t producers[MAX_PRODUCERS];
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void* produce(void* arg) {
+    int id = (int)(long)arg;
+    char title[16];
+    char message[16];
+
+    snprintf(title, sizeof(title), "%d", id);
+    for (int i = 0; i < message_count; i++) {
+        snprintf(message, sizeof(message), "%d", i);
+        notification_queue_push(title, message, "stress");
+    }
+    return NULL;
+}
+
+// Queues the end marker once every producer is done
+static void* close_queue(void* arg) {
+    (void)arg;
+    for (int i = 0; i < producer_count; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    notification_queue_push("end", "", "");
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    producer_count = argc > 1 ? atoi(argv[1]) : 4;
+    message_count = argc > 2 ? atoi(argv[2]) : 200000;
+    if (producer_count <= 0 || producer_count > MAX_PRODUCERS || message_count <= 0) {
+        fprintf(stderr, "Usage: %s [producers] [messages per producer]\n", argv[0]);
+        return 1;
+    }
+
+    int last[MAX_PRODUCERS];
+    for (int i = 0; i < producer_count; i++) {
+        last[i] = -1;
+    }
+
+    double start = now_seconds();
+    for (int i = 0; i < producer_count; i++) {
+        if (pthread_create(&producers[i], NULL, produce, (void*)(long)i) != 0) {
+            fprintf(stderr, "Cannot start producer %d\n", i);
+            return 1;
+        }
+    }
+    pthread_t closer;
+    if (pthread_create(&closer, NULL, close_queue, NULL) != 0) {
+        fprintf(stderr, "Cannot start the closing thread\n");
+        return 1;
+    }
+
+    long received = 0;
+    long out_of_order = 0;
+    long frames = 0;
+    notification_msg_t msg;
+    for (;;) {
+        if (!notification_queue_pop(&msg)) {
+            notification_queue_wait();
+            continue;
+        }
+        if (strcmp(msg.title, "end") == 0) {
+            break;
+        }
+
+        int producer = atoi(msg.title);
+        int sequence = atoi(msg.message);
+        if (producer < 0 || producer >= producer_count || sequence != last[producer] + 1) {
+            out_of_order++;
+        } else {
+            last[producer] = sequence;
+        }
+        received++;
+
+        // A frame's worth of drawing every few hundred messages
+        if (received % 512 == 0) {
+            frames++;
+            usleep(1000);
+        }
+    }
+    double seconds = now_seconds() - start;
+    pthread_join(closer, NULL);
+
+    long expected = (long)producer_count * message_count;
+    printf("%d producers, %ld messages through a %d entry queue in %.2fs (%.0f/s, %ld frames)\n",
+           producer_count, expected, NOTIFICATION_QUEUE_CAPACITY, seconds, received / seconds, frames);
+    printf("  received %ld, lost %ld, out of order %ld\n", received, expected - received, out_of_order);
+
+    return (received == expected && out_of_order == 0) ? 0 : 1;
+}
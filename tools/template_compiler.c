@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Compiles page templates into C tables of static fragments and typed
+// slots, so rendering only lists pointers and never copies markup.
+//
+//   build/template_compiler <output-base> <file.tmpl>...
+//
+// writes <output-base>.c and <output-base>.h. A template file holds named
+// blocks; everything outside them must be blank or a comment:
+//
+//   {{define name}}...{{end}}   a block; one newline after the tag is dropped
+//   {{slot}}                    text, HTML-escaped at render time
+//   {{raw slot}}                text inserted as is
+//   {{int slot}}                an integer
+//   {{! comment}}
+
+#define MAX_NAME_LEN 64
+#define MAX_BLOCKS 128
+#define MAX_PARTS 256
+#define MAX_SLOTS 16
+
+typedef enum {
+    PART_FRAGMENT,
+    PART_TEXT,
+    PART_RAW,
+    PART_INT
+} part_kind_t;
+
+typedef struct {
+    part_kind_t kind;
+    const char* text;            // Fragments point into the source file
+    size_t length;
+    int slot;
+} part_t;
+
+typedef struct {
+    char name[MAX_NAME_LEN];
+    part_kind_t kind;
+} slot_t;
+
+typedef struct {
+    char name[MAX_NAME_LEN];
+    const char* file;
+    part_t parts[MAX_PARTS];
+    int part_count;
+    slot_t slots[MAX_SLOTS];
+    int slot_count;
+} block_t;
+
+static block_t blocks[MAX_BLOCKS];
+static int block_count = 0;
+
+static const char* current_file;
+static const char* current_source;
+
+static int line_of(const char* p) {
+    int line = 1;
+    for (const char* s = current_source; s < p; s++) {
+        if (*s == '\n') line++;
+    }
+    return line;
+}
+
+static void fail(const char* at, const char* message, const char* detail) {
+    fprintf(stderr, "%s:%d: %s%s%s\n", current_file, line_of(at), message,
+            detail ? ": " : "", detail ? detail : "");
+    exit(1);
+}
+
+static char* read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = malloc(size + 1);
+    if (!source || fread(source, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        exit(1);
+    }
+    source[size] = '\0';
+    fclose(file);
+    return source;
+}
+
+// Copies a tag's words; returns how many there were (at most two)
+static int split_tag(const char* tag, size_t length, char words[2][MAX_NAME_LEN]) {
+    int count = 0;
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && isspace((unsigned char)tag[i])) i++;
+        if (i == length) break;
+        if (count == 2) return 3;
+
+        size_t start = i;
+        while (i < length && !isspace((unsigned char)tag[i])) i++;
+        if (i - start >= MAX_NAME_LEN) return 3;
+        memcpy(words[count], tag + start, i - start);
+        words[count][i - start] = '\0';
+        count++;
+    }
+    return count;
+}
+
+static int valid_name(const char* name) {
+    if (!islower((unsigned char)name[0])) return 0;
+    for (const char* p = name; *p; p++) {
+        if (!islower((unsigned char)*p) && !isdigit((unsigned char)*p) && *p != '_') return 0;
+    }
+    return 1;
+}
+
+static void add_part(block_t* block, const char* at, part_t part) {
+    if (block->part_count == MAX_PARTS) {
+        fail(at, "too many parts in block", block->name);
+    }
+    block->parts[block->part_count++] = part;
+}
+
+static void add_slot(block_t* block, const char* at, part_kind_t kind, const char* name) {
+    if (!valid_name(name)) {
+        fail(at, "bad slot name", name);
+    }
+
+    int slot = 0;
+    while (slot < block->slot_count && strcmp(block->slots[slot].name, name) != 0) {
+        slot++;
+    }
+    if (slot == block->slot_count) {
+        if (slot == MAX_SLOTS) {
+            fail(at, "too many slots in block", block->name);
+        }
+        strcpy(block->slots[slot].name, name);
+        block->slots[slot].kind = kind;
+        block->slot_count++;
+    } else if (block->slots[slot].kind != kind) {
+        fail(at, "slot used with two types", name);
+    }
+
+    part_t part = { kind, NULL, 0, slot };
+    add_part(block, at, part);
+}
+
+static void parse_file(const char* path) {
+    char* source = read_file(path);
+    current_file = path;
+    current_source = source;
+
+    block_t* block = NULL;
+    const char* p = source;
+    for (;;) {
+        const char* open = strstr(p, "{{");
+        const char* text_end = open ? open : p + strlen(p);
+
+        if (block) {
+            if (text_end > p) {
+                part_t part = { PART_FRAGMENT, p, (size_t)(text_end - p), 0 };
+                add_part(block, p, part);
+            }
+        } else {
+            for (const char* s = p; s < text_end; s++) {
+                if (!isspace((unsigned char)*s)) fail(s, "text outside a block", NULL);
+            }
+        }
+        if (!open) break;
+
+        const char* close = strstr(open + 2, "}}");
+        if (!close) {
+            fail(open, "unterminated tag", NULL);
+        }
+        p = close + 2;
+
+        const char* tag = open + 2;
+        size_t tag_length = close - tag;
+        if (tag_length > 0 && tag[0] == '!') {
+            continue;
+        }
+
+        char words[2][MAX_NAME_LEN];
+        int word_count = split_tag(tag, tag_length, words);
+        if (word_count == 0 || word_count > 2) {
+            fail(open, "bad tag", NULL);
+        }
+
+        if (strcmp(words[0], "define") == 0) {
+            if (block) fail(open, "define inside block", block->name);
+            if (word_count != 2 || !valid_name(words[1])) fail(open, "bad block name", NULL);
+            for (int i = 0; i < block_count; i++) {
+                if (strcmp(blocks[i].name, words[1]) == 0) fail(open, "block defined twice", words[1]);
+            }
+            if (block_count == MAX_BLOCKS) fail(open, "too many blocks", NULL);
+
+            block = &blocks[block_count++];
+            strcpy(block->name, words[1]);
+            block->file = path;
+            if (*p == '\n') p++;
+        } else if (strcmp(words[0], "end") == 0) {
+            if (!block || word_count != 1) fail(open, "unexpected end", NULL);
+            if (block->part_count == 0) fail(open, "empty block", block->name);
+            block = NULL;
+        } else if (!block) {
+            fail(open, "slot outside a block", words[0]);
+        } else if (word_count == 1) {
+            add_slot(block, open, PART_TEXT, words[0]);
+        } else if (strcmp(words[0], "raw") == 0) {
+            add_slot(block, open, PART_RAW, words[1]);
+        } else if (strcmp(words[0], "int") == 0) {
+            add_slot(block, open, PART_INT, words[1]);
+        } else {
+            fail(open, "unknown slot type", words[0]);
+        }
+    }
+
+    if (block) {
+        fail(p, "missing end", block->name);
+    }
+    // Fragments keep pointing into source until the output is written
+}
+
+static void write_upper(FILE* out, const char* name) {
+    for (const char* p = name; *p; p++) {
+        fputc(toupper((unsigned char)*p), out);
+    }
+}
+
+// Writes a fragment as C string literals, one per source line. Question
+// marks are escaped so no trigraph can form.
+static void write_literal(FILE* out, const char* text, size_t length) {
+    fputc('"', out);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        switch (c) {
+            case '\n':
+                fputs("\\n\"", out);
+                if (i + 1 < length) fputs("\n          \"", out);
+                continue;
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '?': fputs("\\?", out); break;
+            case '\t': fputs("\\t", out); break;
+            default:
+                if (c < 0x20 || c == 0x7f) {
+                    fprintf(out, "\\%03o", c);
+                } else {
+                    fputc(c, out);
+                }
+        }
+    }
+    if (length == 0 || text[length - 1] != '\n') fputc('"', out);
+}
+
+static void write_slot_name(FILE* out, const block_t* block, int slot) {
+    fprintf(out, "TMPL_");
+    write_upper(out, block->name);
+    fputc('_', out);
+    write_upper(out, block->slots[slot].name);
+}
+
+static const char* slot_type_name(part_kind_t kind) {
+    switch (kind) {
+        case PART_TEXT: return "SLOT_TEXT";
+        case PART_RAW: return "SLOT_RAW";
+        case PART_INT: return "SLOT_INT";
+        default: return "SLOT_NONE";
+    }
+}
+
+static FILE* open_output(const char* base, const char* suffix, char* path, size_t path_size) {
+    snprintf(path, path_size, "%s%s", base, suffix);
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(out, "// Generated by tools/template_compiler.c from the .tmpl files; do not edit\n\n");
+    return out;
+}
+
+static void write_header(const char* base) {
+    char path[1024];
+    FILE* out = open_output(base, ".h", path, sizeof(path));
+
+    fprintf(out, "#ifndef TEMPLATES_H\n#define TEMPLATES_H\n\n#include \"agenda.h\"\n");
+    for (int b = 0; b < block_count; b++) {
+        const block_t* block = &blocks[b];
+        fprintf(out, "\n// %s: %s\n", block->file, block->name);
+        if (block->slot_count > 0) {
+            fprintf(out, "enum {\n");
+            for (int s = 0; s < block->slot_count; s++) {
+                fprintf(out, "    ");
+                write_slot_name(out, block, s);
+                fprintf(out, ",\n");
+            }
+            fprintf(out, "};\n");
+        }
+        fprintf(out, "extern const template_t tmpl_%s;\n", block->name);
+    }
+    fprintf(out, "\n#endif // TEMPLATES_H\n");
+
+    if (fclose(out) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static void write_source(const char* base) {
+    char path[1024];
+    FILE* out = open_output(base, ".c", path, sizeof(path));
+
+    fprintf(out, "#include \"templates.h\"\n");
+    for (int b = 0; b < block_count; b++) {
+        const block_t* block = &blocks[b];
+        fprintf(out, "\nstatic const template_part_t %s_parts[] = {\n", block->name);
+        for (int i = 0; i < block->part_count; i++) {
+            const part_t* part = &block->parts[i];
+            if (part->kind == PART_FRAGMENT) {
+                fprintf(out, "    { ");
+                write_literal(out, part->text, part->length);
+                fprintf(out, ", %zu, SLOT_NONE, 0 },\n", part->length);
+            } else {
+                fprintf(out, "    { NULL, 0, %s, ", slot_type_name(part->kind));
+                write_slot_name(out, block, part->slot);
+                fprintf(out, " },\n");
+            }
+        }
+        fprintf(out, "};\n");
+        fprintf(out, "const template_t tmpl_%s = { \"%s\", %s_parts, %d, %d };\n",
+                block->name, block->name, block->name, block->part_count, block->slot_count);
+    }
+
+    if (fclose(out) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output-base> <file.tmpl>...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        parse_file(argv[i]);
+    }
+    write_header(argv[1]);
+    write_source(argv[1]);
+    return 0;
+}